@@ -29,27 +29,35 @@
 
 #include "mip/mip_init.h"
 #include "mip/upe/action.h"
-#include "mip/upe/add_content_footer_action.h"
-#include "mip/upe/add_content_header_action.h"
-#include "mip/upe/add_watermark_action.h"
-#include "mip/upe/custom_action.h"
 #include "mip/upe/label.h"
-#include "mip/upe/metadata_action.h"
-#include "mip/upe/protect_by_template_action.h"
-#include "mip/upe/remove_content_footer_action.h"
-#include "mip/upe/remove_content_header_action.h"
-#include "mip/upe/remove_watermark_action.h"
 
-#include <iostream>
+#include "result_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
 #include <future>
+#include <iostream>
+#include <set>
+#include <thread>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif // __linux__
 
 using sample::auth::AuthDelegateImpl;
+using std::cerr;
 using std::cout;
 using std::endl;
-using std::future;
+using std::exception;
+using std::exception_ptr;
+using std::lock_guard;
 using std::make_shared;
+using std::mutex;
 using std::pair;
-using std::promise;
 using std::runtime_error;
 using std::shared_ptr;
 using std::string;
@@ -59,50 +67,53 @@ using std::vector;
 
 namespace {
 
-string GetContentAlignmentStr(mip::ContentMarkAlignment alignment) {
-  switch (alignment) {
-    case mip::ContentMarkAlignment::LEFT:
-      return "Left";
-    case mip::ContentMarkAlignment::RIGHT:
-      return "Right";
-    case mip::ContentMarkAlignment::CENTER:
-      return "Center";
-    default:
-      throw runtime_error("Unrecognized ContentMarkAlignment");
-  }
+// Requests share an in-flight evaluation only within one cache generation, so none joins an evaluation that started
+// before a policy reload was published
+string GetFlightKey(uint64_t generation, const string& engineId, const string& fingerprint) {
+  string key = std::to_string(generation);
+  key += '\n';
+  key += engineId;
+  key += '\n';
+  key += fingerprint;
+  return key;
 }
 
-string GetWatermarkLayoutStr(mip::WatermarkLayout layout) {
-  switch (layout) {
-    case mip::WatermarkLayout::HORIZONTAL:
-      return "Horizontal";
-    case mip::WatermarkLayout::DIAGONAL:
-      return "Diagonal";
-    default:
-      throw runtime_error("Unrecognized WatermarkLayout");
-  }
+// Last good results are kept per identity rather than per engine, so they survive the engine being reloaded or evicted
+string GetStaleResultKey(const sample::upe::ExecutionStateImpl& state) {
+  const sample::upe::ExecutionStateOptions& options = state.GetOptions();
+  string key = options.username;
+  key += '\n';
+  key += options.delegatedEmail;
+  key += '\n';
+  key += state.GetFingerprint();
+  return key;
 }
 
-void PrintLabel(const shared_ptr<mip::Label>& label, int indentLevel = 0) {
-  string indent(indentLevel * 4, ' ');
-
-  cout << indent << "LABEL:\n" <<
-      indent << "  Id: " << label->GetId() << "\n" <<
-      indent << "  Name: " << label->GetName() << "\n" <<
-      indent << "  Description: " << label->GetDescription() << "\n" <<
-      indent << "  IsActive: " << (label->IsActive() ? "true" : "false") << "\n" <<
-      indent << "  Color: " << label->GetColor() << "\n" <<
-      indent << "  Sensitivity: " << label->GetSensitivity() << "\n" <<
-      indent << "  Tooltip: " << label->GetTooltip() << endl;
-
-  shared_ptr<mip::Label> parent = label->GetParent().lock();
-  if (nullptr != parent)
-    cout << indent << "  Parent Id: " << parent->GetId() << endl;
+// Replica the calling thread is served by, set by Action::PinThreadToEngineReplica
+thread_local size_t tReplicaSlot = 0;
+
+// Same estimate LabelCache uses for a memoized label
+const size_t kApproximateContentLabelBytes = 256;
+
+// Resident set size of the process, or 0 where it cannot be read
+size_t GetResidentMemoryBytes() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  size_t totalPages = 0;
+  size_t residentPages = 0;
+  if (statm >> totalPages >> residentPages)
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif // __linux__
+  return 0;
+}
 
-  if (!label->GetChildren().empty()) {
-    cout << indent << "  Children:" << endl;
-    for (const shared_ptr<mip::Label>& child : label->GetChildren())
-      PrintLabel(child, indentLevel + 1);
+string GetErrorMessage(const exception_ptr& error) {
+  try {
+    std::rethrow_exception(error);
+  } catch (const exception& ex) {
+    return ex.what();
+  } catch (...) {
+    return "Unknown error";
   }
 }
 
@@ -112,161 +123,83 @@ void PrintSensitivityType(const shared_ptr<mip::SensitivityTypesRulePackage>& ty
       "  Rule: " << type->GetRulePackage() << endl;
 }
 
-void PrintAction(const shared_ptr<mip::Action>& action) {
-  cout << "ACTION:\n" << "  Id: " << action->GetId() << endl;
-
-  switch (action->GetType()) {
-    case mip::ActionType::ADD_CONTENT_FOOTER: {
-      auto derivedAction = static_cast<mip::AddContentFooterAction*>(action.get());
-      cout << "  Type: AddContentFooter" << "\n" <<
-          "  UIElementName: " << derivedAction->GetUIElementName() << "\n" <<
-          "  Text: " << derivedAction->GetText() << "\n" <<
-          "  FontName: " << derivedAction->GetFontName() << "\n" <<
-          "  FontSize: " << derivedAction->GetFontSize() << "\n" <<
-          "  FontColor: " << derivedAction->GetFontColor() << "\n" <<
-          "  Alignment: " << GetContentAlignmentStr(derivedAction->GetAlignment()) << "\n" <<
-          "  Margin: " << derivedAction->GetMargin() << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::ADD_CONTENT_HEADER: {
-      auto derivedAction = static_cast<mip::AddContentHeaderAction*>(action.get());
-      cout << "  Type: AddContentHeader" << "\n" <<
-          "  UIElementName: " << derivedAction->GetUIElementName() << "\n" <<
-          "  Text: " << derivedAction->GetText() << "\n" <<
-          "  FontName: " << derivedAction->GetFontName() << "\n" <<
-          "  FontSize: " << derivedAction->GetFontSize() << "\n" <<
-          "  FontColor: " << derivedAction->GetFontColor() << "\n" <<
-          "  Alignment: " << GetContentAlignmentStr(derivedAction->GetAlignment()) << "\n" <<
-          "  Margin: " << derivedAction->GetMargin() << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::ADD_WATERMARK: {
-      auto derivedAction = static_cast<mip::AddWatermarkAction*>(action.get());
-      cout << "  Type: AddWatermarkAction" << "\n" <<
-          "  UIElementName: " << derivedAction->GetUIElementName() << "\n" <<
-          "  Layout: " << GetWatermarkLayoutStr(derivedAction->GetLayout()) << "\n" <<
-          "  Text: " << derivedAction->GetText() << "\n" <<
-          "  FontName: " << derivedAction->GetFontName() << "\n" <<
-          "  FontSize: " << derivedAction->GetFontSize() << "\n" <<
-          "  FontColor: " << derivedAction->GetFontColor() << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::CUSTOM: {
-      auto derivedAction = static_cast<mip::CustomAction*>(action.get());
-      cout << "  Type: Custom" << "\n";
-      if (!derivedAction->GetProperties().empty()) {
-        cout << "  Properties:" << "\n";
-        for (const pair<string, string>& prop : derivedAction->GetProperties())
-          cout << "    '" << prop.first << "' : '" << prop.second << "'\n";
-      }
-      cout << endl;
-      break;
-    }
-
-    case mip::ActionType::JUSTIFY: {
-      cout << "  Type: Justify" << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::METADATA: {
-      auto derivedAction = static_cast<mip::MetadataAction*>(action.get());
-      cout << "  Type: Metadata" << "\n";
-      if (!derivedAction->GetMetadataToRemove().empty()) {
-        cout << "  Remove:" << "\n";
-        for (const string& prop : derivedAction->GetMetadataToRemove())
-          cout << "    '" << prop << "'\n";
-      }
-      if (!derivedAction->GetMetadataToAdd().empty()) {
-        cout << "  Add:" << "\n";
-        for (const pair<string, string>& prop : derivedAction->GetMetadataToAdd())
-          cout << "    '" << prop.first << "' : '" << prop.second << "'\n";
-      }
-      cout << endl;
-      break;
-    }
-
-    case mip::ActionType::PROTECT_ADHOC: {
-      cout << "  Type: ProtectAdHoc" << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::PROTECT_BY_TEMPLATE: {
-      auto derivedAction = static_cast<mip::ProtectByTemplateAction*>(action.get());
-      cout << "  Type: ProtectByTemplate" << "\n" <<
-          "  TemplateId: " << derivedAction->GetTemplateId() << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::PROTECT_DO_NOT_FORWARD: {
-      cout << "  Type: ProtectDoNotForward" << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::REMOVE_CONTENT_FOOTER: {
-      auto derivedAction = static_cast<mip::RemoveContentFooterAction*>(action.get());
-      cout << "  Type: RemoveContentFooterAction" << "\n";
-      if (!derivedAction->GetUIElementNames().empty()) {
-        cout << "  UIElementNames:\n";
-        for (const string& element : derivedAction->GetUIElementNames())
-            cout << "    " << element << "\n";
-      }
-      cout << endl;
-      break;
-    }
-
-    case mip::ActionType::REMOVE_CONTENT_HEADER: {
-      auto derivedAction = static_cast<mip::RemoveContentHeaderAction*>(action.get());
-      cout << "  Type: RemoveContentHeaderAction" << "\n";
-      if (!derivedAction->GetUIElementNames().empty()) {
-        cout << "  UIElementNames:\n";
-        for (const string& element : derivedAction->GetUIElementNames())
-            cout << "    " << element << "\n";
-      }
-      cout << endl;
-      break;
-    }
-
-    case mip::ActionType::REMOVE_PROTECTION: {
-      cout << "  Type: RemoveProtection" << "\n" << endl;
-      break;
-    }
-
-    case mip::ActionType::REMOVE_WATERMARK: {
-      auto derivedAction = static_cast<mip::RemoveWatermarkAction*>(action.get());
-      cout << "  Type: RemoveWatermarkAction" << "\n";
-      if (!derivedAction->GetUIElementNames().empty()) {
-        cout << "  UIElementNames:\n";
-        for (const string& element : derivedAction->GetUIElementNames())
-            cout << "    " << element << "\n";
-      }
-      cout << endl;
-      break;
-    }
-
-    default: {
-      throw runtime_error("Unrecognized ActionType");
-    }
-  }
-}
-
 } // namespace
 
 namespace sample {
 namespace upe {
 
+// State shared between WarmUpEngines and the continuations of the engine loads it starts. Each continuation holds a
+// reference, so loads still pending when WarmUpEngines throws complete into it rather than into a dead stack frame.
+struct Action::WarmUpContext {
+  void Complete(size_t index, const exception_ptr& error, const shared_ptr<mip::PolicyEngine>& engine) {
+    EngineLoad& load = loads[index];
+    load.latency = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - load.start);
+    load.policyFetch = PolicyProfileObserverImpl::GetPolicyFetchOnThisThread();
+    load.engine = engine;
+    if (error)
+      load.error = GetErrorMessage(error);
+
+    lock_guard<mutex> lock(completionMutex);
+    completedLoads.push_back(index);
+    loadCompleted.notify_one();
+  }
+
+  vector<EngineLoad> loads;
+  mutex completionMutex;
+  std::condition_variable loadCompleted;
+  vector<size_t> completedLoads;
+};
+
 Action::Action(
     const AuthenticationOptions& authOptions,
     const ProfileOptions& profileOptions,
     const string& locale,
     const string& workingDirectory, 
-    bool loadSensitivityTypes)
+    bool loadSensitivityTypes,
+    StartupTimeline& startupTimeline)
     : mAuthOptions(authOptions),
       mProfileOptions(profileOptions),
+      mStartupTimeline(startupTimeline),
+      mProfile(mProfilePromise.get_future().share()),
       mLocale(locale),
-      mLoadSensitivityTypes(loadSensitivityTypes) {
+      mLoadSensitivityTypes(loadSensitivityTypes),
+      mEngineCache(
+          profileOptions.engineCacheSize,
+          [this](const mip::Identity& identity, const string& engineId) { return LoadCachedEngine(identity, engineId); },
+          [this](const string& engineId) { UnloadPolicyEngine(engineId); }),
+      mIsLoadingReplicas(false),
+      mIsReplicaLoadPaused(false),
+      mIsStoppingReplicaLoads(false),
+      mReplicaLoadTime(0),
+      mSharedEngineMemory(0),
+      mReplicatedEngineMemory(0),
+      mActionCache(profileOptions.actionCacheSize, profileOptions.actionCacheBytes),
+      mLabelCache(profileOptions.labelCacheSize, profileOptions.labelCacheBytes),
+      mActionFlights(profileOptions.coalesceRequests),
+      mLabelFlights(profileOptions.coalesceRequests),
+      mStaleActions(profileOptions.staleResultCacheSize, profileOptions.staleResultCacheBytes),
+      mStaleLabels(profileOptions.staleResultCacheSize, profileOptions.staleResultCacheBytes),
+      mIsEngineLoadDisabled(false),
+      mPublishedReloads(0),
+      mDeadlinesExceeded(0),
+      mStaleResults(0),
+      mActionPlanHits(0),
+      mActionPlanTables(0),
+      mLastActionPlanSize(0),
+      mLastActionPlanBytes(0),
+      mLastActionPlanBuildTime(0),
+      mReloadScheduler(
+          std::chrono::milliseconds(profileOptions.reloadQuietPeriodMs),
+          std::chrono::milliseconds(profileOptions.reloadMaxDelayMs),
+          profileOptions.maxConcurrentReloads,
+          [this](const string& engineId) { ReloadPolicyEngine(engineId); }) {
+  if (!profileOptions.sharedResultCacheName.empty()) {
+    mSharedResults.reset(new SharedResultCache(
+        profileOptions.sharedResultCacheName,
+        profileOptions.sharedResultCacheSlots,
+        profileOptions.sharedResultCacheSlotBytes));
+  }
+
   // Auth delegate will be used to acquire policy from SCC service when profileOptions.policyType == PolicyType::Server
   mAuthDelegate = make_shared<AuthDelegateImpl>(
       false /*isVerbose*/,
@@ -301,34 +234,137 @@ Action::Action(
 
   settings.SetMinimumLogLevel(mip::LogLevel::Trace); // set the minimum log level to trace for easier debugging
 
-  // Create a context to pass to 'PolicyProfile::LoadAsync'. That context will be forwarded to the corresponding
-  // PolicyProfile::Observer methods. In this case, we use promises/futures as a simple way to to detect the async
-  // operation completions synchronously.
-  auto loadPromise = make_shared<promise<shared_ptr<mip::PolicyProfile>>>();
-  future<shared_ptr<mip::PolicyProfile>> loadFuture = loadPromise->get_future();
-
+  // 'PolicyProfile::LoadAsync' takes a context that is forwarded to the corresponding PolicyProfile::Observer methods.
+  // AsyncProfileOperations passes a pooled completion token as that context. Rather than blocking here, the profile is
+  // published to mProfile once the token completes and GetProfile waits for it.
+  //
   // A profile should be created and held for the duration of the application lifetime
-  mip::PolicyProfile::LoadAsync(settings, loadPromise /*context*/);
-  mProfile = loadFuture.get();
+  mProfileOperations.Load(
+      settings,
+      [this](const std::exception_ptr& error, const shared_ptr<mip::PolicyProfile>& profile) {
+        if (error) {
+          mProfilePromise.set_exception(error);
+        } else {
+          mStartupTimeline.Record(StartupTimeline::Stage::ProfileLoaded);
+          mProfilePromise.set_value(profile);
+        }
+      });
 }
 
 Action::~Action() {
+  // The pending profile load and background engine load reference this Action
+  mProfile.wait();
+  if (mEngineLoadThread.joinable())
+    mEngineLoadThread.join();
+
   // Uninitialize MIP prior to process termination
-  mEngine = nullptr;
-  mProfile = nullptr;
+  mReloadScheduler.Shutdown();
+  {
+    lock_guard<mutex> lock(mReplicaMutex);
+    mIsStoppingReplicaLoads = true;
+    mPendingReplicaEngine.reset();
+  }
+  mReplicaLoadRequested.notify_all();
+  if (mReplicaLoadThread.joinable())
+    mReplicaLoadThread.join();
+  std::atomic_store(&mDefaultEngine, shared_ptr<CachedEngine>());
+  shared_ptr<const vector<shared_ptr<CachedEngine>>> replicas =
+      std::atomic_exchange(&mEngineReplicas, shared_ptr<const vector<shared_ptr<CachedEngine>>>());
+  if (nullptr != replicas)
+    ReleaseEngineReplicas(*replicas);
+  mEngineCache.Clear();
+  mProfile = std::shared_future<shared_ptr<mip::PolicyProfile>>();
+  mProfilePromise = std::promise<shared_ptr<mip::PolicyProfile>>();
   mip::ReleaseAllResources();
 }
 
+void Action::LoadEngineInBackground() {
+  if (mEngineLoadThread.joinable())
+    return;
+
+  mEngineLoadThread = std::thread([this] {
+    // A failed load is not cached, so the first request retries it and reports the error
+    try {
+      GetDefaultEngine();
+    } catch (...) {
+    }
+  });
+}
+
+// Quiesces the background work that calls into the SDK or takes Action locks, then takes every Action lock, so that a
+// process forked now gets them unlocked and consistent. Reloads and replica loads are paused rather than cancelled: a
+// policy change arriving meanwhile is still recorded, and the engine cache waits for its background loads and unloads.
+// Locks held by threads inside the SDK itself cannot be controlled from here; quiescing only ensures none of them is
+// running an operation this Action started.
+void Action::PrepareFork() {
+  mReloadScheduler.Pause();
+  {
+    std::unique_lock<mutex> lock(mReplicaMutex);
+    mIsReplicaLoadPaused = true;
+    mReplicaLoadRequested.wait(lock, [this] { return !mIsLoadingReplicas; });
+  }
+  if (mEngineLoadThread.joinable())
+    mEngineLoadThread.join();
+
+  // Waiting on background work is done; from here on nothing blocks while holding a lock
+  mEngineCache.LockForFork();
+  mForkEngines.clear();
+  shared_ptr<const vector<shared_ptr<CachedEngine>>> replicas = std::atomic_load(&mEngineReplicas);
+  if (nullptr != replicas)
+    mForkEngines = *replicas;
+  else if (shared_ptr<CachedEngine> defaultEngine = std::atomic_load(&mDefaultEngine))
+    mForkEngines.push_back(defaultEngine);
+  for (const shared_ptr<CachedEngine>& engine : mForkEngines)
+    engine->handlers.LockForFork();
+  mReplicaMutex.lock();
+  mActionPlanMutex.lock();
+  mActionCache.LockForFork();
+  mLabelCache.LockForFork();
+  mActionFlights.LockForFork();
+  mLabelFlights.LockForFork();
+  mStaleActions.LockForFork();
+  mStaleLabels.LockForFork();
+  mReloadScheduler.LockForFork();
+}
+
+void Action::UnlockAfterFork() {
+  mReloadScheduler.UnlockAfterFork();
+  mStaleLabels.UnlockAfterFork();
+  mStaleActions.UnlockAfterFork();
+  mLabelFlights.UnlockAfterFork();
+  mActionFlights.UnlockAfterFork();
+  mLabelCache.UnlockAfterFork();
+  mActionCache.UnlockAfterFork();
+  mActionPlanMutex.unlock();
+  mReplicaMutex.unlock();
+  for (const shared_ptr<CachedEngine>& engine : mForkEngines)
+    engine->handlers.UnlockAfterFork();
+  mForkEngines.clear();
+  mEngineCache.UnlockAfterFork();
+}
+
+void Action::AfterForkInParent() {
+  UnlockAfterFork();
+  {
+    lock_guard<mutex> lock(mReplicaMutex);
+    mIsReplicaLoadPaused = false;
+  }
+  mReplicaLoadRequested.notify_all();
+  mReloadScheduler.Resume();
+}
+
+// The child has only the forking thread: reloads and replica loads stay paused, and engines are never loaded
+void Action::AfterForkInChild() {
+  UnlockAfterFork();
+  mIsEngineLoadDisabled = true;
+}
+
 // Lists all engines known to the profile (from the storage cache). Note that if the optional 'useStorageCache' sample
 // app flag is not set, this will return empty results.
 void Action::ListEngines() {
-  // Create a context to pass to 'PolicyProfile::ListEnginesAsync'. That context will be forwarded to the corresponding
-  // PolicyProfile::Observer methods. In this case, we use promises/futures as a simple way to to detect the async 
-  // operation completions synchronously.
-  auto listEnginesPromise = make_shared<promise<vector<string>>>();
-  future<vector<string>> listEnginesFuture = listEnginesPromise->get_future();
-  mProfile->ListEnginesAsync(listEnginesPromise);
-  const vector<string>& engineIds = listEnginesFuture.get();
+  // As with every PolicyProfile async operation, the context passed to 'PolicyProfile::ListEnginesAsync' is a completion
+  // token that PolicyProfileObserverImpl completes. In this case, we wait for it synchronously.
+  const vector<string> engineIds = mProfileOperations.ListEnginesAndWait(*GetProfile());
 
   if (engineIds.empty()) {
     cout << "NO CACHED ENGINES" << endl;
@@ -339,80 +375,412 @@ void Action::ListEngines() {
   }
 }
 
-// Creates/loads an engine and prints all labels defined in the policy
-void Action::ListLabels() {
-  EnsurePolicyEngine();
+// Loads cached engines concurrently. The loads are started from this thread and complete through continuations, so no
+// thread is blocked per pending load; this thread only waits for completions and hands each engine to the cache.
+void Action::WarmUpEngines(size_t maxEngines, size_t maxConcurrentLoads, std::ostream& report) {
+  Clock::time_point start = Clock::now();
+  vector<string> engineIds = mProfileOperations.ListEnginesAndWait(*GetProfile());
+  size_t count = std::min(engineIds.size(), mProfileOptions.engineCacheSize);
+  if (maxEngines > 0)
+    count = std::min(count, maxEngines);
+
+  shared_ptr<WarmUpContext> context = make_shared<WarmUpContext>();
+  context->loads.resize(count);
+  vector<size_t> completedLoads;
+  size_t startedCount = 0;
+  size_t finishedCount = 0;
+  size_t loadedCount = 0;
+  size_t unknownFetchCount = 0;
+  report << "ENGINE WARM-UP:\n";
+  while (finishedCount < count) {
+    for (; startedCount < count && startedCount - finishedCount < maxConcurrentLoads; ++startedCount) {
+      EngineLoad& load = context->loads[startedCount];
+      load.engineId = engineIds[startedCount];
+      load.start = Clock::now();
+      shared_ptr<WarmUpContext> loadContext = context;
+      size_t index = startedCount;
+      mProfileOperations.AddEngine(*GetProfile(), GetExistingEngineSettings(load.engineId),
+          [loadContext, index](const exception_ptr& error, const shared_ptr<mip::PolicyEngine>& engine) {
+            loadContext->Complete(index, error, engine); });
+    }
 
+    {
+      std::unique_lock<mutex> lock(context->completionMutex);
+      context->loadCompleted.wait(lock, [&context] { return !context->completedLoads.empty(); });
+      completedLoads.swap(context->completedLoads);
+    }
+
+    for (size_t index : completedLoads) {
+      EngineLoad& load = context->loads[index];
+      report << "  Engine '" << load.engineId << "': " << load.latency.count() << " ms";
+      if (nullptr == load.engine) {
+        report << ", ERROR: " << load.error << "\n";
+      } else {
+        report << (load.policyFetch == PolicyProfileObserverImpl::PolicyFetch::Required ? ", policy fetched" :
+            load.policyFetch == PolicyProfileObserverImpl::PolicyFetch::NotRequired ? ", cached policy" :
+            ", policy fetch unknown") << "\n";
+        if (load.policyFetch == PolicyProfileObserverImpl::PolicyFetch::Unknown)
+          ++unknownFetchCount;
+        if (mEngineCache.Add(CreateCachedEngine(load.engine)))
+          ++loadedCount;
+        load.engine = nullptr;
+      }
+      ++finishedCount;
+    }
+    completedLoads.clear();
+  }
+
+  report << "  Loaded " << loadedCount << " of " << engineIds.size() << " cached engines in " <<
+      std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count() << " ms (up to " <<
+      maxConcurrentLoads << " at once)" << endl;
+  // The SDK reports whether a load fetches policy without saying which load it means, so loads that overlapped
+  // another engine load can't be attributed
+  if (unknownFetchCount > 0) {
+    report << "  Policy fetch unknown for " << unknownFetchCount << " engine(s) whose load overlapped another; " <<
+        "use --maxConcurrentLoads 1 to attribute every load" << endl;
+  }
+}
+
+// Creates/loads an engine and writes all labels defined in the policy
+void Action::ListLabels(OutputSink& output) {
   if (mProfileOptions.simulatePolicyChange)
-    SimulatePolicyChange(mEngine);
+    SimulatePolicyChange(GetEngine());
 
-  for (const shared_ptr<mip::Label>& label : mEngine->ListSensitivityLabels())
-    PrintLabel(label);
+  shared_ptr<mip::PolicyEngine> engine = GetEngine();
+  for (const shared_ptr<mip::Label>& label : engine->ListSensitivityLabels())
+    output.WriteLabel(label);
 }
 
 // Creates/loads an engine and prints all sensitivity types defined in the policy
 void Action::ListSensitivityTypes() {
-  EnsurePolicyEngine();
-
-  for (const shared_ptr<mip::SensitivityTypesRulePackage>& type : mEngine->ListSensitivityTypes()) {
+  shared_ptr<mip::PolicyEngine> engine = GetEngine();
+  for (const shared_ptr<mip::SensitivityTypesRulePackage>& type : engine->ListSensitivityTypes()) {
     PrintSensitivityType(type);
   }
 }
 
-// Creates/loads an engine and prints default label defined in the policy
-void Action::ShowDefaultLabel() {
-  EnsurePolicyEngine();
+// Creates/loads an engine and writes default label defined in the policy
+void Action::ShowDefaultLabel(OutputSink& output) {
+  if (mProfileOptions.simulatePolicyChange)
+    SimulatePolicyChange(GetEngine());
+
+  output.WriteDefaultLabel(GetEngine()->GetDefaultSensitivityLabel());
+}
 
+// Creates/loads an engine, writes current label based on execution state
+void Action::ShowLabel(const ExecutionStateOptions& options, OutputSink& output) {
   if (mProfileOptions.simulatePolicyChange)
-    SimulatePolicyChange(mEngine);
+    SimulatePolicyChange(GetEngine());
 
-  shared_ptr<mip::Label> defaultLabel = mEngine->GetDefaultSensitivityLabel();
-  if (nullptr != defaultLabel)
-    PrintLabel(defaultLabel);
-  else
-    cout << "NO DEFAULT LABEL" << endl;
+  output.WriteContentLabel(GetSensitivityLabel(options));
 }
 
-// Creates/loads an engine, shows current label based on execution state
-void Action::ShowLabel(const ExecutionStateOptions& options) {
-  EnsurePolicyEngine();
+// Creates/loads an engine, shows policy data XML
+void Action::ShowPolicyData() {
+  cout << GetEngine()->GetPolicyDataXml();
+}
 
+// Creates/loads an engine, computes actions based on current execution state, and writes resulting actions
+void Action::ComputeActions(const ExecutionStateOptions& options, OutputSink& output) {
   if (mProfileOptions.simulatePolicyChange)
-    SimulatePolicyChange(mEngine);
+    SimulatePolicyChange(GetEngine());
+
+  output.WriteActions(GetActions(options));
+}
+
+// Creates/loads an engine if needed and returns all labels defined in the policy
+vector<shared_ptr<mip::Label>> Action::GetLabels() {
+  return GetDefaultEngine(GetDeadline(0))->engine->ListSensitivityLabels();
+}
 
+// Creates/loads an engine if needed and returns the default label defined in the policy, if any
+shared_ptr<mip::Label> Action::GetDefaultLabel() {
+  return GetDefaultEngine(GetDeadline(0))->engine->GetDefaultSensitivityLabel();
+}
+
+// Creates/loads an engine if needed and returns the current label based on execution state. When enabled, results are
+// memoized by the metadata the engine reads until the next policy change (see LabelCache), and concurrent requests for
+// the same state share one evaluation.
+shared_ptr<mip::ContentLabel> Action::GetSensitivityLabel(const ExecutionStateOptions& options, bool* isStale) {
   ExecutionStateImpl state(options);
+  return GetSensitivityLabel(state, isStale);
+}
 
-  // Pass in the isAuditDiscoveryEnabled flag to CreatePolicyHandler()
-  auto handler = mEngine->CreatePolicyHandler(options.isAuditDiscoveryEnabled);
-  shared_ptr<mip::ContentLabel> label = handler->GetSensitivityLabel(state);
-  if (nullptr != label)
-    PrintLabel(label->GetLabel());
-  else
-    cout << "NO LABEL" << endl;
+shared_ptr<mip::ContentLabel> Action::GetSensitivityLabel(ExecutionStateImpl& state, bool* isStale) {
+  return GetSensitivityLabel(state, GetDeadline(state.GetOptions().timeoutMs), isStale);
 }
 
-// Creates/loads an engine, shows policy data XML
-void Action::ShowPolicyData() {
-  EnsurePolicyEngine();
-  cout << mEngine->GetPolicyDataXml();
+void Action::WriteSensitivityLabelJson(ExecutionStateImpl& state, string& out, bool* isStale) {
+  Deadline deadline = GetDeadline(state.GetOptions().timeoutMs);
+  string key;
+  if (nullptr != mSharedResults) {
+    key = GetSharedResultKey('L', state, deadline);
+    if (!key.empty() && mSharedResults->Find(key, out)) {
+      if (nullptr != isStale)
+        *isStale = false;
+      return;
+    }
+  }
+
+  uint64_t generation = nullptr != mSharedResults ? mSharedResults->GetGeneration() : 0;
+  bool isLabelStale = false;
+  size_t start = out.size();
+  AppendContentLabelJson(GetSensitivityLabel(state, deadline, &isLabelStale), out);
+  if (!key.empty() && !isLabelStale)
+    mSharedResults->Insert(key, out.data() + start, out.size() - start, generation);
+  if (nullptr != isStale)
+    *isStale = isLabelStale;
 }
 
-// Creates/loads an engine, computes actions based on current execution state, and prints resulting actions
-void Action::ComputeActions(const ExecutionStateOptions& options) {
-  EnsurePolicyEngine();
+shared_ptr<mip::ContentLabel> Action::GetSensitivityLabel(ExecutionStateImpl& state, Deadline deadline, bool* isStale) {
+  if (nullptr != isStale)
+    *isStale = false;
+  try {
+    shared_ptr<mip::ContentLabel> label = GetSensitivityLabelBefore(state, deadline);
+    if (mStaleLabels.IsEnabled())
+      mStaleLabels.Insert(GetStaleResultKey(state), label, kApproximateContentLabelBytes, mStaleLabels.GetGeneration());
+    return label;
+  } catch (const DeadlineExceededError&) {
+    ++mDeadlinesExceeded;
+    shared_ptr<mip::ContentLabel> label;
+    if (nullptr == isStale || !mStaleLabels.IsEnabled() || !mStaleLabels.Find(GetStaleResultKey(state), label))
+      throw;
+    ++mStaleResults;
+    *isStale = true;
+    return label;
+  }
+}
 
-  if (mProfileOptions.simulatePolicyChange)
-    SimulatePolicyChange(mEngine);
+shared_ptr<mip::ContentLabel> Action::GetSensitivityLabelBefore(ExecutionStateImpl& state, Deadline deadline) {
+  const ExecutionStateOptions& options = state.GetOptions();
+  uint64_t generation = mLabelCache.GetGeneration();
+  shared_ptr<CachedEngine> engine = GetCachedEngine(options, deadline);
+  if (!mLabelCache.IsEnabled() && !mLabelFlights.IsEnabled()) {
+    // Handlers are pooled by the isAuditDiscoveryEnabled flag they were created with (see CreatePolicyHandler())
+    auto handler = engine->handlers.Acquire(options.isAuditDiscoveryEnabled);
+    return handler->GetSensitivityLabel(state);
+  }
+
+  const string& engineId = engine->engine->GetSettings().GetEngineId();
+  shared_ptr<mip::ContentLabel> label;
+  if (mLabelCache.IsEnabled() && mLabelCache.Find(mLabelCache.GetKey(engineId, state), label))
+    return label;
+
+  if (!mLabelFlights.IsEnabled())
+    return EvaluateSensitivityLabel(*engine, state, generation);
+  return mLabelFlights.Run(GetFlightKey(generation, engineId, state.GetFingerprint()), deadline, [&] {
+      return EvaluateSensitivityLabel(*engine, state, generation); });
+}
+
+shared_ptr<mip::ContentLabel> Action::EvaluateSensitivityLabel(
+    CachedEngine& engine,
+    ExecutionStateImpl& state,
+    uint64_t generation) {
+  const ExecutionStateOptions& options = state.GetOptions();
+  if (mLabelCache.IsEnabled()) {
+    state.SetMetadataQueryObserver([this](const vector<string>& names, const vector<string>& namePrefixes) {
+        mLabelCache.RecordMetadataQuery(names, namePrefixes); });
+  }
+
+  shared_ptr<mip::ContentLabel> label;
+  {
+    auto handler = engine.handlers.Acquire(options.isAuditDiscoveryEnabled);
+    label = handler->GetSensitivityLabel(state);
+  }
+
+  // Keyed again now that every metadata query made by this evaluation has been recorded
+  if (mLabelCache.IsEnabled())
+    mLabelCache.Insert(mLabelCache.GetKey(engine.engine->GetSettings().GetEngineId(), state), label, generation);
+  return label;
+}
 
+// Creates/loads an engine if needed and returns the actions computed for the execution state. States covered by the
+// engine's precomputed action plans are answered from that table. Otherwise, when enabled, results are memoized per
+// engine and execution state until the next policy change, and concurrent requests for the same state share one
+// evaluation. Note that a precomputed, memoized or shared result skips the audit events ComputeActions would otherwise
+// send for the state.
+vector<shared_ptr<mip::Action>> Action::GetActions(const ExecutionStateOptions& options, bool* isStale) {
   ExecutionStateImpl state(options);
-  auto handler = mEngine->CreatePolicyHandler(options.isAuditDiscoveryEnabled);
-  auto actions = handler->ComputeActions(state);
-  if (!actions.empty()) {
-    for (const shared_ptr<mip::Action>& action : actions)
-      PrintAction(action);
-  } else {
-    cout << "NO ACTIONS" << endl;
+  return GetActions(state, isStale);
+}
+
+vector<shared_ptr<mip::Action>> Action::GetActions(ExecutionStateImpl& state, bool* isStale) {
+  return GetActions(state, GetDeadline(state.GetOptions().timeoutMs), isStale);
+}
+
+void Action::WriteActionsJson(ExecutionStateImpl& state, string& out, bool* isStale) {
+  Deadline deadline = GetDeadline(state.GetOptions().timeoutMs);
+  string key;
+  if (nullptr != mSharedResults) {
+    key = GetSharedResultKey('A', state, deadline);
+    if (!key.empty() && mSharedResults->Find(key, out)) {
+      if (nullptr != isStale)
+        *isStale = false;
+      return;
+    }
+  }
+
+  uint64_t generation = nullptr != mSharedResults ? mSharedResults->GetGeneration() : 0;
+  bool isActionsStale = false;
+  size_t start = out.size();
+  AppendActionsJson(GetActions(state, deadline, &isActionsStale), out);
+  if (!key.empty() && !isActionsStale)
+    mSharedResults->Insert(key, out.data() + start, out.size() - start, generation);
+  if (nullptr != isStale)
+    *isStale = isActionsStale;
+}
+
+vector<shared_ptr<mip::Action>> Action::GetActions(ExecutionStateImpl& state, Deadline deadline, bool* isStale) {
+  if (nullptr != isStale)
+    *isStale = false;
+  try {
+    vector<shared_ptr<mip::Action>> actions = GetActionsBefore(state, deadline);
+    if (mStaleActions.IsEnabled()) {
+      mStaleActions.Insert(
+          GetStaleResultKey(state), actions, GetApproximateActionsSize(actions), mStaleActions.GetGeneration());
+    }
+    return actions;
+  } catch (const DeadlineExceededError&) {
+    ++mDeadlinesExceeded;
+    vector<shared_ptr<mip::Action>> actions;
+    if (nullptr == isStale || !mStaleActions.IsEnabled() || !mStaleActions.Find(GetStaleResultKey(state), actions))
+      throw;
+    ++mStaleResults;
+    *isStale = true;
+    return actions;
+  }
+}
+
+vector<shared_ptr<mip::Action>> Action::GetActionsBefore(ExecutionStateImpl& state, Deadline deadline) {
+  const ExecutionStateOptions& options = state.GetOptions();
+  uint64_t generation = mActionCache.GetGeneration();
+  shared_ptr<CachedEngine> engine = GetCachedEngine(options, deadline);
+  if (nullptr == engine->actionPlans && !mActionCache.IsEnabled() && !mActionFlights.IsEnabled()) {
+    auto handler = engine->handlers.Acquire(options.isAuditDiscoveryEnabled);
+    return handler->ComputeActions(state);
+  }
+
+  string fingerprint = state.GetFingerprint();
+  if (nullptr != engine->actionPlans) {
+    const vector<shared_ptr<mip::Action>>* plan = engine->actionPlans->Find(fingerprint);
+    if (nullptr != plan) {
+      ++mActionPlanHits;
+      return *plan;
+    }
+  }
+
+  const string& engineId = engine->engine->GetSettings().GetEngineId();
+  vector<shared_ptr<mip::Action>> actions;
+  string key;
+  if (mActionCache.IsEnabled()) {
+    key = engineId;
+    key += '\n';
+    key += fingerprint;
+    if (mActionCache.Find(key, actions))
+      return actions;
+  }
+
+  auto evaluate = [&] {
+    vector<shared_ptr<mip::Action>> computedActions;
+    {
+      auto handler = engine->handlers.Acquire(options.isAuditDiscoveryEnabled);
+      computedActions = handler->ComputeActions(state);
+    }
+    if (mActionCache.IsEnabled())
+      mActionCache.Insert(key, computedActions, GetApproximateActionsSize(computedActions), generation);
+    return computedActions;
+  };
+  if (!mActionFlights.IsEnabled())
+    return evaluate();
+  return mActionFlights.Run(GetFlightKey(generation, engineId, fingerprint), deadline, evaluate);
+}
+
+shared_ptr<mip::PolicyEngine> Action::GetEngine() {
+  return GetDefaultEngine()->engine;
+}
+
+void Action::PrintStatistics(std::ostream& output) const {
+  PolicyHandlerPool::Statistics handlerPool = mEngineCache.GetHandlerPoolStatistics();
+  EngineCache::Statistics engineCache = mEngineCache.GetStatistics();
+  output << "STATISTICS:\n" <<
+      "  Handler pool: " << handlerPool.hits << " hits, " << handlerPool.misses << " misses, " <<
+      static_cast<int>(handlerPool.GetHitRate() * 100.0 + 0.5) << "% hit rate, " <<
+      handlerPool.invalidations << " invalidations\n" <<
+      "  Engine cache: " << engineCache.hits << " hits, " << engineCache.misses << " misses (" <<
+      engineCache.reusedEngineIds << " reloaded by engine id), " << engineCache.evictions << " evictions" << endl;
+  mStartupTimeline.Print(output);
+
+  if (mActionCache.IsEnabled()) {
+    ResultCache<vector<shared_ptr<mip::Action>>>::Statistics actionCache = mActionCache.GetStatistics();
+    output << "  Action cache: " << actionCache.hits << " hits, " << actionCache.misses << " misses, " <<
+        actionCache.evictions << " evictions, " << actionCache.clears << " policy change clears, " <<
+        actionCache.entries << " entries (~" << actionCache.bytes / 1024 << " KiB)" << endl;
   }
+
+  if (mLabelCache.IsEnabled()) {
+    LabelCache::Statistics labelCache = mLabelCache.GetStatistics();
+    output << "  Label cache: " << labelCache.results.hits << " hits, " << labelCache.results.misses << " misses, " <<
+        labelCache.results.evictions << " evictions, " << labelCache.results.clears << " policy change clears, " <<
+        labelCache.results.entries << " entries, keyed by " << labelCache.metadataNames << " metadata names and " <<
+        labelCache.metadataPrefixes << " prefixes" << endl;
+  }
+
+  if (mActionFlights.IsEnabled()) {
+    SingleFlight<vector<shared_ptr<mip::Action>>>::Statistics actionFlights = mActionFlights.GetStatistics();
+    SingleFlight<shared_ptr<mip::ContentLabel>>::Statistics labelFlights = mLabelFlights.GetStatistics();
+    output << "  Coalescing: " << actionFlights.coalesced << " of " << actionFlights.calls << " action evaluations (" <<
+        static_cast<int>(actionFlights.GetCoalescingRatio() * 100.0 + 0.5) << "%) and " << labelFlights.coalesced <<
+        " of " << labelFlights.calls << " label evaluations (" <<
+        static_cast<int>(labelFlights.GetCoalescingRatio() * 100.0 + 0.5) << "%) shared another request's" << endl;
+  }
+
+  if (mProfileOptions.precomputeActions) {
+    lock_guard<mutex> lock(mActionPlanMutex);
+    output << "  Action plans: " << mActionPlanHits.load() << " hits, " << mActionPlanTables << " tables built, " <<
+        "latest has " << mLastActionPlanSize << " plans (~" << mLastActionPlanBytes / 1024 << " KiB) built in " <<
+        mLastActionPlanBuildTime.count() << " ms" << endl;
+  }
+
+  shared_ptr<const vector<shared_ptr<CachedEngine>>> replicas = std::atomic_load(&mEngineReplicas);
+  if (nullptr != replicas) {
+    lock_guard<mutex> lock(mReplicaMutex);
+    output << "  Engine replicas: " << replicas->size() << " of '" <<
+        replicas->front()->engine->GetSettings().GetEngineId() << "' loaded in " << mReplicaLoadTime.count() << " ms";
+    if (mSharedEngineMemory > 0 && mReplicatedEngineMemory > mSharedEngineMemory) {
+      size_t addedMemory = mReplicatedEngineMemory - mSharedEngineMemory;
+      output << ", resident memory " << mSharedEngineMemory / 1024 << " KiB shared -> " <<
+          mReplicatedEngineMemory / 1024 << " KiB replicated (~" << addedMemory / (replicas->size() - 1) / 1024 <<
+          " KiB per replica)";
+    }
+    output << "\n    Handler leases per replica:";
+    for (const shared_ptr<CachedEngine>& replica : *replicas) {
+      PolicyHandlerPool::Statistics handlers = replica->handlers.GetStatistics();
+      output << " " << handlers.hits + handlers.misses;
+    }
+    output << endl;
+  }
+  size_t residentMemory = GetResidentMemoryBytes();
+  if (residentMemory > 0)
+    output << "  Memory: " << residentMemory / 1024 << " KiB resident" << endl;
+
+  if (nullptr != mSharedResults) {
+    SharedResultCache::Statistics shared = mSharedResults->GetStatistics();
+    SharedResultCache::Statistics host = mSharedResults->GetHostStatistics();
+    output << "  Shared result cache: " << shared.hits << " hits, " << shared.misses << " misses (" <<
+        static_cast<int>(shared.GetHitRate() * 100.0 + 0.5) << "% hit rate, " <<
+        static_cast<int>(host.GetHitRate() * 100.0 + 0.5) << "% across processes), " << shared.inserts <<
+        " inserts, generation " << mSharedResults->GetGeneration() << ", " << mSharedResults->GetSlotCount() <<
+        " slots (" << mSharedResults->GetSegmentBytes() / 1024 << " KiB)" << endl;
+  }
+
+  if (mProfileOptions.requestTimeoutMs > 0 || mDeadlinesExceeded.load() > 0) {
+    output << "  Deadlines: " << mDeadlinesExceeded.load() << " exceeded, " << mStaleResults.load() <<
+        " answered with stale results" << endl;
+  }
+
+  ReloadScheduler::Statistics reloads = mReloadScheduler.GetStatistics();
+  output << "  Policy changes: " << reloads.notifications << " notifications, " << reloads.coalesced <<
+      " coalesced, " << reloads.reloads << " engine reloads" << endl;
 }
 
 // Handles policy change notifications from PolicyProfile::Observer. The SDK periodically syncs the policy from the SCC
@@ -420,41 +788,304 @@ void Action::ComputeActions(const ExecutionStateOptions& options) {
 // the policy through the OIP portal), the SDK will unload the engine and then fire this notification that the policy
 // has changed. The application then must re-add the engine with the same engine id to perform operations against the
 // updated policy.
+//
+// The engine is re-added on a background thread rather than blocking the SDK's notification thread, and bursts of
+// notifications for the same engine are coalesced into one reload (see ReloadScheduler). Requests keep using the
+// previous engine until the reloaded one is ready and published; the previous engine is released once the last request
+// holding it finishes.
 void Action::OnPolicyChanged(const std::string& engineId) {
-  mEngine = LoadExistingPolicyEngine(engineId);
+  mReloadScheduler.Schedule(engineId);
+}
+
+void Action::ReloadPolicyEngine(const string& engineId) {
+  shared_ptr<CachedEngine> engine;
+  try {
+    // The reloaded engine comes with a fresh handler pool, so handlers created from the unloaded engine are never
+    // handed out again
+    engine = mEngineCache.Reload(engineId);
+  } catch (const exception& ex) {
+    // Keep serving the previous engine; the next policy change notification retries
+    cerr << "ERROR: Failed to reload engine '" << engineId << "': " << ex.what() << endl;
+    return;
+  }
+
+  shared_ptr<CachedEngine> defaultEngine = std::atomic_load(&mDefaultEngine);
+  if (nullptr != engine && nullptr != defaultEngine && defaultEngine->engine->GetSettings().GetEngineId() == engineId) {
+    std::atomic_store(&mDefaultEngine, engine);
+    if (GetEngineReplicaCount() > 1)
+      LoadEngineReplicasInBackground(engine);
+  }
+
+  // Memoized actions and labels are dropped once the reloaded engine is published. Lookups that may still have fetched
+  // the old engine started in the previous cache generation, so their results are discarded rather than cached.
+  mActionCache.Clear();
+  mLabelCache.Clear();
+  if (nullptr != mSharedResults)
+    mSharedResults->BumpGeneration();
+  if (nullptr != engine)
+    ++mPublishedReloads;
+}
+
+// Waits for the profile load started by the constructor, rethrowing its error
+shared_ptr<mip::PolicyProfile> Action::GetProfile() {
+  return mProfile.get();
+}
+
+// Deadline for a request allowed to wait 'timeoutMs', or ProfileOptions::requestTimeoutMs if 0
+Deadline Action::GetDeadline(size_t timeoutMs) const {
+  if (timeoutMs == 0)
+    timeoutMs = mProfileOptions.requestTimeoutMs;
+  if (timeoutMs == 0)
+    return Deadline::max();
+  return Clock::now() + std::chrono::milliseconds(timeoutMs);
+}
+
+// Returns the engine for <username>, creating/loading it on first use. Subsequent calls reuse it; after a policy change
+// ReloadPolicyEngine publishes the re-added engine with the same id.
+shared_ptr<CachedEngine> Action::GetDefaultEngine(Deadline deadline) {
+  shared_ptr<CachedEngine> engine = std::atomic_load(&mDefaultEngine);
+  if (nullptr != engine)
+    return GetEngineReplica(engine);
+
+  mip::Identity identity(mAuthOptions.username);
+  if (!mProfileOptions.engineId.empty())
+    mEngineCache.SetEngineId(identity, mProfileOptions.engineId);
+
+  // Concurrent first calls share the engine cache's single load. A reload published meanwhile is newer, keep that one.
+  engine = mEngineCache.Get(identity, deadline);
+  mStartupTimeline.Record(StartupTimeline::Stage::EngineLoaded);
+  shared_ptr<CachedEngine> expected;
+  if (!std::atomic_compare_exchange_strong(&mDefaultEngine, &expected, engine))
+    return GetEngineReplica(expected);
+
+  // Threads are served by the one engine until its replicas are loaded in the background
+  if (GetEngineReplicaCount() > 1)
+    LoadEngineReplicasInBackground(engine);
+  return engine;
+}
+
+size_t Action::GetEngineReplicaCount() const {
+  if (mProfileOptions.engineReplicas > 0)
+    return mProfileOptions.engineReplicas;
+  return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void Action::PinThreadToEngineReplica(size_t workerIndex) {
+  tReplicaSlot = workerIndex;
+}
+
+// Returns the replica of 'engine' the calling thread is pinned to (see PinThreadToEngineReplica)
+shared_ptr<CachedEngine> Action::GetEngineReplica(const shared_ptr<CachedEngine>& engine) {
+  shared_ptr<const vector<shared_ptr<CachedEngine>>> replicas = std::atomic_load(&mEngineReplicas);
+  if (nullptr == replicas || replicas->front() != engine)
+    return engine;
+  return (*replicas)[tReplicaSlot % replicas->size()];
+}
+
+// Hands 'engine' to the replica load thread, replacing any engine whose replica load has not started yet
+void Action::LoadEngineReplicasInBackground(const shared_ptr<CachedEngine>& engine) {
+  {
+    lock_guard<mutex> lock(mReplicaMutex);
+    if (mIsStoppingReplicaLoads)
+      return;
+    mPendingReplicaEngine = engine;
+    if (!mReplicaLoadThread.joinable())
+      mReplicaLoadThread = std::thread([this] { ReplicaLoadLoop(); });
+  }
+  mReplicaLoadRequested.notify_all();
+}
+
+void Action::ReplicaLoadLoop() {
+  for (;;) {
+    shared_ptr<CachedEngine> engine;
+    {
+      std::unique_lock<mutex> lock(mReplicaMutex);
+      mReplicaLoadRequested.wait(lock, [this] {
+          return mIsStoppingReplicaLoads || (!mIsReplicaLoadPaused && nullptr != mPendingReplicaEngine); });
+      if (mIsStoppingReplicaLoads)
+        return;
+      engine.swap(mPendingReplicaEngine);
+      mIsLoadingReplicas = true;
+    }
+
+    // The replicas of an engine replaced by a reload are no longer served, whether or not the new ones load
+    shared_ptr<CachedEngine> defaultEngine = std::atomic_load(&mDefaultEngine);
+    shared_ptr<const vector<shared_ptr<CachedEngine>>> replicas = std::atomic_load(&mEngineReplicas);
+    if (nullptr != replicas && replicas->front() != defaultEngine) {
+      std::atomic_store(&mEngineReplicas, shared_ptr<const vector<shared_ptr<CachedEngine>>>());
+      ReleaseEngineReplicas(*replicas);
+    }
+
+    // Replicas of an engine replaced by a reload meanwhile would never be served
+    if (defaultEngine == engine)
+      LoadEngineReplicas(engine);
+
+    {
+      lock_guard<mutex> lock(mReplicaMutex);
+      mIsLoadingReplicas = false;
+    }
+    mReplicaLoadRequested.notify_all();
+  }
+}
+
+// Loads the replicas of 'engine' concurrently and publishes them. Each replica is added as a new engine for <username>
+// rather than by loading 'engine's id again: the SDK may hand back the one loaded instance for an id, and unloading an
+// id shared by every replica would unload them all. If any replica fails to load, is an instance already loaded, or was
+// loaded with another policy than the one 'engine' precomputed its table from, the replicas loaded are released and
+// threads keep sharing 'engine'.
+void Action::LoadEngineReplicas(const shared_ptr<CachedEngine>& engine) {
+  string engineId = engine->engine->GetSettings().GetEngineId();
+  mip::Identity identity(mAuthOptions.username);
+  Clock::time_point start = Clock::now();
+  size_t sharedEngineMemory = GetResidentMemoryBytes();
+
+  vector<std::future<shared_ptr<mip::PolicyEngine>>> loads;
+  for (size_t i = 1; i < GetEngineReplicaCount(); ++i)
+    loads.push_back(std::async(std::launch::async, [this, &identity] { return CreateNewPolicyEngine(identity); }));
+
+  auto replicas = make_shared<vector<shared_ptr<CachedEngine>>>();
+  replicas->push_back(engine);
+  std::set<const mip::PolicyEngine*> instances;
+  instances.insert(engine->engine.get());
+  string error;
+  for (std::future<shared_ptr<mip::PolicyEngine>>& load : loads) {
+    try {
+      shared_ptr<mip::PolicyEngine> replica = load.get();
+      // Kept even if rejected, so it is released with the others. Replicas share the table precomputed for 'engine'.
+      replicas->push_back(make_shared<CachedEngine>(replica, engine->actionPlans));
+      if (!instances.insert(replica.get()).second)
+        error = "engine '" + replica->GetSettings().GetEngineId() + "' is an instance already loaded";
+      else if (replica->GetPolicyDataXml() != engine->engine->GetPolicyDataXml())
+        error = "engine '" + replica->GetSettings().GetEngineId() + "' was loaded with another policy";
+    } catch (const exception& ex) {
+      error = ex.what();
+    }
+  }
+  if (!error.empty()) {
+    cerr << "WARNING: Failed to load a replica of engine '" << engineId << "', sharing one engine: " << error << endl;
+    ReleaseEngineReplicas(*replicas);
+    return;
+  }
+
+  lock_guard<mutex> lock(mReplicaMutex);
+  mReplicaLoadTime = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+  mSharedEngineMemory = sharedEngineMemory;
+  mReplicatedEngineMemory = GetResidentMemoryBytes();
+  std::atomic_store(&mEngineReplicas, shared_ptr<const vector<shared_ptr<CachedEngine>>>(replicas));
 }
 
-void Action::EnsurePolicyEngine() {
-  if (mProfileOptions.engineId.empty())
-    mEngine = CreateNewPolicyEngine();
-  else
-    mEngine = LoadExistingPolicyEngine(mProfileOptions.engineId);
+// Deletes the replica engines in 'replicas', all but the first (the engine they replicate), so they neither stay loaded
+// nor pile up in the profile's storage cache. Requests still holding a replica finish with it.
+void Action::ReleaseEngineReplicas(const vector<shared_ptr<CachedEngine>>& replicas) {
+  std::set<string> engineIds;
+  for (size_t i = 0; i < replicas.size(); ++i) {
+    string engineId = replicas[i]->engine->GetSettings().GetEngineId();
+    // Never delete the replicated engine itself, should a replica have come back with its id
+    if (!engineIds.insert(engineId).second || i == 0)
+      continue;
+    try {
+      mProfileOperations.DeleteEngineAndWait(*GetProfile(), engineId);
+    } catch (const exception& ex) {
+      cerr << "WARNING: Failed to release engine replica '" << engineId << "': " << ex.what() << endl;
+    }
+  }
+}
+
+// Returns the engine for the identity named by the execution state, or the <username> engine if none is named
+shared_ptr<CachedEngine> Action::GetCachedEngine(const ExecutionStateOptions& options, Deadline deadline) {
+  shared_ptr<CachedEngine> defaultEngine = GetDefaultEngine(deadline);
+  if (options.username.empty())
+    return defaultEngine;
+
+  mip::Identity identity(options.username);
+  identity.SetDelegatedEmail(options.delegatedEmail);
+  return mEngineCache.Get(identity, deadline);
+}
+
+// Key of a result in the shared result cache: result type, then the policy, identity and execution state it was
+// computed for. Processes load their own engines, so results are matched by policy id rather than engine id. Empty if
+// the engine cannot be obtained, in which case the request fails (or falls back) the usual way.
+string Action::GetSharedResultKey(char type, const ExecutionStateImpl& state, Deadline deadline) {
+  const ExecutionStateOptions& options = state.GetOptions();
+  string key(1, type);
+  try {
+    // Results outlive this process in the segment, and a policy updated while no process observed the change keeps its
+    // id, so the key names the policy content as well. Processes sharing the segment may load engines with other
+    // settings, and the locale in particular localizes label names, descriptions and tooltips.
+    shared_ptr<CachedEngine> engine = GetCachedEngine(options, deadline);
+    std::call_once(engine->policyVersionOnce, [&engine] {
+      const mip::PolicyEngine::Settings& settings = engine->engine->GetSettings();
+      string& version = engine->policyVersion;
+      version = engine->engine->GetPolicyId();
+      version += '\n';
+      version += std::to_string(SharedResultCache::GetHash(engine->engine->GetPolicyDataXml()));
+      version += '\n';
+      version += settings.GetLocale();
+      version += settings.IsLoadSensitivityTypesEnabled() ? "\n1" : "\n0";
+      for (const pair<string, string>& setting : settings.GetCustomSettings()) {
+        version += '\n';
+        version += setting.first;
+        version += '=';
+        version += setting.second;
+      }
+    });
+    key += engine->policyVersion;
+  } catch (const exception&) {
+    return string();
+  }
+  key += '\n';
+  key += options.username.empty() ? mAuthOptions.username : options.username;
+  key += '\n';
+  key += options.delegatedEmail;
+  key += '\n';
+  key += state.GetFingerprint();
+  return key;
+}
+
+// Creates or loads an engine for the engine cache
+shared_ptr<CachedEngine> Action::LoadCachedEngine(const mip::Identity& identity, const string& engineId) {
+  if (mIsEngineLoadDisabled)
+    throw runtime_error("No engine is loaded for '" + (engineId.empty() ? identity.GetEmail() : engineId) +
+        "' and engine loads are disabled");
+  return CreateCachedEngine(engineId.empty() ? CreateNewPolicyEngine(identity) : LoadExistingPolicyEngine(engineId));
+}
+
+// Wraps an engine for the engine cache and, if enabled, precomputes its action plans before the engine is published,
+// so the first requests against it already find the table
+shared_ptr<CachedEngine> Action::CreateCachedEngine(const shared_ptr<mip::PolicyEngine>& engine) {
+  if (!mProfileOptions.precomputeActions)
+    return make_shared<CachedEngine>(engine);
+
+  shared_ptr<const ActionPlanTable> actionPlans =
+      ActionPlanTable::Build(engine, std::max(std::thread::hardware_concurrency(), 1u));
+  {
+    lock_guard<mutex> lock(mActionPlanMutex);
+    ++mActionPlanTables;
+    mLastActionPlanSize = actionPlans->GetSize();
+    mLastActionPlanBytes = actionPlans->GetApproximateBytes();
+    mLastActionPlanBuildTime = actionPlans->GetBuildTime();
+  }
+  return make_shared<CachedEngine>(engine, actionPlans);
 }
 
 // Creates a new policy engine. Note that the same mip::PolicyProfile::AddEngineAsync API is used both to create a 
 // new engine and load a cached engine. It is up to the application to remember/record the id for the newly-created 
 // engine to prevent duplicate engines from being added to the cache.
-shared_ptr<mip::PolicyEngine> Action::CreateNewPolicyEngine() {
-  mip::Identity identity(mAuthOptions.username);
-
+shared_ptr<mip::PolicyEngine> Action::CreateNewPolicyEngine(const mip::Identity& identity) {
   // TODO: Describe client data
   string clientData = "my client data";
 
   mip::PolicyEngine::Settings settings(identity, clientData, mLocale, mLoadSensitivityTypes);
   settings.SetCustomSettings(GetCustomPolicySettings());
 
-  // Create a context to pass to 'PolicyProfile::AddEngineAsync'. That context will be forwarded to the corresponding
-  // PolicyProfile::Observer methods. In this case, we use promises/futures as a simple way to to detect the async 
-  // operation completions synchronously.
-  auto addEnginePromise = make_shared<promise<shared_ptr<mip::PolicyEngine>>>();
-  future<shared_ptr<mip::PolicyEngine>> addEngineFuture = addEnginePromise->get_future();
-
+  // 'PolicyProfile::AddEngineAsync' completes through the PolicyProfile::Observer methods. In this case, we wait for
+  // the operation synchronously; AsyncProfileOperations::AddEngine would instead run a continuation on completion.
+  //
   // An engine will exist for the lifetime of the profile unless:
   //  A) Engine is manually unloaded (mip::Policy::UnloadEngineAsync)
   //  B) Engine is manually deleted (mip::Policy::DeleteEngineAsync)
   //  C) Policy has changed (mip::Policy::Observer::OnPolicyChanged called), in which case engine must be re-added
-  mProfile->AddEngineAsync(settings, addEnginePromise);
-  shared_ptr<mip::PolicyEngine> engine = addEngineFuture.get();
+  shared_ptr<mip::PolicyEngine> engine = mProfileOperations.AddEngineAndWait(*GetProfile(), settings);
 
   // If the profile is configured to use a file cache for its engines (mip::PolicyProfile::Settings::UseInMemoryStorage)
   // it is important for an application to remember/record the id for this newly-created engine across sessions to 
@@ -463,7 +1094,7 @@ shared_ptr<mip::PolicyEngine> Action::CreateNewPolicyEngine() {
   //  mip::PolicyProfile::Settings object held by the engine may be different than the 'settings' value passed to 
   // mip::PolicyProfile::AddEngineAsync. (e.g. engine id, session id, etc. Values may have been populated during the add 
   // process if they didn't already exist.)
-  cout << "Engine added with id: '" << engine->GetSettings().GetEngineId() << "'" << endl;
+  cerr << "Engine added with id: '" << engine->GetSettings().GetEngineId() << "'" << endl;
 
   return engine;
 }
@@ -471,18 +1102,23 @@ shared_ptr<mip::PolicyEngine> Action::CreateNewPolicyEngine() {
 // Loads an existing policy engine from the file cache. Note that the same mip::PolicyProfile::AddEngineAsync API is 
 // used both to create a new engine and load a cached engine.
 shared_ptr<mip::PolicyEngine> Action::LoadExistingPolicyEngine(const string& engineId) {
+  shared_ptr<mip::PolicyEngine> engine = mProfileOperations.AddEngineAndWait(*GetProfile(), GetExistingEngineSettings(engineId));
+
+  cerr << "Engine loaded with id: '" << engineId << "'" << endl;
+
+  return engine;
+}
+
+mip::PolicyEngine::Settings Action::GetExistingEngineSettings(const string& engineId) {
   string clientData = "my client data";
   mip::PolicyEngine::Settings settings(engineId, clientData, mLocale, mLoadSensitivityTypes);
   settings.SetCustomSettings(GetCustomPolicySettings());
+  return settings;
+}
 
-  auto addEnginePromise = make_shared<promise<shared_ptr<mip::PolicyEngine>>>();
-  future<shared_ptr<mip::PolicyEngine>> addEngineFuture = addEnginePromise->get_future();
-  mProfile->AddEngineAsync(settings, addEnginePromise);
-  shared_ptr<mip::PolicyEngine> engine = addEngineFuture.get();
-
-  cout << "Engine loaded with id: '" << engineId << "'" << endl;
-
-  return engine;
+// Unloads an engine from the profile. It stays in the storage cache (if any) and can be loaded again by id.
+void Action::UnloadPolicyEngine(const string& engineId) {
+  mProfileOperations.UnloadEngineAndWait(*GetProfile(), engineId);
 }
 
 // Generates custom settings based on the sample app parameters. Custom settings are debug-only options that allow
@@ -503,13 +1139,11 @@ vector<pair<string, string>> Action::GetCustomPolicySettings() {
 // the updated policy.
 void Action::SimulatePolicyChange(const std::shared_ptr<mip::PolicyEngine>& engine) {
   string engineId = engine->GetSettings().GetEngineId();
-  
-  auto unloadEnginePromise = make_shared<promise<void>>();
-  future<void> unloadEngineFuture = unloadEnginePromise->get_future();
-  mProfile->UnloadEngineAsync(engineId, unloadEnginePromise);
-  unloadEngineFuture.get();
+  UnloadPolicyEngine(engineId);
 
+  // The sample then continues against the updated policy, so wait for the background reload to publish it
   mProfileObserver->OnPolicyChanged(engineId);
+  mReloadScheduler.Flush();
 }
 
 } // namespace upe
@@ -28,17 +28,39 @@
 #ifndef SAMPLES_UPE_ACTION_H_
 #define SAMPLES_UPE_ACTION_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "mip/common_types.h"
+#include "mip/upe/action.h"
+#include "mip/upe/content_label.h"
+#include "mip/upe/label.h"
 #include "mip/upe/policy_engine.h"
 #include "mip/upe/policy_profile.h"
 
+#include "async_profile_operations.h"
 #include "auth_delegate_impl.h"
+#include "deadline.h"
+#include "engine_cache.h"
 #include "execution_state_impl.h"
+#include "label_cache.h"
+#include "output_sink.h"
 #include "policy_profile_observer_impl.h"
+#include "reload_scheduler.h"
+#include "result_cache.h"
+#include "shared_result_cache.h"
+#include "single_flight.h"
+#include "startup_timeline.h"
 
 namespace sample {
 namespace upe {
@@ -66,6 +88,28 @@ struct ProfileOptions {
   bool useStorageCache = false;
   bool simulatePolicyChange = false;
   std::string engineId;
+  size_t engineCacheSize = 16; // maximum number of identities with a loaded engine
+  // Engines loaded for <username>, each worker thread pinned to one of them. Replicas are added as engines of their
+  // own, so each is a distinct PolicyEngine with its own engine id. 1 shares a single engine across threads, 0 loads one
+  // per core.
+  size_t engineReplicas = 1;
+  size_t actionCacheSize = 0; // maximum number of memoized ComputeActions results, 0 disables the cache
+  size_t actionCacheBytes = 64 * 1024 * 1024; // approximate memory bound for memoized ComputeActions results
+  size_t labelCacheSize = 0; // maximum number of memoized GetSensitivityLabel results, 0 disables the cache
+  size_t labelCacheBytes = 16 * 1024 * 1024; // approximate memory bound for memoized GetSensitivityLabel results
+  size_t reloadQuietPeriodMs = 500; // policy changes for an engine are collapsed until none arrived for this long...
+  size_t reloadMaxDelayMs = 5000; // ...or this long after the first one
+  size_t maxConcurrentReloads = 2;
+  bool precomputeActions = false; // build an ActionPlanTable whenever an engine is created/loaded
+  bool coalesceRequests = false; // concurrent identical GetActions/GetSensitivityLabel calls share one evaluation
+  size_t requestTimeoutMs = 0; // default request deadline (see ExecutionStateOptions::timeoutMs), 0 waits indefinitely
+  size_t staleResultCacheSize = 0; // last good results kept to answer requests past their deadline, 0 disables them
+  size_t staleResultCacheBytes = 16 * 1024 * 1024; // approximate memory bound for those results
+  // Shared memory segment (e.g. "/upe_sample_results") holding serialized results for every process on the host that
+  // names it, see SharedResultCache. Empty disables it.
+  std::string sharedResultCacheName;
+  size_t sharedResultCacheSlots = 16384; // used only by the process creating the segment
+  size_t sharedResultCacheSlotBytes = 2048; // results larger than a slot are not shared
   PolicyType policyType;
   std::string policyFile;
   mip::ApplicationInfo appInfo;
@@ -78,33 +122,175 @@ public:
       const ProfileOptions& profileOptions,
       const std::string& locale,
       const std::string& workingDirectory, 
-      bool loadSensitivityTypes);
+      bool loadSensitivityTypes,
+      StartupTimeline& startupTimeline);
   ~Action();
 
+  // The profile starts loading when the Action is constructed and every operation waits for it, so the caller can
+  // prepare its input meanwhile. This also starts creating/loading the engine for <username> on a background thread.
+  void LoadEngineInBackground();
+
   void ListEngines();
-  void ListLabels();
+  void ListLabels(OutputSink& output);
   void ListSensitivityTypes();
-  void ShowDefaultLabel();
-  void ShowLabel(const ExecutionStateOptions& options);
+  void ShowDefaultLabel(OutputSink& output);
+  void ShowLabel(const ExecutionStateOptions& options, OutputSink& output);
   void ShowPolicyData();
-  void ComputeActions(const ExecutionStateOptions& options);
+  void ComputeActions(const ExecutionStateOptions& options, OutputSink& output);
+
+  // Non-printing variants of ListLabels/ShowDefaultLabel/ShowLabel/ComputeActions. The engine is created/loaded on
+  // first use and then reused by every subsequent call, which lets a batch of execution states share one profile and
+  // engine. Execution states naming another identity (ExecutionStateOptions::username) are evaluated by that
+  // identity's engine from the engine cache.
+  //
+  // A request stops waiting for its engine, or for an identical evaluation in flight, at its deadline and throws
+  // DeadlineExceededError. Callers passing 'isStale' instead get the last result computed for that identity and
+  // execution state, if one is kept, with '*isStale' set to true.
+  std::vector<std::shared_ptr<mip::Label>> GetLabels();
+  std::shared_ptr<mip::Label> GetDefaultLabel();
+  std::shared_ptr<mip::ContentLabel> GetSensitivityLabel(const ExecutionStateOptions& options, bool* isStale = nullptr);
+  std::vector<std::shared_ptr<mip::Action>> GetActions(const ExecutionStateOptions& options, bool* isStale = nullptr);
+
+  // Same as above, for an execution state already built from its options (e.g. by another thread). The state is not
+  // modified, but its metadata query observer may be replaced.
+  std::shared_ptr<mip::ContentLabel> GetSensitivityLabel(ExecutionStateImpl& state, bool* isStale = nullptr);
+  std::vector<std::shared_ptr<mip::Action>> GetActions(ExecutionStateImpl& state, bool* isStale = nullptr);
+
+  // Same as above, appending the result as JSON (see result_writer.h) to 'out'. With
+  // ProfileOptions::sharedResultCacheName, results serialized by any process sharing the segment are reused as is, for
+  // the same policy, identity and execution state, until the next policy change.
+  void WriteSensitivityLabelJson(ExecutionStateImpl& state, std::string& out, bool* isStale = nullptr);
+  void WriteActionsJson(ExecutionStateImpl& state, std::string& out, bool* isStale = nullptr);
+  bool IsSharingResults() const { return nullptr != mSharedResults; }
+
+  // Creates/loads the engine for <username> if needed and returns it. The engine may be shared across threads, each of
+  // which should create its own mip::PolicyHandler from it. After a policy change the previous engine keeps being
+  // returned until the reloaded one is ready.
+  std::shared_ptr<mip::PolicyEngine> GetEngine();
+
+  // Loads engines from the profile's storage cache ahead of their first request: the first 'maxEngines' listed (all if
+  // 0), never more than the engine cache holds, with up to 'maxConcurrentLoads' loads in flight. Writes each engine's
+  // load latency and whether its policy had to be fetched from the server to 'report'.
+  void WarmUpEngines(size_t maxEngines, size_t maxConcurrentLoads, std::ostream& report);
+
+  StartupTimeline& GetStartupTimeline() { return mStartupTimeline; }
+
+  // With ProfileOptions::engineReplicas, pins the calling worker thread to replica 'workerIndex' (modulo the replica
+  // count), so workers with distinct indexes below the replica count never share an engine. Threads never pinned are
+  // served by the first replica. Call from each worker thread before its first request.
+  static void PinThreadToEngineReplica(size_t workerIndex);
+
+  // Call around fork(), as pthread_atfork handlers would be: PrepareFork waits for background engine loads, reloads and
+  // replica loads to finish, pauses them and takes every lock the Action holds; the parent then resumes them. The child,
+  // where the SDK threads that complete engine loads do not exist, can serve requests against engines already loaded
+  // but makes requests that need another engine fail rather than load it.
+  void PrepareFork();
+  void AfterForkInParent();
+  void AfterForkInChild();
+
+  // Number of engines reloaded after a policy change and published so far. A change means engines obtained earlier
+  // may be serving an outdated policy.
+  uint64_t GetPublishedReloadCount() const { return mPublishedReloads.load(); }
+
+  // Prints counters gathered while serving requests (e.g. PolicyHandler pool hit rate)
+  void PrintStatistics(std::ostream& output) const;
 
 private:
-  void EnsurePolicyEngine();
-  std::shared_ptr<mip::PolicyEngine> CreateNewPolicyEngine();
+  typedef std::chrono::steady_clock Clock;
+
+  struct EngineLoad {
+    std::string engineId;
+    Clock::time_point start;
+    std::chrono::milliseconds latency;
+    PolicyProfileObserverImpl::PolicyFetch policyFetch = PolicyProfileObserverImpl::PolicyFetch::Unknown;
+    std::shared_ptr<mip::PolicyEngine> engine;
+    std::string error;
+  };
+  struct WarmUpContext;
+
+  std::shared_ptr<mip::PolicyProfile> GetProfile();
+  Deadline GetDeadline(size_t timeoutMs) const;
+  std::shared_ptr<CachedEngine> GetDefaultEngine(Deadline deadline = Deadline::max());
+  size_t GetEngineReplicaCount() const;
+  std::shared_ptr<CachedEngine> GetEngineReplica(const std::shared_ptr<CachedEngine>& engine);
+  void LoadEngineReplicasInBackground(const std::shared_ptr<CachedEngine>& engine);
+  void ReplicaLoadLoop();
+  void LoadEngineReplicas(const std::shared_ptr<CachedEngine>& engine);
+  void ReleaseEngineReplicas(const std::vector<std::shared_ptr<CachedEngine>>& replicas);
+  void UnlockAfterFork();
+  std::shared_ptr<CachedEngine> LoadCachedEngine(const mip::Identity& identity, const std::string& engineId);
+  std::shared_ptr<CachedEngine> CreateCachedEngine(const std::shared_ptr<mip::PolicyEngine>& engine);
+  mip::PolicyEngine::Settings GetExistingEngineSettings(const std::string& engineId);
+  std::shared_ptr<CachedEngine> GetCachedEngine(const ExecutionStateOptions& options, Deadline deadline);
+  std::string GetSharedResultKey(char type, const ExecutionStateImpl& state, Deadline deadline);
+  std::shared_ptr<mip::ContentLabel> GetSensitivityLabel(ExecutionStateImpl& state, Deadline deadline, bool* isStale);
+  std::vector<std::shared_ptr<mip::Action>> GetActions(ExecutionStateImpl& state, Deadline deadline, bool* isStale);
+  std::shared_ptr<mip::ContentLabel> GetSensitivityLabelBefore(ExecutionStateImpl& state, Deadline deadline);
+  std::vector<std::shared_ptr<mip::Action>> GetActionsBefore(ExecutionStateImpl& state, Deadline deadline);
+  std::shared_ptr<mip::ContentLabel> EvaluateSensitivityLabel(
+      CachedEngine& engine,
+      ExecutionStateImpl& state,
+      uint64_t generation);
+  std::shared_ptr<mip::PolicyEngine> CreateNewPolicyEngine(const mip::Identity& identity);
   std::shared_ptr<mip::PolicyEngine> LoadExistingPolicyEngine(const std::string& engineId);
+  void UnloadPolicyEngine(const std::string& engineId);
   std::vector<std::pair<std::string, std::string>> GetCustomPolicySettings();
   void OnPolicyChanged(const std::string& engineId);
+  void ReloadPolicyEngine(const std::string& engineId);
   void SimulatePolicyChange(const std::shared_ptr<mip::PolicyEngine>& engine);
 
   AuthenticationOptions mAuthOptions;
   ProfileOptions mProfileOptions;
   std::shared_ptr<sample::auth::AuthDelegateImpl> mAuthDelegate;
   std::shared_ptr<PolicyProfileObserverImpl> mProfileObserver;
-  std::shared_ptr<mip::PolicyProfile> mProfile;
-  std::shared_ptr<mip::PolicyEngine> mEngine;
+  AsyncProfileOperations mProfileOperations;
+  StartupTimeline& mStartupTimeline;
+  std::promise<std::shared_ptr<mip::PolicyProfile>> mProfilePromise;
+  std::shared_future<std::shared_ptr<mip::PolicyProfile>> mProfile; // set once the profile has loaded
+  std::thread mEngineLoadThread;
   std::string mLocale;
   bool mLoadSensitivityTypes;
+  EngineCache mEngineCache;
+  // Engine for <username>, never evicted while held here. Read with std::atomic_load and replaced with
+  // std::atomic_store/compare_exchange so requests always see a fully loaded engine.
+  std::shared_ptr<CachedEngine> mDefaultEngine;
+  // With ProfileOptions::engineReplicas, mDefaultEngine followed by its replicas. Replaced as a whole (atomic_store)
+  // after a reload; until then threads are served by the reloaded mDefaultEngine alone. Only the replica load thread
+  // replaces it, releasing the replicas of the previous set.
+  std::shared_ptr<const std::vector<std::shared_ptr<CachedEngine>>> mEngineReplicas;
+  // Replicas are loaded on mReplicaLoadThread, started on first use, for the latest engine handed to it
+  std::thread mReplicaLoadThread;
+  std::condition_variable mReplicaLoadRequested;
+  std::shared_ptr<CachedEngine> mPendingReplicaEngine;
+  bool mIsLoadingReplicas;
+  bool mIsReplicaLoadPaused; // by PrepareFork
+  bool mIsStoppingReplicaLoads;
+  mutable std::mutex mReplicaMutex;
+  std::chrono::milliseconds mReplicaLoadTime; // of the latest replica set
+  size_t mSharedEngineMemory; // resident bytes before and after loading the latest replica set, 0 if unknown
+  size_t mReplicatedEngineMemory;
+  ResultCache<std::vector<std::shared_ptr<mip::Action>>> mActionCache; // keyed by engine id + execution state
+  LabelCache mLabelCache;
+  // In-flight evaluations, keyed by cache generation, engine id and execution state
+  SingleFlight<std::vector<std::shared_ptr<mip::Action>>> mActionFlights;
+  SingleFlight<std::shared_ptr<mip::ContentLabel>> mLabelFlights;
+  // Last good results, keyed by identity and execution state. Kept across policy changes since they only answer
+  // requests that could not get a current result in time.
+  ResultCache<std::vector<std::shared_ptr<mip::Action>>> mStaleActions;
+  ResultCache<std::shared_ptr<mip::ContentLabel>> mStaleLabels;
+  std::unique_ptr<SharedResultCache> mSharedResults; // with ProfileOptions::sharedResultCacheName
+  std::atomic<bool> mIsEngineLoadDisabled;
+  std::atomic<uint64_t> mPublishedReloads;
+  std::atomic<uint64_t> mDeadlinesExceeded;
+  std::atomic<uint64_t> mStaleResults;
+  std::atomic<uint64_t> mActionPlanHits;
+  mutable std::mutex mActionPlanMutex;
+  uint64_t mActionPlanTables; // tables built so far
+  size_t mLastActionPlanSize; // plans, memory and build time of the latest table
+  size_t mLastActionPlanBytes;
+  std::chrono::milliseconds mLastActionPlanBuildTime;
+  ReloadScheduler mReloadScheduler;
+  std::vector<std::shared_ptr<CachedEngine>> mForkEngines; // whose handler pools PrepareFork locked
 };
 
 } // namespace sample
@@ -0,0 +1,131 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "action_plan_table.h"
+
+#include <exception>
+
+#include "mip/upe/label.h"
+#include "mip/upe/policy_handler.h"
+
+#include "execution_state_impl.h"
+#include "worker_pool.h"
+
+using std::exception;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Rough footprint of a computed mip::Action and of a table/cache entry's bookkeeping
+const size_t kApproximateActionBytes = 512;
+const size_t kApproximateEntryOverhead = 128;
+
+const mip::ContentFormat kContentFormats[] = { mip::ContentFormat::DEFAULT, mip::ContentFormat::EMAIL };
+const mip::DataState kDataStates[] = { mip::DataState::REST, mip::DataState::MOTION, mip::DataState::USE };
+
+void AddLabelIds(const vector<shared_ptr<mip::Label>>& labels, vector<string>& labelIds) {
+  for (const shared_ptr<mip::Label>& label : labels) {
+    labelIds.push_back(label->GetId());
+    AddLabelIds(label->GetChildren(), labelIds);
+  }
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+size_t GetApproximateActionsSize(const vector<shared_ptr<mip::Action>>& actions) {
+  return actions.size() * kApproximateActionBytes;
+}
+
+shared_ptr<const ActionPlanTable> ActionPlanTable::Build(
+    const shared_ptr<mip::PolicyEngine>& engine,
+    size_t threadCount) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  vector<string> labelIds;
+  AddLabelIds(engine->ListSensitivityLabels(), labelIds);
+
+  vector<ExecutionStateOptions> states;
+  for (const string& labelId : labelIds) {
+    for (mip::ContentFormat contentFormat : kContentFormats) {
+      for (mip::DataState dataState : kDataStates) {
+        ExecutionStateOptions options;
+        options.newLabelId = labelId;
+        options.contentFormat = contentFormat;
+        options.dataState = dataState;
+        options.isAuditDiscoveryEnabled = false;
+        states.push_back(options);
+      }
+    }
+  }
+
+  // Each worker evaluates with its own handler. Handlers are created with audit discovery disabled so that building the
+  // table never emits audit events for content that doesn't exist; the setting doesn't change the computed actions.
+  WorkerPool pool(threadCount);
+  vector<shared_ptr<mip::PolicyHandler>> handlers(pool.GetThreadCount());
+  vector<vector<shared_ptr<mip::Action>>> actions(states.size());
+  vector<char> isComputed(states.size());
+  pool.ParallelFor(states.size(), [&](size_t workerIndex, size_t item) {
+    shared_ptr<mip::PolicyHandler>& handler = handlers[workerIndex];
+    try {
+      if (nullptr == handler)
+        handler = engine->CreatePolicyHandler(false /*isAuditDiscoveryEnabled*/);
+      actions[item] = handler->ComputeActions(ExecutionStateImpl(states[item]));
+      isComputed[item] = true;
+    } catch (const exception&) {
+      // Not precomputed, requests for this state are evaluated as usual
+    }
+  });
+
+  shared_ptr<ActionPlanTable> table(new ActionPlanTable());
+  for (size_t i = 0; i < states.size(); ++i) {
+    if (!isComputed[i])
+      continue;
+    // The same plan, sharing its actions, serves requests with and without audit discovery
+    table->mApproximateBytes += GetApproximateActionsSize(actions[i]);
+    for (bool isAuditDiscoveryEnabled : { false, true }) {
+      states[i].isAuditDiscoveryEnabled = isAuditDiscoveryEnabled;
+      string fingerprint = ExecutionStateImpl(states[i]).GetFingerprint();
+      table->mApproximateBytes += fingerprint.size() + kApproximateEntryOverhead;
+      table->mPlans[fingerprint] = actions[i];
+    }
+  }
+  table->mBuildTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  return table;
+}
+
+const vector<shared_ptr<mip::Action>>* ActionPlanTable::Find(const string& fingerprint) const {
+  auto it = mPlans.find(fingerprint);
+  return it != mPlans.end() ? &it->second : nullptr;
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,77 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_ACTION_PLAN_TABLE_H_
+#define SAMPLES_UPE_ACTION_PLAN_TABLE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mip/upe/action.h"
+#include "mip/upe/policy_engine.h"
+
+namespace sample {
+namespace upe {
+
+// Rough memory footprint of computed actions (objects, ids, text/font strings), used to bound caches and size tables
+size_t GetApproximateActionsSize(const std::vector<std::shared_ptr<mip::Action>>& actions);
+
+// Actions precomputed for the execution states most requests boil down to: applying a label to unlabeled content,
+// for every label in the policy, content format, data state and audit setting, with all other fields at their defaults.
+// The table is built once after an engine is loaded and never modified, so lookups need no locking.
+class ActionPlanTable {
+public:
+  // Computes every plan with 'engine', spread across 'threadCount' threads. States the engine fails to evaluate are
+  // left out of the table.
+  static std::shared_ptr<const ActionPlanTable> Build(
+      const std::shared_ptr<mip::PolicyEngine>& engine,
+      size_t threadCount);
+
+  // Returns the precomputed actions for an execution state fingerprint (ExecutionStateImpl::GetFingerprint), or nullptr
+  // if the state isn't one of the precomputed ones
+  const std::vector<std::shared_ptr<mip::Action>>* Find(const std::string& fingerprint) const;
+
+  size_t GetSize() const { return mPlans.size(); }
+  size_t GetApproximateBytes() const { return mApproximateBytes; }
+  std::chrono::milliseconds GetBuildTime() const { return mBuildTime; }
+
+private:
+  ActionPlanTable() : mApproximateBytes(0), mBuildTime(0) {}
+
+  std::unordered_map<std::string, std::vector<std::shared_ptr<mip::Action>>> mPlans; // keyed by state fingerprint
+  size_t mApproximateBytes;
+  std::chrono::milliseconds mBuildTime;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_ACTION_PLAN_TABLE_H_
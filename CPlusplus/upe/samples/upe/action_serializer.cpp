@@ -0,0 +1,395 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "action_serializer.h"
+
+#include "mip/upe/add_content_footer_action.h"
+#include "mip/upe/add_content_header_action.h"
+#include "mip/upe/add_watermark_action.h"
+#include "mip/upe/apply_label_action.h"
+#include "mip/upe/custom_action.h"
+#include "mip/upe/metadata_action.h"
+#include "mip/upe/protect_by_template_action.h"
+#include "mip/upe/recommend_label_action.h"
+#include "mip/upe/remove_content_footer_action.h"
+#include "mip/upe/remove_content_header_action.h"
+#include "mip/upe/remove_watermark_action.h"
+
+#include "result_writer.h"
+
+using sample::upe::ActionField;
+using sample::upe::ActionFieldType;
+using sample::upe::ActionTypeDescriptor;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Names of enum values, indexed by value
+const char* const kAlignmentNames[] = {"Left", "Right", "Center"};
+const char* const kAlignmentJson[] = {"\"Left\"", "\"Right\"", "\"Center\""};
+const char* const kLayoutNames[] = {"Horizontal", "Diagonal"};
+const char* const kLayoutJson[] = {"\"Horizontal\"", "\"Diagonal\""};
+
+template <size_t N>
+const char* GetEnumName(const char* const (&names)[N], unsigned int value, const char* unknown) {
+  return value < N ? names[value] : unknown;
+}
+
+// Field accessors, instantiated per action type and getter. Some getters are not const.
+template <typename T, typename R, R (T::*Get)() const>
+R Read(mip::Action& action) {
+  return (static_cast<T&>(action).*Get)();
+}
+
+template <typename T, typename R, R (T::*Get)()>
+R ReadMutable(mip::Action& action) {
+  return (static_cast<T&>(action).*Get)();
+}
+
+// Content header and footer actions expose the same fields through unrelated types
+template <typename T>
+vector<ActionField> GetContentMarkFields() {
+  return {
+    ActionField("uiElementName", "UIElementName", &ReadMutable<T, const string&, &T::GetUIElementName>),
+    ActionField("text", "Text", &Read<T, const string&, &T::GetText>),
+    ActionField("fontName", "FontName", &Read<T, const string&, &T::GetFontName>),
+    ActionField("fontSize", "FontSize", &Read<T, int, &T::GetFontSize>),
+    ActionField("fontColor", "FontColor", &Read<T, const string&, &T::GetFontColor>),
+    ActionField("alignment", "Alignment", &Read<T, mip::ContentMarkAlignment, &T::GetAlignment>),
+    ActionField("margin", "Margin", &Read<T, int, &T::GetMargin>),
+  };
+}
+
+template <typename T>
+vector<ActionField> GetRemoveContentMarkFields() {
+  return {
+    ActionField(
+        "uiElementNames", "UIElementNames", &ReadMutable<T, const vector<string>&, &T::GetUIElementNames>),
+  };
+}
+
+template <typename T>
+vector<ActionField> GetLabelFields() {
+  return {
+    ActionField("labelId", "LabelId", &Read<T, const string&, &T::GetLabelId>),
+    ActionField("classificationIds", "ClassificationIds", &Read<T, const vector<string>&, &T::GetClassificationIds>),
+  };
+}
+
+void AddDescriptor(
+    mip::ActionType type,
+    const char* jsonName,
+    const char* textName,
+    vector<ActionField> fields,
+    vector<ActionTypeDescriptor>& descriptors) {
+  ActionTypeDescriptor& descriptor = descriptors[sample::upe::GetActionTypeIndex(type)];
+  descriptor.type = type;
+  descriptor.jsonType = ",\"type\":\"";
+  descriptor.jsonType += jsonName;
+  descriptor.jsonType += '"';
+  descriptor.textName = textName;
+  descriptor.fields = std::move(fields);
+}
+
+// Indexed by GetActionTypeIndex. Text names are those earlier versions printed.
+vector<ActionTypeDescriptor> CreateDescriptors() {
+  typedef mip::AddWatermarkAction Watermark;
+  typedef mip::CustomAction Custom;
+  typedef mip::MetadataAction Metadata;
+  typedef mip::ProtectByTemplateAction ProtectByTemplate;
+
+  vector<ActionTypeDescriptor> descriptors(sample::upe::kActionTypeCount);
+  AddDescriptor(mip::ActionType::ADD_CONTENT_FOOTER, "AddContentFooter", "AddContentFooter",
+      GetContentMarkFields<mip::AddContentFooterAction>(), descriptors);
+  AddDescriptor(mip::ActionType::ADD_CONTENT_HEADER, "AddContentHeader", "AddContentHeader",
+      GetContentMarkFields<mip::AddContentHeaderAction>(), descriptors);
+  AddDescriptor(mip::ActionType::ADD_WATERMARK, "AddWatermark", "AddWatermarkAction", {
+      ActionField(
+          "uiElementName", "UIElementName", &ReadMutable<Watermark, const string&, &Watermark::GetUIElementName>),
+      ActionField("layout", "Layout", &Read<Watermark, mip::WatermarkLayout, &Watermark::GetLayout>),
+      ActionField("text", "Text", &Read<Watermark, const string&, &Watermark::GetText>),
+      ActionField("fontName", "FontName", &Read<Watermark, const string&, &Watermark::GetFontName>),
+      ActionField("fontSize", "FontSize", &Read<Watermark, int, &Watermark::GetFontSize>),
+      ActionField("fontColor", "FontColor", &Read<Watermark, const string&, &Watermark::GetFontColor>),
+    }, descriptors);
+  AddDescriptor(mip::ActionType::CUSTOM, "Custom", "Custom", {
+      ActionField("name", nullptr, &Read<Custom, const string&, &Custom::GetName>),
+      ActionField(
+          "properties", "Properties", &Read<Custom, const vector<pair<string, string>>&, &Custom::GetProperties>),
+    }, descriptors);
+  AddDescriptor(mip::ActionType::JUSTIFY, "Justify", "Justify", {}, descriptors);
+  AddDescriptor(mip::ActionType::METADATA, "Metadata", "Metadata", {
+      ActionField("remove", "Remove", &Read<Metadata, const vector<string>&, &Metadata::GetMetadataToRemove>, true),
+      ActionField("add", "Add", &Read<Metadata, const vector<pair<string, string>>&, &Metadata::GetMetadataToAdd>),
+    }, descriptors);
+  AddDescriptor(mip::ActionType::PROTECT_ADHOC, "ProtectAdHoc", "ProtectAdHoc", {}, descriptors);
+  AddDescriptor(mip::ActionType::PROTECT_BY_TEMPLATE, "ProtectByTemplate", "ProtectByTemplate", {
+      ActionField(
+          "templateId", "TemplateId", &Read<ProtectByTemplate, const string&, &ProtectByTemplate::GetTemplateId>),
+    }, descriptors);
+  AddDescriptor(mip::ActionType::PROTECT_DO_NOT_FORWARD, "ProtectDoNotForward", "ProtectDoNotForward", {}, descriptors);
+  AddDescriptor(mip::ActionType::REMOVE_CONTENT_FOOTER, "RemoveContentFooter", "RemoveContentFooterAction",
+      GetRemoveContentMarkFields<mip::RemoveContentFooterAction>(), descriptors);
+  AddDescriptor(mip::ActionType::REMOVE_CONTENT_HEADER, "RemoveContentHeader", "RemoveContentHeaderAction",
+      GetRemoveContentMarkFields<mip::RemoveContentHeaderAction>(), descriptors);
+  AddDescriptor(mip::ActionType::REMOVE_PROTECTION, "RemoveProtection", "RemoveProtection", {}, descriptors);
+  AddDescriptor(mip::ActionType::REMOVE_WATERMARK, "RemoveWatermark", "RemoveWatermarkAction",
+      GetRemoveContentMarkFields<mip::RemoveWatermarkAction>(), descriptors);
+  AddDescriptor(mip::ActionType::APPLY_LABEL, "ApplyLabel", "ApplyLabel",
+      GetLabelFields<mip::ApplyLabelAction>(), descriptors);
+  AddDescriptor(mip::ActionType::RECOMMEND_LABEL, "RecommendLabel", "RecommendLabel",
+      GetLabelFields<mip::RecommendLabelAction>(), descriptors);
+  return descriptors;
+}
+
+void AppendInteger(int value, string& out) {
+  char digits[16];
+  char* end = digits + sizeof(digits);
+  char* begin = end;
+  unsigned int magnitude = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+  do {
+    *--begin = static_cast<char>('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (value < 0)
+    *--begin = '-';
+  out.append(begin, end);
+}
+
+void AppendFieldJson(const ActionField& field, mip::Action& action, string& out) {
+  out += field.jsonKey;
+  switch (field.type) {
+    case ActionFieldType::String:
+      sample::upe::AppendJsonString(field.getString(action), out);
+      break;
+
+    case ActionFieldType::Integer:
+      AppendInteger(field.getInteger(action), out);
+      break;
+
+    case ActionFieldType::Alignment:
+      out += GetEnumName(kAlignmentJson, static_cast<unsigned int>(field.getAlignment(action)), "\"Unknown\"");
+      break;
+
+    case ActionFieldType::Layout:
+      out += GetEnumName(kLayoutJson, static_cast<unsigned int>(field.getLayout(action)), "\"Unknown\"");
+      break;
+
+    case ActionFieldType::StringList: {
+      const vector<string>& values = field.getStringList(action);
+      out += '[';
+      for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0)
+          out += ',';
+        sample::upe::AppendJsonString(values[i], out);
+      }
+      out += ']';
+      break;
+    }
+
+    case ActionFieldType::StringPairs: {
+      const vector<pair<string, string>>& values = field.getStringPairs(action);
+      out += '{';
+      for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0)
+          out += ',';
+        sample::upe::AppendJsonString(values[i].first, out);
+        out += ':';
+        sample::upe::AppendJsonString(values[i].second, out);
+      }
+      out += '}';
+      break;
+    }
+  }
+}
+
+// Scalars as "  <name>: <value>", lists and pairs as an indented block that is left out when empty
+void AppendFieldText(const ActionField& field, mip::Action& action, string& out) {
+  switch (field.type) {
+    case ActionFieldType::String:
+    case ActionFieldType::Integer:
+    case ActionFieldType::Alignment:
+    case ActionFieldType::Layout:
+      out += "  ";
+      out += field.textName;
+      out += ": ";
+      if (field.type == ActionFieldType::String)
+        out += field.getString(action);
+      else if (field.type == ActionFieldType::Integer)
+        AppendInteger(field.getInteger(action), out);
+      else if (field.type == ActionFieldType::Alignment)
+        out += GetEnumName(kAlignmentNames, static_cast<unsigned int>(field.getAlignment(action)), "Unknown");
+      else
+        out += GetEnumName(kLayoutNames, static_cast<unsigned int>(field.getLayout(action)), "Unknown");
+      out += '\n';
+      break;
+
+    case ActionFieldType::StringList: {
+      const vector<string>& values = field.getStringList(action);
+      if (values.empty())
+        break;
+      out += "  ";
+      out += field.textName;
+      out += ":\n";
+      for (const string& value : values) {
+        out += field.isQuotedInText ? "    '" : "    ";
+        out += value;
+        out += field.isQuotedInText ? "'\n" : "\n";
+      }
+      break;
+    }
+
+    case ActionFieldType::StringPairs: {
+      const vector<pair<string, string>>& values = field.getStringPairs(action);
+      if (values.empty())
+        break;
+      out += "  ";
+      out += field.textName;
+      out += ":\n";
+      for (const pair<string, string>& value : values) {
+        out += "    '";
+        out += value.first;
+        out += "' : '";
+        out += value.second;
+        out += "'\n";
+      }
+      break;
+    }
+  }
+}
+
+string GetJsonKey(const char* jsonName) {
+  string key = ",\"";
+  key += jsonName;
+  key += "\":";
+  return key;
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+ActionField::ActionField(const char* jsonName, const char* textName, StringGetter get)
+    : type(ActionFieldType::String), jsonKey(GetJsonKey(jsonName)), textName(textName), isQuotedInText(false) {
+  getString = get;
+}
+
+ActionField::ActionField(const char* jsonName, const char* textName, IntegerGetter get)
+    : type(ActionFieldType::Integer), jsonKey(GetJsonKey(jsonName)), textName(textName), isQuotedInText(false) {
+  getInteger = get;
+}
+
+ActionField::ActionField(const char* jsonName, const char* textName, AlignmentGetter get)
+    : type(ActionFieldType::Alignment), jsonKey(GetJsonKey(jsonName)), textName(textName), isQuotedInText(false) {
+  getAlignment = get;
+}
+
+ActionField::ActionField(const char* jsonName, const char* textName, LayoutGetter get)
+    : type(ActionFieldType::Layout), jsonKey(GetJsonKey(jsonName)), textName(textName), isQuotedInText(false) {
+  getLayout = get;
+}
+
+ActionField::ActionField(const char* jsonName, const char* textName, StringListGetter get, bool isQuotedInText)
+    : type(ActionFieldType::StringList),
+      jsonKey(GetJsonKey(jsonName)),
+      textName(textName),
+      isQuotedInText(isQuotedInText) {
+  getStringList = get;
+}
+
+ActionField::ActionField(const char* jsonName, const char* textName, StringPairsGetter get)
+    : type(ActionFieldType::StringPairs), jsonKey(GetJsonKey(jsonName)), textName(textName), isQuotedInText(false) {
+  getStringPairs = get;
+}
+
+size_t GetActionTypeIndex(mip::ActionType type) {
+  unsigned int bits = static_cast<unsigned int>(type);
+  if (bits == 0 || (bits & (bits - 1)) != 0)
+    return kActionTypeCount;
+  size_t index = 0;
+  while ((bits >>= 1) != 0)
+    ++index;
+  return index < kActionTypeCount ? index : kActionTypeCount;
+}
+
+const ActionTypeDescriptor* GetActionTypeDescriptor(mip::ActionType type) {
+  static const vector<ActionTypeDescriptor> descriptors = CreateDescriptors();
+  size_t index = GetActionTypeIndex(type);
+  return index < descriptors.size() ? &descriptors[index] : nullptr;
+}
+
+void AppendActionJson(mip::Action& action, string& out) {
+  out += "{\"id\":";
+  AppendJsonString(action.GetId(), out);
+
+  const ActionTypeDescriptor* descriptor = GetActionTypeDescriptor(action.GetType());
+  if (nullptr == descriptor) {
+    out += ",\"type\":\"Unknown\"}";
+    return;
+  }
+  out += descriptor->jsonType;
+  for (const ActionField& field : descriptor->fields)
+    AppendFieldJson(field, action, out);
+  out += '}';
+}
+
+void AppendActionText(mip::Action& action, string& out) {
+  out += "ACTION:\n  Id: ";
+  out += action.GetId();
+  out += "\n  Type: ";
+
+  const ActionTypeDescriptor* descriptor = GetActionTypeDescriptor(action.GetType());
+  if (nullptr == descriptor) {
+    out += "Unknown\n\n";
+    return;
+  }
+  out += descriptor->textName;
+  out += '\n';
+  for (const ActionField& field : descriptor->fields) {
+    if (nullptr != field.textName)
+      AppendFieldText(field, action, out);
+  }
+
+  // Actions are separated by a blank line
+  out += '\n';
+}
+
+void AppendActionsText(const vector<shared_ptr<mip::Action>>& actions, string& out) {
+  if (actions.empty()) {
+    out += "NO ACTIONS\n";
+    return;
+  }
+  for (const shared_ptr<mip::Action>& action : actions)
+    AppendActionText(*action, out);
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,110 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_ACTION_SERIALIZER_H_
+#define SAMPLES_UPE_ACTION_SERIALIZER_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mip/common_types.h"
+#include "mip/upe/action.h"
+
+namespace sample {
+namespace upe {
+
+enum class ActionFieldType {
+  String,
+  Integer,
+  Alignment,   // mip::ContentMarkAlignment
+  Layout,      // mip::WatermarkLayout
+  StringList,
+  StringPairs,
+};
+
+// One field of an action type: its name in JSON and text output, and the accessor reading it from an action of that
+// type. The constructor taking the accessor determines the field's type.
+struct ActionField {
+  typedef const std::string& (*StringGetter)(mip::Action& action);
+  typedef int (*IntegerGetter)(mip::Action& action);
+  typedef mip::ContentMarkAlignment (*AlignmentGetter)(mip::Action& action);
+  typedef mip::WatermarkLayout (*LayoutGetter)(mip::Action& action);
+  typedef const std::vector<std::string>& (*StringListGetter)(mip::Action& action);
+  typedef const std::vector<std::pair<std::string, std::string>>& (*StringPairsGetter)(mip::Action& action);
+
+  ActionField(const char* jsonName, const char* textName, StringGetter get);
+  ActionField(const char* jsonName, const char* textName, IntegerGetter get);
+  ActionField(const char* jsonName, const char* textName, AlignmentGetter get);
+  ActionField(const char* jsonName, const char* textName, LayoutGetter get);
+  ActionField(const char* jsonName, const char* textName, StringListGetter get, bool isQuotedInText = false);
+  ActionField(const char* jsonName, const char* textName, StringPairsGetter get);
+
+  ActionFieldType type;
+  std::string jsonKey;  // ',"<jsonName>":'
+  const char* textName; // nullptr if the field is not part of text output
+  bool isQuotedInText;  // list items are shown as 'item' rather than item
+  union {
+    StringGetter getString;
+    IntegerGetter getInteger;
+    AlignmentGetter getAlignment;
+    LayoutGetter getLayout;
+    StringListGetter getStringList;
+    StringPairsGetter getStringPairs;
+  };
+};
+
+// How actions of one mip::ActionType are serialized: the type's names and its fields, in output order
+struct ActionTypeDescriptor {
+  mip::ActionType type;
+  std::string jsonType; // ',"type":"<name>"'
+  const char* textName;
+  std::vector<ActionField> fields;
+};
+
+// Number of action types known to this sample, i.e. the bit positions of mip::ActionType values
+const size_t kActionTypeCount = 15;
+
+// Bit position of a single mip::ActionType value, or kActionTypeCount if 'type' is not one known to this sample
+size_t GetActionTypeIndex(mip::ActionType type);
+
+// Descriptor of 'type', or nullptr if it is not one known to this sample
+const ActionTypeDescriptor* GetActionTypeDescriptor(mip::ActionType type);
+
+// Append one action, or all of them, to 'out' as a single-line JSON object/array (see result_writer.h) or as the
+// human-readable text printed by <computeActions>. Action types unknown to this sample are written with type "Unknown"
+// and no fields. Nothing is allocated per action beyond what 'out' grows by.
+void AppendActionJson(mip::Action& action, std::string& out);
+void AppendActionText(mip::Action& action, std::string& out);
+void AppendActionsText(const std::vector<std::shared_ptr<mip::Action>>& actions, std::string& out);
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_ACTION_SERIALIZER_H_
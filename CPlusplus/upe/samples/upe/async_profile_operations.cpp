@@ -0,0 +1,179 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "async_profile_operations.h"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+#include "policy_profile_observer_impl.h"
+
+using std::exception_ptr;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Blocks until a continuation it hands out runs. Lives on the waiting thread's stack, so the continuation only captures
+// a pointer and fits in std::function's inline storage.
+template <typename T>
+class Waiter {
+public:
+  Waiter() : mIsDone(false) {}
+
+  typename sample::upe::CompletionToken<T>::Continuation GetContinuation() {
+    return [this](const exception_ptr& error, const T& result) { Set(error, result); };
+  }
+
+  T Wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mIsDone; });
+    if (mError)
+      std::rethrow_exception(mError);
+    return mResult;
+  }
+
+private:
+  void Set(const exception_ptr& error, const T& result) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mError = error;
+    mResult = result;
+    mIsDone = true;
+    mDone.notify_all();
+  }
+
+  std::mutex mMutex;
+  std::condition_variable mDone;
+  bool mIsDone;
+  exception_ptr mError;
+  T mResult;
+};
+
+// Starts an operation with a pooled token. An operation failing synchronously is reported to the continuation too, which
+// also returns the token to the pool.
+template <typename T, typename Operation>
+void StartOperation(
+    sample::upe::CompletionTokenPool<T>& tokens,
+    typename sample::upe::CompletionToken<T>::Continuation continuation,
+    Operation operation) {
+  shared_ptr<sample::upe::CompletionToken<T>> token = tokens.Acquire(std::move(continuation));
+  try {
+    operation(token);
+  } catch (...) {
+    token->Fail(std::current_exception());
+  }
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+void AsyncProfileOperations::Load(const mip::PolicyProfile::Settings& settings, LoadContinuation continuation) {
+  StartOperation(mLoadTokens, std::move(continuation), [&settings](const shared_ptr<void>& context) {
+      mip::PolicyProfile::LoadAsync(settings, context); });
+}
+
+void AsyncProfileOperations::ListEngines(mip::PolicyProfile& profile, ListEnginesContinuation continuation) {
+  StartOperation(mListEnginesTokens, std::move(continuation), [&profile](const shared_ptr<void>& context) {
+      profile.ListEnginesAsync(context); });
+}
+
+void AsyncProfileOperations::AddEngine(
+    mip::PolicyProfile& profile,
+    const mip::PolicyEngine::Settings& settings,
+    AddEngineContinuation continuation) {
+  // A load can be told apart from others only if none started while it was in flight: neither before it (another was
+  // in flight when it started) nor after it (the start count moved on)
+  uint64_t start = ++mAddEngineStarts;
+  bool isStartedAlone = ++mAddEnginesInFlight == 1;
+  AddEngineContinuation countedContinuation = [this, start, isStartedAlone, continuation](
+      const exception_ptr& error,
+      const shared_ptr<mip::PolicyEngine>& engine) {
+    bool isAlone = isStartedAlone && mAddEngineStarts.load() == start;
+    --mAddEnginesInFlight;
+    if (!isAlone)
+      PolicyProfileObserverImpl::ForgetPolicyFetchOnThisThread();
+    continuation(error, engine);
+  };
+  StartOperation(mAddEngineTokens, std::move(countedContinuation), [&profile, &settings](const shared_ptr<void>& ctx) {
+      profile.AddEngineAsync(settings, ctx); });
+}
+
+void AsyncProfileOperations::UnloadEngine(
+    mip::PolicyProfile& profile,
+    const string& engineId,
+    EngineContinuation continuation) {
+  StartOperation(mEngineTokens, std::move(continuation), [&profile, &engineId](const shared_ptr<void>& context) {
+      profile.UnloadEngineAsync(engineId, context); });
+}
+
+void AsyncProfileOperations::DeleteEngine(
+    mip::PolicyProfile& profile,
+    const string& engineId,
+    EngineContinuation continuation) {
+  StartOperation(mEngineTokens, std::move(continuation), [&profile, &engineId](const shared_ptr<void>& context) {
+      profile.DeleteEngineAsync(engineId, context); });
+}
+
+shared_ptr<mip::PolicyProfile> AsyncProfileOperations::LoadAndWait(const mip::PolicyProfile::Settings& settings) {
+  Waiter<shared_ptr<mip::PolicyProfile>> waiter;
+  Load(settings, waiter.GetContinuation());
+  return waiter.Wait();
+}
+
+vector<string> AsyncProfileOperations::ListEnginesAndWait(mip::PolicyProfile& profile) {
+  Waiter<vector<string>> waiter;
+  ListEngines(profile, waiter.GetContinuation());
+  return waiter.Wait();
+}
+
+shared_ptr<mip::PolicyEngine> AsyncProfileOperations::AddEngineAndWait(
+    mip::PolicyProfile& profile,
+    const mip::PolicyEngine::Settings& settings) {
+  Waiter<shared_ptr<mip::PolicyEngine>> waiter;
+  AddEngine(profile, settings, waiter.GetContinuation());
+  return waiter.Wait();
+}
+
+void AsyncProfileOperations::UnloadEngineAndWait(mip::PolicyProfile& profile, const string& engineId) {
+  Waiter<NoResult> waiter;
+  UnloadEngine(profile, engineId, waiter.GetContinuation());
+  waiter.Wait();
+}
+
+void AsyncProfileOperations::DeleteEngineAndWait(mip::PolicyProfile& profile, const string& engineId) {
+  Waiter<NoResult> waiter;
+  DeleteEngine(profile, engineId, waiter.GetContinuation());
+  waiter.Wait();
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,93 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_ASYNC_PROFILE_OPERATIONS_H_
+#define SAMPLES_UPE_ASYNC_PROFILE_OPERATIONS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/upe/policy_engine.h"
+#include "mip/upe/policy_profile.h"
+
+#include "completion_token.h"
+
+namespace sample {
+namespace upe {
+
+// Continuation-passing wrappers over the PolicyProfile async operations. Each operation takes its context from a pool
+// of completion tokens and returns immediately; the continuation runs on the SDK thread that completes it, so any number
+// of operations (e.g. engine loads for many tenants) can be pending without a thread blocked on each. The *AndWait
+// variants block the calling thread for the sample's synchronous flows. Requires the profile's observer to be a
+// PolicyProfileObserverImpl.
+class AsyncProfileOperations {
+public:
+  AsyncProfileOperations() : mAddEnginesInFlight(0), mAddEngineStarts(0) {}
+
+  typedef CompletionToken<std::shared_ptr<mip::PolicyProfile>>::Continuation LoadContinuation;
+  typedef CompletionToken<std::vector<std::string>>::Continuation ListEnginesContinuation;
+  typedef CompletionToken<std::shared_ptr<mip::PolicyEngine>>::Continuation AddEngineContinuation;
+  typedef CompletionToken<NoResult>::Continuation EngineContinuation; // UnloadEngine and DeleteEngine
+
+  void Load(const mip::PolicyProfile::Settings& settings, LoadContinuation continuation);
+  void ListEngines(mip::PolicyProfile& profile, ListEnginesContinuation continuation);
+
+  // The continuation can learn whether the engine's policy was fetched from
+  // PolicyProfileObserverImpl::GetPolicyFetchOnThisThread. That is Unknown if any other AddEngine overlapped this one,
+  // since OnAddEngineStarting carries no context to tell the loads apart.
+  void AddEngine(
+      mip::PolicyProfile& profile,
+      const mip::PolicyEngine::Settings& settings,
+      AddEngineContinuation continuation);
+  void UnloadEngine(mip::PolicyProfile& profile, const std::string& engineId, EngineContinuation continuation);
+  void DeleteEngine(mip::PolicyProfile& profile, const std::string& engineId, EngineContinuation continuation);
+
+  // Blocking variants, rethrowing the operation's error
+  std::shared_ptr<mip::PolicyProfile> LoadAndWait(const mip::PolicyProfile::Settings& settings);
+  std::vector<std::string> ListEnginesAndWait(mip::PolicyProfile& profile);
+  std::shared_ptr<mip::PolicyEngine> AddEngineAndWait(
+      mip::PolicyProfile& profile,
+      const mip::PolicyEngine::Settings& settings);
+  void UnloadEngineAndWait(mip::PolicyProfile& profile, const std::string& engineId);
+  void DeleteEngineAndWait(mip::PolicyProfile& profile, const std::string& engineId);
+
+private:
+  CompletionTokenPool<std::shared_ptr<mip::PolicyProfile>> mLoadTokens;
+  CompletionTokenPool<std::vector<std::string>> mListEnginesTokens;
+  CompletionTokenPool<std::shared_ptr<mip::PolicyEngine>> mAddEngineTokens;
+  CompletionTokenPool<NoResult> mEngineTokens;
+  std::atomic<size_t> mAddEnginesInFlight;
+  std::atomic<uint64_t> mAddEngineStarts;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_ASYNC_PROFILE_OPERATIONS_H_
@@ -0,0 +1,133 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "batch_input.h"
+
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+using std::runtime_error;
+using std::string;
+
+namespace sample {
+namespace upe {
+
+BatchInput::BatchInput(std::istream& input)
+    : mStream(&input),
+      mData(nullptr),
+      mSize(0),
+      mPosition(0),
+      mMapping(nullptr) {}
+
+#ifndef _WIN32
+
+BatchInput::BatchInput(const string& path)
+    : mStream(nullptr),
+      mData(nullptr),
+      mSize(0),
+      mPosition(0),
+      mMapping(nullptr) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw runtime_error("Unable to open batch file '" + path + "'");
+
+  struct stat status;
+  bool isRegularFile = fstat(fd, &status) == 0 && S_ISREG(status.st_mode);
+  if (isRegularFile && status.st_size == 0) {
+    mData = ""; // nothing to map
+  } else if (isRegularFile) {
+    void* mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      mMapping = mapping;
+      mSize = static_cast<size_t>(status.st_size);
+      mData = static_cast<const char*>(mapping);
+      madvise(mapping, mSize, MADV_SEQUENTIAL); // read ahead, the file is read once front to back
+    }
+  }
+  close(fd); // the mapping stays valid
+
+  if (nullptr == mData) {
+    mFile.reset(new std::ifstream(path));
+    if (!*mFile)
+      throw runtime_error("Unable to open batch file '" + path + "'");
+    mStream = mFile.get();
+  }
+}
+
+BatchInput::~BatchInput() {
+  if (nullptr != mMapping)
+    munmap(mMapping, mSize);
+}
+
+#else // _WIN32
+
+// Read whole instead of mapped, so lines are still referenced in place
+BatchInput::BatchInput(const string& path)
+    : mStream(nullptr),
+      mData(nullptr),
+      mSize(0),
+      mPosition(0),
+      mMapping(nullptr) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw runtime_error("Unable to open batch file '" + path + "'");
+  mContents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  mData = mContents.data();
+  mSize = mContents.size();
+}
+
+BatchInput::~BatchInput() {}
+
+#endif // _WIN32
+
+bool BatchInput::ReadLine(string& buffer, StringView& line) {
+  if (nullptr == mData) {
+    if (!std::getline(*mStream, buffer))
+      return false;
+    line = StringView(buffer);
+    return true;
+  }
+
+  if (mPosition >= mSize)
+    return false;
+  const void* newline = memchr(mData + mPosition, '\n', mSize - mPosition);
+  size_t end = nullptr != newline ? static_cast<size_t>(static_cast<const char*>(newline) - mData) : mSize;
+  line = StringView(mData + mPosition, end - mPosition);
+  mPosition = end + 1;
+  return true;
+}
+
+} // namespace sample
+} // namespace upe
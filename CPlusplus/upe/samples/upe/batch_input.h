@@ -0,0 +1,75 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_BATCH_INPUT_H_
+#define SAMPLES_UPE_BATCH_INPUT_H_
+
+#include <cstddef>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+
+#include "string_view.h"
+
+namespace sample {
+namespace upe {
+
+// Lines of batch input. A regular file is mapped into memory and its lines are referenced in place, found with memchr
+// (which the C library vectorizes), so reading them copies nothing. Streams, and files that cannot be mapped such as
+// pipes, are read line by line into the caller's buffer instead.
+class BatchInput {
+public:
+  explicit BatchInput(std::istream& input);
+  // Throws std::runtime_error if the file cannot be opened
+  explicit BatchInput(const std::string& path);
+  ~BatchInput();
+
+  // Reads the next line, without its '\n'. A line read from a stream is stored in 'buffer', so 'line' stays valid
+  // until 'buffer' changes or, for a mapped file, until this input is destroyed. Returns false at the end of input.
+  bool ReadLine(std::string& buffer, StringView& line);
+
+  bool IsMapped() const { return nullptr != mData; }
+  size_t GetMappedBytes() const { return mSize; }
+
+private:
+  BatchInput(const BatchInput&);
+  BatchInput& operator=(const BatchInput&);
+
+  std::unique_ptr<std::ifstream> mFile;
+  std::istream* mStream;
+  const char* mData; // mapped file, or nullptr if reading from mStream
+  size_t mSize;
+  size_t mPosition;
+  void* mMapping;
+  std::string mContents; // file contents where mapping is unavailable
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_BATCH_INPUT_H_
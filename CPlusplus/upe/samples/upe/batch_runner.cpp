@@ -0,0 +1,547 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "batch_runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "execution_state_parser.h"
+#include "result_writer.h"
+#include "worker_pool.h"
+
+using std::endl;
+using std::exception;
+using std::lock_guard;
+using std::mutex;
+using std::ostream;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+// Number of lines handed to each worker per chunk. Lines within a chunk are claimed dynamically, so this only bounds
+// how much input is buffered and how often workers synchronize.
+const size_t kLinesPerWorker = 256;
+
+bool IsBlank(sample::upe::StringView line) {
+  for (size_t i = 0; i < line.GetSize(); ++i) {
+    if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r')
+      return false;
+  }
+  return true;
+}
+
+// Evaluates one input line and appends its JSON result to 'result'. Returns false if the line failed.
+bool EvaluateLine(
+    sample::upe::Action& action,
+    sample::upe::BatchOperation operation,
+    const sample::upe::ExecutionStateOptions& defaults,
+    size_t lineNumber,
+    sample::upe::StringView line,
+    string& result) {
+  bool isSuccess = true;
+  result += "{\"line\":";
+  result += to_string(lineNumber);
+  size_t prefixLength = result.size();
+  try {
+    // Parsed in place, so the state's metadata references the line rather than a copy of it
+    sample::upe::ExecutionStateView view;
+    sample::upe::ParseExecutionStateView(line, defaults, view);
+    sample::upe::ExecutionStateImpl state(std::move(view));
+    bool isStale = false;
+    result += ",\"result\":";
+    if (operation == sample::upe::BatchOperation::ShowLabel)
+      action.WriteSensitivityLabelJson(state, result, &isStale);
+    else
+      action.WriteActionsJson(state, result, &isStale);
+    if (isStale)
+      result += ",\"stale\":true";
+  } catch (const exception& ex) {
+    isSuccess = false;
+    result.resize(prefixLength);
+    result += ",\"error\":";
+    sample::upe::AppendJsonString(ex.what(), result);
+  }
+  result += '}';
+  return isSuccess;
+}
+
+size_t RunSerialBatch(
+    sample::upe::Action& action,
+    sample::upe::BatchOperation operation,
+    const sample::upe::ExecutionStateOptions& defaults,
+    sample::upe::BatchInput& input,
+    sample::upe::OutputSink& output) {
+  size_t failures = 0;
+  size_t lineNumber = 0;
+  string buffer;
+  sample::upe::StringView line;
+
+  while (input.ReadLine(buffer, line)) {
+    ++lineNumber;
+    if (IsBlank(line))
+      continue;
+
+    // Results are formatted straight into the sink's buffer, which is written out in large chunks and flushed once at
+    // the end of the batch
+    if (!EvaluateLine(action, operation, defaults, lineNumber, line, output.BeginRecord()))
+      ++failures;
+    output.EndRecord();
+    action.GetStartupTimeline().Record(sample::upe::StartupTimeline::Stage::FirstResult); // no-op after the first
+  }
+
+  output.Flush();
+  return failures;
+}
+
+// Reads the input in chunks, evaluates each chunk across the worker pool, then writes the chunk's results in order.
+// Concurrent evaluations each lease their own PolicyHandler from the Action's per-engine handler pools.
+size_t RunParallelBatch(
+    sample::upe::Action& action,
+    sample::upe::BatchOperation operation,
+    const sample::upe::ExecutionStateOptions& defaults,
+    size_t threadCount,
+    sample::upe::BatchInput& input,
+    sample::upe::OutputSink& output) {
+  // The engine may still be loading: workers parse their first lines meanwhile and then share the engine cache's load
+  sample::upe::WorkerPool pool(threadCount);
+
+  const size_t chunkSize = threadCount * kLinesPerWorker;
+  vector<string> buffers(chunkSize);
+  vector<sample::upe::StringView> lines(chunkSize);
+  vector<size_t> lineNumbers(chunkSize);
+  vector<string> results(chunkSize);
+  vector<char> isFailed(chunkSize);
+
+  size_t failures = 0;
+  size_t lineNumber = 0;
+  bool isEndOfInput = false;
+  while (!isEndOfInput) {
+    size_t count = 0;
+    while (count < chunkSize) {
+      if (!input.ReadLine(buffers[count], lines[count])) {
+        isEndOfInput = true;
+        break;
+      }
+      ++lineNumber;
+      if (IsBlank(lines[count]))
+        continue;
+      lineNumbers[count++] = lineNumber;
+    }
+
+    pool.ParallelFor(count, [&](size_t worker, size_t item) {
+      sample::upe::Action::PinThreadToEngineReplica(worker);
+      results[item].clear();
+      isFailed[item] = !EvaluateLine(action, operation, defaults, lineNumbers[item], lines[item], results[item]);
+    });
+
+    for (size_t i = 0; i < count; ++i) {
+      output.WriteRecord(results[i].data(), results[i].size());
+      if (isFailed[i])
+        ++failures;
+    }
+    if (count > 0)
+      action.GetStartupTimeline().Record(sample::upe::StartupTimeline::Stage::FirstResult);
+  }
+
+  output.Flush();
+  return failures;
+}
+
+// One input line on its way through the pipeline. Items are recycled, so their buffers are reused across lines.
+struct PipelineItem {
+  size_t sequence = 0; // position among non-blank lines, which is the output order
+  size_t lineNumber = 0;
+  string buffer; // holds the line unless the input is mapped
+  sample::upe::StringView line;
+  unique_ptr<sample::upe::ExecutionStateImpl> state; // references the line
+  shared_ptr<mip::ContentLabel> label;
+  vector<shared_ptr<mip::Action>> actions;
+  bool isStale = false;
+  string sharedResult; // result JSON, written by the compute stage when results are shared across processes
+  string error;
+  string result;
+};
+
+typedef sample::upe::BoundedQueue<PipelineItem*> PipelineQueue;
+typedef std::chrono::steady_clock Clock;
+
+// Time a stage's threads spent working on items, waiting for input and waiting for room downstream
+struct StageStatistics {
+  StageStatistics(const char* stageName, size_t stageThreadCount) : name(stageName), threadCount(stageThreadCount) {}
+
+  const char* name;
+  size_t threadCount;
+  uint64_t items = 0;
+  Clock::duration busy = Clock::duration::zero();
+  Clock::duration starved = Clock::duration::zero();
+  Clock::duration blocked = Clock::duration::zero();
+  uint64_t inputQueueDepthSum = 0; // input queue depth seen before each pop
+  size_t inputQueueCapacity = 0;
+
+  void Add(const StageStatistics& other) {
+    items += other.items;
+    busy += other.busy;
+    starved += other.starved;
+    blocked += other.blocked;
+    inputQueueDepthSum += other.inputQueueDepthSum;
+  }
+};
+
+int GetPercentage(Clock::duration part, Clock::duration total) {
+  return total.count() > 0 ? static_cast<int>(100.0 * part.count() / total.count() + 0.5) : 0;
+}
+
+// Read -> build -> compute -> serialize, with a bounded queue between each pair of stages. The reader takes items from
+// a free list holding as many items as fit in the window between the oldest line not yet written and the newest line
+// read, so results waiting to be written in order are bounded too.
+class BatchPipeline {
+public:
+  BatchPipeline(
+      sample::upe::Action& action,
+      sample::upe::BatchOperation operation,
+      const sample::upe::ExecutionStateOptions& defaults,
+      const sample::upe::BatchOptions& options,
+      sample::upe::OutputSink& output)
+      : mAction(action),
+        mOperation(operation),
+        mDefaults(defaults),
+        mOutput(output),
+        mBuildQueue(options.queueCapacity),
+        mComputeQueue(options.queueCapacity),
+        mSerializeQueue(options.queueCapacity),
+        mItems(mBuildQueue.GetCapacity() * 4),
+        mFreeItems(mItems.size()),
+        mPendingWrites(mItems.size(), nullptr),
+        mNextWrite(0),
+        mFailures(0),
+        mReadStatistics("read", 1),
+        mBuildStatistics("build", options.buildThreads),
+        mComputeStatistics("compute", options.threadCount),
+        mSerializeStatistics("serialize", options.serializeThreads) {
+    for (PipelineItem& item : mItems)
+      mFreeItems.TryPush(&item);
+    mBuildStatistics.inputQueueCapacity = mBuildQueue.GetCapacity();
+    mComputeStatistics.inputQueueCapacity = mComputeQueue.GetCapacity();
+    mSerializeStatistics.inputQueueCapacity = mSerializeQueue.GetCapacity();
+  }
+
+  size_t Run(sample::upe::BatchInput& input) {
+    Clock::time_point start = Clock::now();
+    std::atomic<size_t> remainingBuilders(mBuildStatistics.threadCount);
+    std::atomic<size_t> remainingComputers(mComputeStatistics.threadCount);
+    std::atomic<size_t> remainingSerializers(mSerializeStatistics.threadCount);
+    vector<std::thread> threads;
+    for (size_t i = 0; i < mBuildStatistics.threadCount; ++i) {
+      threads.emplace_back([this, &remainingBuilders] {
+        RunStage(mBuildQueue, &mComputeQueue, remainingBuilders, mBuildStatistics, [this](PipelineItem& item) {
+          Build(item); });
+      });
+    }
+    for (size_t i = 0; i < mComputeStatistics.threadCount; ++i) {
+      threads.emplace_back([this, &remainingComputers, i] {
+        sample::upe::Action::PinThreadToEngineReplica(i);
+        RunStage(mComputeQueue, &mSerializeQueue, remainingComputers, mComputeStatistics, [this](PipelineItem& item) {
+          Compute(item); });
+      });
+    }
+    for (size_t i = 0; i < mSerializeStatistics.threadCount; ++i) {
+      threads.emplace_back([this, &remainingSerializers] {
+        RunStage(mSerializeQueue, nullptr, remainingSerializers, mSerializeStatistics, [this](PipelineItem& item) {
+          Serialize(item); });
+      });
+    }
+
+    Read(input);
+    for (std::thread& thread : threads)
+      thread.join();
+    mOutput.Flush();
+    mElapsed = Clock::now() - start;
+    return mFailures;
+  }
+
+  void PrintStatistics(ostream& output) const {
+    output << "PIPELINE: " << mReadStatistics.items << " lines in " <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(mElapsed).count() << " ms\n";
+    const StageStatistics* stages[] = {
+        &mReadStatistics, &mBuildStatistics, &mComputeStatistics, &mSerializeStatistics };
+    const StageStatistics* bottleneck = nullptr;
+    int bottleneckBusy = -1;
+    for (const StageStatistics* stage : stages) {
+      // Shares of the stage's thread time
+      Clock::duration threadTime = mElapsed * static_cast<int>(stage->threadCount);
+      int busy = GetPercentage(stage->busy, threadTime);
+      output << "  " << stage->name << ": " << stage->threadCount <<
+          (stage->threadCount == 1 ? " thread, " : " threads, ") << busy << "% busy, " << GetPercentage(stage->starved, threadTime) << "% starved, " <<
+          GetPercentage(stage->blocked, threadTime) << "% blocked";
+      if (stage->inputQueueCapacity > 0 && stage->items > 0) {
+        output << ", input queue " <<
+            static_cast<int>(100.0 * stage->inputQueueDepthSum / stage->items / stage->inputQueueCapacity + 0.5) <<
+            "% full on average";
+      }
+      output << "\n";
+      if (busy > bottleneckBusy) {
+        bottleneck = stage;
+        bottleneckBusy = busy;
+      }
+    }
+    output << "  Bottleneck: " << bottleneck->name << endl;
+  }
+
+private:
+  BatchPipeline(const BatchPipeline&);
+  BatchPipeline& operator=(const BatchPipeline&);
+
+  // Runs on the calling thread. Blocked time covers waiting both for a free item and for room in the build queue.
+  void Read(sample::upe::BatchInput& input) {
+    size_t lineNumber = 0;
+    size_t sequence = 0;
+    PipelineItem* item = nullptr;
+    Clock::time_point now = Clock::now();
+    for (;;) {
+      if (nullptr == item) {
+        mFreeItems.Pop(item);
+        Clock::time_point acquired = Clock::now();
+        mReadStatistics.blocked += acquired - now;
+        now = acquired;
+      }
+      if (!input.ReadLine(item->buffer, item->line))
+        break;
+      ++lineNumber;
+      if (IsBlank(item->line))
+        continue;
+
+      item->sequence = sequence++;
+      item->lineNumber = lineNumber;
+      Clock::time_point read = Clock::now();
+      mReadStatistics.busy += read - now;
+      ++mReadStatistics.items;
+      mBuildQueue.Push(item);
+      item = nullptr;
+      now = Clock::now();
+      mReadStatistics.blocked += now - read;
+    }
+    mReadStatistics.busy += Clock::now() - now;
+    mBuildQueue.Close();
+  }
+
+  // Pops items from 'input' until it is closed and drained, processes them and pushes them to 'output' (or, for the
+  // last stage, writes them). The stage's last thread to finish closes 'output'.
+  template<typename Process>
+  void RunStage(
+      PipelineQueue& input,
+      PipelineQueue* output,
+      std::atomic<size_t>& remainingThreads,
+      StageStatistics& statistics,
+      Process process) {
+    StageStatistics threadStatistics(statistics.name, 1);
+    PipelineItem* item = nullptr;
+    for (;;) {
+      Clock::time_point waitStart = Clock::now();
+      size_t depth = input.GetApproximateSize();
+      if (!input.Pop(item)) {
+        threadStatistics.starved += Clock::now() - waitStart;
+        break;
+      }
+      Clock::time_point start = Clock::now();
+      threadStatistics.starved += start - waitStart;
+      threadStatistics.inputQueueDepthSum += depth;
+      ++threadStatistics.items;
+
+      process(*item);
+      Clock::time_point end = Clock::now();
+      threadStatistics.busy += end - start;
+
+      if (nullptr != output) {
+        output->Push(item);
+        threadStatistics.blocked += Clock::now() - end;
+      } else {
+        Write(item, threadStatistics);
+      }
+    }
+
+    {
+      lock_guard<mutex> lock(mStatisticsMutex);
+      statistics.Add(threadStatistics);
+    }
+    if (--remainingThreads == 0 && nullptr != output)
+      output->Close();
+  }
+
+  void Build(PipelineItem& item) {
+    item.error.clear();
+    item.state.reset();
+    try {
+      sample::upe::ExecutionStateView view;
+      sample::upe::ParseExecutionStateView(item.line, mDefaults, view);
+      item.state.reset(new sample::upe::ExecutionStateImpl(std::move(view)));
+    } catch (const exception& ex) {
+      item.error = ex.what();
+    }
+  }
+
+  void Compute(PipelineItem& item) {
+    item.label = nullptr;
+    item.actions.clear();
+    item.sharedResult.clear();
+    if (!item.error.empty())
+      return;
+    try {
+      if (mAction.IsSharingResults() && mOperation == sample::upe::BatchOperation::ShowLabel)
+        mAction.WriteSensitivityLabelJson(*item.state, item.sharedResult, &item.isStale);
+      else if (mAction.IsSharingResults())
+        mAction.WriteActionsJson(*item.state, item.sharedResult, &item.isStale);
+      else if (mOperation == sample::upe::BatchOperation::ShowLabel)
+        item.label = mAction.GetSensitivityLabel(*item.state, &item.isStale);
+      else
+        item.actions = mAction.GetActions(*item.state, &item.isStale);
+    } catch (const exception& ex) {
+      item.error = ex.what();
+    }
+    item.state.reset();
+  }
+
+  void Serialize(PipelineItem& item) {
+    item.result = "{\"line\":" + to_string(item.lineNumber);
+    if (!item.error.empty()) {
+      item.result += ",\"error\":";
+      sample::upe::AppendJsonString(item.error, item.result);
+    } else {
+      item.result += ",\"result\":";
+      if (mAction.IsSharingResults())
+        item.result += item.sharedResult;
+      else if (mOperation == sample::upe::BatchOperation::ShowLabel)
+        sample::upe::AppendContentLabelJson(item.label, item.result);
+      else
+        sample::upe::AppendActionsJson(item.actions, item.result);
+      if (item.isStale)
+        item.result += ",\"stale\":true";
+    }
+    item.result += '}';
+    item.label = nullptr;
+    item.sharedResult.clear();
+    item.actions.clear();
+  }
+
+  // Writes the item, and any later items it was holding up, once every earlier item is written. Waiting for another
+  // thread's write counts as blocked, writing as busy.
+  void Write(PipelineItem* item, StageStatistics& threadStatistics) {
+    Clock::time_point waitStart = Clock::now();
+    lock_guard<mutex> lock(mWriteMutex);
+    Clock::time_point start = Clock::now();
+    threadStatistics.blocked += start - waitStart;
+
+    mPendingWrites[item->sequence % mPendingWrites.size()] = item;
+    size_t written = 0;
+    for (;;) {
+      PipelineItem*& next = mPendingWrites[mNextWrite % mPendingWrites.size()];
+      if (nullptr == next)
+        break;
+      mOutput.WriteRecord(next->result.data(), next->result.size());
+      if (!next->error.empty())
+        ++mFailures;
+      mFreeItems.TryPush(next); // never full, it has room for every item
+      next = nullptr;
+      ++mNextWrite;
+      ++written;
+    }
+    if (written > 0)
+      mAction.GetStartupTimeline().Record(sample::upe::StartupTimeline::Stage::FirstResult);
+    threadStatistics.busy += Clock::now() - start;
+  }
+
+  sample::upe::Action& mAction;
+  const sample::upe::BatchOperation mOperation;
+  const sample::upe::ExecutionStateOptions& mDefaults;
+  sample::upe::OutputSink& mOutput;
+  PipelineQueue mBuildQueue;
+  PipelineQueue mComputeQueue;
+  PipelineQueue mSerializeQueue;
+  vector<PipelineItem> mItems;
+  PipelineQueue mFreeItems;
+  mutex mWriteMutex;
+  vector<PipelineItem*> mPendingWrites; // indexed by sequence, modulo the number of items
+  size_t mNextWrite;
+  size_t mFailures;
+  mutex mStatisticsMutex;
+  StageStatistics mReadStatistics;
+  StageStatistics mBuildStatistics;
+  StageStatistics mComputeStatistics;
+  StageStatistics mSerializeStatistics;
+  Clock::duration mElapsed = Clock::duration::zero();
+};
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+size_t RunBatch(
+    Action& action,
+    BatchOperation operation,
+    const ExecutionStateOptions& defaults,
+    const BatchOptions& options,
+    BatchInput& input,
+    OutputSink& output) {
+  size_t failures = 0;
+  if (options.isPipelined) {
+    BatchPipeline pipeline(action, operation, defaults, options, output);
+    failures = pipeline.Run(input);
+    if (nullptr != options.statistics)
+      pipeline.PrintStatistics(*options.statistics);
+  } else if (options.threadCount <= 1) {
+    failures = RunSerialBatch(action, operation, defaults, input, output);
+  } else {
+    failures = RunParallelBatch(action, operation, defaults, options.threadCount, input, output);
+  }
+
+  if (nullptr != options.statistics) {
+    if (input.IsMapped())
+      *options.statistics << "INPUT: " << input.GetMappedBytes() / 1024 << " KiB mapped" << endl;
+    OutputSink::Statistics sink = output.GetStatistics();
+    *options.statistics << "OUTPUT: " << sink.records << " records, " << sink.bytes / 1024 << " KiB in " <<
+        sink.writes << (sink.writes == 1 ? " write" : " writes") << endl;
+  }
+  return failures;
+}
+
+} // namespace sample
+} // namespace upe
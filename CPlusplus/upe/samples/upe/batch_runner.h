@@ -0,0 +1,92 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_BATCH_RUNNER_H_
+#define SAMPLES_UPE_BATCH_RUNNER_H_
+
+#include <cstddef>
+#include <ostream>
+
+#include "action.h"
+#include "batch_input.h"
+#include "execution_state_impl.h"
+#include "output_sink.h"
+
+namespace sample {
+namespace upe {
+
+enum class BatchOperation {
+  ShowLabel,
+  ComputeActions,
+};
+
+struct BatchOptions {
+  // Worker threads evaluating lines against the shared engine (the compute stage's threads when pipelined)
+  size_t threadCount = 1;
+
+  // Run reading, parsing, evaluation and serialization as separate stages connected by bounded queues instead
+  bool isPipelined = false;
+  size_t buildThreads = 1;      // threads parsing lines into execution states
+  size_t serializeThreads = 1;  // threads serializing results, which are still written in input order
+  size_t queueCapacity = 1024;  // items each queue between stages holds before its producers block
+
+  // When set, receives statistics of the output written and, when pipelined, of each stage
+  std::ostream* statistics = nullptr;
+};
+
+// Evaluates one JSON execution state per input line (see ParseExecutionStateJson) against the single engine held by
+// 'action' and writes one JSON result record per line to 'output' (newline-delimited or length-prefixed, depending on
+// its format), flushing it once at the end:
+//   {"line":1,"result":<content label, null, or array of actions>}
+//   {"line":2,"error":"<message>"}
+//   {"line":3,"result":<...>,"stale":true}
+// A line past its deadline is answered with the last result kept for its identity and execution state, marked stale,
+// or else fails. Blank lines are skipped. Fields missing from a line take their value from 'defaults'. Returns the number of lines
+// that failed.
+//
+// Lines are parsed in place (see ParseExecutionStateView): when 'input' is a mapped file, the metadata of the states
+// being evaluated references the mapping and no line is copied.
+//
+// With 'threadCount' > 1, lines are evaluated by that many worker threads which share the one mip::PolicyEngine, each
+// worker leasing its own mip::PolicyHandler from the Action. Results are still written in input order.
+//
+// Pipelined, one thread reads lines, 'buildThreads' parse them into ExecutionStateImpls, 'threadCount' evaluate them
+// and 'serializeThreads' turn results into JSON and write them in order. Each stage blocks on its full output queue,
+// so the slowest stage paces the others; the statistics show each stage's busy, starved (input queue empty) and
+// blocked (output queue full) share of its threads' time.
+size_t RunBatch(
+    Action& action,
+    BatchOperation operation,
+    const ExecutionStateOptions& defaults,
+    const BatchOptions& options,
+    BatchInput& input,
+    OutputSink& output);
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_BATCH_RUNNER_H_
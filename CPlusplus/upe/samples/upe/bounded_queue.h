@@ -0,0 +1,218 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_BOUNDED_QUEUE_H_
+#define SAMPLES_UPE_BOUNDED_QUEUE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace sample {
+namespace upe {
+
+// Fixed-capacity multi-producer/multi-consumer queue. TryPush/TryPop are lock-free (a ring of cells, each carrying a
+// sequence number that tells producers and consumers whose turn it is). Push/Pop block while the queue is full/empty,
+// which is how a slow consumer applies backpressure to its producers: they spin briefly, then sleep on a condition
+// variable that is only signalled while someone is actually waiting. T should be cheap to copy (e.g. a pointer).
+template<typename T>
+class BoundedQueue {
+public:
+  // 'capacity' is rounded up to a power of two, and to at least 2: with one cell, a cell's sequence after a pop would
+  // also mean "pushed" to the next lap
+  explicit BoundedQueue(size_t capacity)
+      : mCapacity(RoundUpToPowerOfTwo(capacity)),
+        mCells(new Cell[mCapacity]),
+        mEnqueuePosition(0),
+        mDequeuePosition(0),
+        mIsClosed(false),
+        mWaiters(0) {
+    for (size_t i = 0; i < mCapacity; ++i)
+      mCells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  size_t GetCapacity() const { return mCapacity; }
+
+  // Number of queued items, exact only while no push/pop is in progress
+  size_t GetApproximateSize() const {
+    size_t enqueuePosition = mEnqueuePosition.load(std::memory_order_relaxed);
+    size_t dequeuePosition = mDequeuePosition.load(std::memory_order_relaxed);
+    return enqueuePosition > dequeuePosition ? enqueuePosition - dequeuePosition : 0;
+  }
+
+  // Returns false if the queue is full
+  bool TryPush(const T& value) {
+    if (!TryPushWithoutNotify(value))
+      return false;
+    NotifyWaiters();
+    return true;
+  }
+
+  // Returns false if the queue is empty
+  bool TryPop(T& value) {
+    if (!TryPopWithoutNotify(value))
+      return false;
+    NotifyWaiters();
+    return true;
+  }
+
+  // Blocks while the queue is full. Returns false, without pushing, if the queue is closed meanwhile.
+  bool Push(const T& value) {
+    return Wait([this, &value] { return TryPushWithoutNotify(value); });
+  }
+
+  // Blocks while the queue is empty. Returns false once the queue is closed and drained.
+  bool Pop(T& value) {
+    return Wait([this, &value] { return TryPopWithoutNotify(value); });
+  }
+
+  // Wakes every blocked Push/Pop. Items already queued can still be popped.
+  void Close() {
+    mIsClosed.store(true);
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStateChanged.notify_all();
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Spins (yielding) this many times before a blocked Push/Pop sleeps
+  static const int kSpinCount = 16;
+
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 2;
+    while (result < value)
+      result <<= 1;
+    return result;
+  }
+
+  BoundedQueue(const BoundedQueue&);
+  BoundedQueue& operator=(const BoundedQueue&);
+
+  bool TryPushWithoutNotify(const T& value) {
+    size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = mCells[position & (mCapacity - 1)];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == position) {
+        if (mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < position) {
+        return false; // full: the cell still holds the value pushed one lap ago
+      } else {
+        position = mEnqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPopWithoutNotify(T& value) {
+    size_t position = mDequeuePosition.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = mCells[position & (mCapacity - 1)];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == position + 1) {
+        if (mDequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          value = cell.value;
+          cell.sequence.store(position + mCapacity, std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < position + 1) {
+        return false; // empty: the cell's value has not been pushed yet
+      } else {
+        position = mDequeuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Retries 'attempt' until it succeeds or the queue is closed, returning whether it succeeded
+  template<typename Attempt>
+  bool Wait(Attempt attempt) {
+    bool isSuccess = false;
+    bool isDone = false;
+    for (int spin = 0; spin < kSpinCount && !(isDone = IsDone(attempt, isSuccess)); ++spin)
+      std::this_thread::yield();
+
+    if (!isDone) {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWaiters.fetch_add(1);
+      // Pairs with the fence in NotifyWaiters: either this thread's next attempt sees the other thread's push/pop, or
+      // that thread sees this waiter and signals under the mutex held here
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!IsDone(attempt, isSuccess))
+        mStateChanged.wait(lock);
+      mWaiters.fetch_sub(1);
+    }
+
+    if (isSuccess)
+      NotifyWaiters();
+    return isSuccess;
+  }
+
+  // Returns true once 'attempt' has succeeded or the queue is closed, setting 'isSuccess' accordingly
+  template<typename Attempt>
+  bool IsDone(Attempt& attempt, bool& isSuccess) {
+    isSuccess = attempt();
+    if (isSuccess)
+      return true;
+    if (!mIsClosed.load())
+      return false;
+    // The closing thread's last push precedes Close(), so one more attempt cannot miss it
+    isSuccess = attempt();
+    return true;
+  }
+
+  void NotifyWaiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mWaiters.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStateChanged.notify_all();
+    }
+  }
+
+  const size_t mCapacity;
+  std::unique_ptr<Cell[]> mCells;
+  std::atomic<size_t> mEnqueuePosition;
+  std::atomic<size_t> mDequeuePosition;
+  std::atomic<bool> mIsClosed;
+  std::atomic<int> mWaiters;
+  std::mutex mMutex;
+  std::condition_variable mStateChanged;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_BOUNDED_QUEUE_H_
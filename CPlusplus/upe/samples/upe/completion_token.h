@@ -0,0 +1,138 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_COMPLETION_TOKEN_H_
+#define SAMPLES_UPE_COMPLETION_TOKEN_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace sample {
+namespace upe {
+
+// Result type of async operations that complete without a value (e.g. PolicyProfile::UnloadEngineAsync)
+struct NoResult {};
+
+template <typename T>
+class CompletionTokenPool;
+
+// Context passed to a PolicyProfile async operation. PolicyProfileObserverImpl completes it with the operation's result
+// or error, which returns the token to its pool and then runs the continuation on the SDK thread reporting the
+// completion. No thread waits for the operation unless the continuation's owner chooses to.
+template <typename T>
+class CompletionToken final {
+public:
+  // Called with a null 'error' and the operation's result, or with the error and a default-constructed result
+  typedef std::function<void(const std::exception_ptr& error, const T& result)> Continuation;
+
+  void Complete(const T& result) { Finish(nullptr, result); }
+  void Fail(const std::exception_ptr& error) { Finish(error, T()); }
+
+private:
+  friend class CompletionTokenPool<T>;
+
+  CompletionToken(CompletionTokenPool<T>* pool, size_t index) : mPool(pool), mIndex(index) {}
+  CompletionToken(const CompletionToken&);
+  CompletionToken& operator=(const CompletionToken&);
+
+  void Finish(const std::exception_ptr& error, const T& result) {
+    Continuation continuation;
+    continuation.swap(mContinuation);
+    mPool->Release(mIndex);
+    continuation(error, result);
+  }
+
+  CompletionTokenPool<T>* mPool;
+  size_t mIndex;
+  Continuation mContinuation;
+};
+
+// Recycles completion tokens so that starting an operation doesn't allocate a context (or a promise and its shared
+// state) per call; the pool only allocates when more operations are pending than ever before. Destroying the pool
+// waits until every token handed out has completed.
+template <typename T>
+class CompletionTokenPool {
+public:
+  CompletionTokenPool() : mPendingCount(0) {}
+
+  ~CompletionTokenPool() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mAllReleased.wait(lock, [this] { return mPendingCount == 0; });
+  }
+
+  // Returns an idle token armed with 'continuation', to be passed as the operation's context
+  std::shared_ptr<CompletionToken<T>> Acquire(typename CompletionToken<T>::Continuation continuation) {
+    std::shared_ptr<CompletionToken<T>> token;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (mIdleIndices.empty()) {
+        mTokens.push_back(std::shared_ptr<CompletionToken<T>>(new CompletionToken<T>(this, mTokens.size())));
+        mIdleIndices.push_back(mTokens.size() - 1);
+      }
+      token = mTokens[mIdleIndices.back()];
+      mIdleIndices.pop_back();
+      ++mPendingCount;
+    }
+    token->mContinuation = std::move(continuation);
+    return token;
+  }
+
+  size_t GetCapacity() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTokens.size();
+  }
+
+private:
+  friend class CompletionToken<T>;
+
+  CompletionTokenPool(const CompletionTokenPool&);
+  CompletionTokenPool& operator=(const CompletionTokenPool&);
+
+  void Release(size_t index) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIdleIndices.push_back(index);
+    if (--mPendingCount == 0)
+      mAllReleased.notify_all();
+  }
+
+  mutable std::mutex mMutex;
+  std::condition_variable mAllReleased;
+  std::vector<std::shared_ptr<CompletionToken<T>>> mTokens;
+  std::vector<size_t> mIdleIndices;
+  size_t mPendingCount;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_COMPLETION_TOKEN_H_
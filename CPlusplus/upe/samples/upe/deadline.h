@@ -0,0 +1,60 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_DEADLINE_H_
+#define SAMPLES_UPE_DEADLINE_H_
+
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+
+namespace sample {
+namespace upe {
+
+// Point in time by which a request must be answered. Deadline::max() means the request waits as long as it takes.
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// Thrown when a request stops waiting because its deadline passed. The work it was waiting for is not stopped.
+class DeadlineExceededError : public std::runtime_error {
+public:
+  explicit DeadlineExceededError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Returns the future's value, or throws DeadlineExceededError if it is not ready by 'deadline'. 'what' names the
+// result being waited for in the error message.
+template<typename T>
+T GetBeforeDeadline(const std::shared_future<T>& future, Deadline deadline, const char* what) {
+  if (deadline != Deadline::max() && future.wait_until(deadline) != std::future_status::ready)
+    throw DeadlineExceededError(std::string("Deadline exceeded waiting for ") + what);
+  return future.get();
+}
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_DEADLINE_H_
@@ -0,0 +1,354 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "engine_cache.h"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using std::exception;
+using std::lock_guard;
+using std::move;
+using std::mutex;
+using std::promise;
+using std::shared_future;
+using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace {
+
+bool IsReady(const shared_future<shared_ptr<sample::upe::CachedEngine>>& engine) {
+  return engine.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void AddStatistics(const sample::upe::PolicyHandlerPool::Statistics& from,
+    sample::upe::PolicyHandlerPool::Statistics& to) {
+  to.hits += from.hits;
+  to.misses += from.misses;
+  to.invalidations += from.invalidations;
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+EngineCache::EngineCache(size_t maxSize, LoadEngineFunction loadEngine, UnloadEngineFunction unloadEngine)
+    : mMaxSize(maxSize > 0 ? maxSize : 1),
+      mLoadEngine(move(loadEngine)),
+      mUnloadEngine(move(unloadEngine)),
+      mBackgroundLoads(0) {}
+
+string EngineCache::GetKey(const mip::Identity& identity) {
+  // A newline cannot appear in an email address, so it safely separates the two parts
+  return identity.GetEmail() + '\n' + identity.GetDelegatedEmail();
+}
+
+string EngineCache::GetEngineIdKey(const string& engineId) {
+  // Identity keys hold exactly one newline, so this can't collide with one
+  return "\n\n" + engineId;
+}
+
+void EngineCache::SetEngineId(const mip::Identity& identity, const string& engineId) {
+  lock_guard<mutex> lock(mMutex);
+  string key = GetKey(identity);
+  mEngineIdsByKey[key] = engineId;
+  mKeysByEngineId[engineId] = key;
+
+  // An engine added by id (see Add) now belongs to this identity
+  auto itAdded = mEntriesByKey.find(GetEngineIdKey(engineId));
+  if (itAdded != mEntriesByKey.end() && mEntriesByKey.find(key) == mEntriesByKey.end()) {
+    auto itEntry = itAdded->second;
+    mEntriesByKey.erase(itAdded);
+    itEntry->key = key;
+    mEntriesByKey[key] = itEntry;
+  }
+}
+
+shared_ptr<CachedEngine> EngineCache::Get(const mip::Identity& identity) {
+  return Get(identity, Deadline::max());
+}
+
+shared_ptr<CachedEngine> EngineCache::Get(const mip::Identity& identity, Deadline deadline) {
+  string key = GetKey(identity);
+  string engineId;
+  auto loadPromise = std::make_shared<promise<shared_ptr<CachedEngine>>>();
+  shared_future<shared_ptr<CachedEngine>> engine;
+  shared_ptr<void> lease;
+  bool isLoader = false;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mEntriesByKey.find(key);
+    if (it != mEntriesByKey.end()) {
+      ++mStatistics.hits;
+      mEntries.splice(mEntries.begin(), mEntries, it->second);
+      // Take the reference under the lock, otherwise eviction could unload the engine before this caller holds it
+      if (IsReady(it->second->engine))
+        return it->second->engine.get();
+      engine = it->second->engine;
+      lease = it->second->lease;
+    } else {
+      ++mStatistics.misses;
+      auto itEngineId = mEngineIdsByKey.find(key);
+      if (itEngineId != mEngineIdsByKey.end()) {
+        engineId = itEngineId->second;
+        ++mStatistics.reusedEngineIds;
+      }
+
+      // Concurrent requests for this identity wait on this entry instead of adding their own engine
+      Entry entry;
+      entry.key = key;
+      entry.engine = loadPromise->get_future().share();
+      entry.lease = std::make_shared<char>();
+      mEntries.push_front(entry);
+      mEntriesByKey[key] = mEntries.begin();
+      engine = entry.engine;
+      lease = entry.lease;
+      isLoader = true;
+      if (deadline != Deadline::max())
+        ++mBackgroundLoads;
+    }
+  }
+
+  if (isLoader && deadline == Deadline::max())
+    return Load(identity, key, engineId, *loadPromise);
+
+  if (isLoader) {
+    // Load on a background thread so this request can give up at its deadline without abandoning the load
+    std::thread([this, identity, key, engineId, loadPromise]() {
+      try {
+        Load(identity, key, engineId, *loadPromise);
+      } catch (...) {
+        // Already delivered through the promise
+      }
+      lock_guard<mutex> lock(mMutex);
+      if (--mBackgroundLoads == 0)
+        mBackgroundLoadsDone.notify_all();
+    }).detach();
+  }
+  return GetBeforeDeadline(engine, deadline, "the policy engine to load");
+}
+
+shared_ptr<CachedEngine> EngineCache::Load(
+    const mip::Identity& identity,
+    const string& key,
+    const string& engineId,
+    promise<shared_ptr<CachedEngine>>& loadPromise) {
+  shared_ptr<CachedEngine> loadedEngine;
+  try {
+    WaitForUnload(engineId);
+    loadedEngine = mLoadEngine(identity, engineId);
+    {
+      lock_guard<mutex> lock(mMutex);
+      const string& loadedEngineId = loadedEngine->engine->GetSettings().GetEngineId();
+      mEngineIdsByKey[key] = loadedEngineId;
+      mKeysByEngineId[loadedEngineId] = key;
+    }
+    loadPromise.set_value(loadedEngine);
+  } catch (...) {
+    {
+      lock_guard<mutex> lock(mMutex);
+      auto it = mEntriesByKey.find(key);
+      if (it != mEntriesByKey.end()) {
+        mEntries.erase(it->second);
+        mEntriesByKey.erase(it);
+      }
+    }
+    loadPromise.set_exception(std::current_exception());
+    throw;
+  }
+
+  // The new engine cannot be evicted here since 'loadedEngine' still holds it
+  EvictIdleEngines();
+  return loadedEngine;
+}
+
+bool EngineCache::Add(const shared_ptr<CachedEngine>& engine) {
+  const mip::Identity& identity = engine->engine->GetSettings().GetIdentity();
+  const string& engineId = engine->engine->GetSettings().GetEngineId();
+  {
+    lock_guard<mutex> lock(mMutex);
+    // Prefer the identity the engine id was mapped to, then the identity in the engine's settings
+    string key;
+    auto itKey = mKeysByEngineId.find(engineId);
+    if (itKey != mKeysByEngineId.end())
+      key = itKey->second;
+    else
+      key = identity.GetEmail().empty() ? GetEngineIdKey(engineId) : GetKey(identity);
+    if (mEntriesByKey.find(key) != mEntriesByKey.end())
+      return false;
+
+    promise<shared_ptr<CachedEngine>> addPromise;
+    addPromise.set_value(engine);
+    Entry entry;
+    entry.key = key;
+    entry.engine = addPromise.get_future().share();
+    entry.lease = std::make_shared<char>();
+    mEntries.push_front(entry);
+    mEntriesByKey[key] = mEntries.begin();
+    mKeysByEngineId[engineId] = key;
+    if (key != GetEngineIdKey(engineId))
+      mEngineIdsByKey[key] = engineId;
+  }
+
+  EvictIdleEngines();
+  return true;
+}
+
+shared_ptr<CachedEngine> EngineCache::Reload(const string& engineId) {
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto itKey = mKeysByEngineId.find(engineId);
+    if (itKey == mKeysByEngineId.end() || mEntriesByKey.find(itKey->second) == mEntriesByKey.end())
+      return nullptr;
+  }
+
+  WaitForUnload(engineId);
+  shared_ptr<CachedEngine> reloadedEngine = mLoadEngine(mip::Identity(), engineId);
+  promise<shared_ptr<CachedEngine>> reloadPromise;
+  reloadPromise.set_value(reloadedEngine);
+
+  unique_lock<mutex> lock(mMutex);
+  auto itKey = mKeysByEngineId.find(engineId);
+  auto it = itKey != mKeysByEngineId.end() ? mEntriesByKey.find(itKey->second) : mEntriesByKey.end();
+  if (it == mEntriesByKey.end()) {
+    // Evicted while reloading. Nothing caches the reloaded engine, so unload it rather than leave the SDK holding it;
+    // the next Get loads it by id again.
+    mUnloadingEngineIds.insert(engineId);
+    lock.unlock();
+    UnloadEngines(vector<string>(1, engineId));
+    return nullptr;
+  }
+
+  if (IsReady(it->second->engine))
+    Retire(it->second->engine.get());
+  it->second->engine = reloadPromise.get_future().share();
+  return reloadedEngine;
+}
+
+void EngineCache::Clear() {
+  unique_lock<mutex> lock(mMutex);
+  mBackgroundLoadsDone.wait(lock, [this]() { return mBackgroundLoads == 0; });
+  for (const Entry& entry : mEntries) {
+    if (IsReady(entry.engine))
+      Retire(entry.engine.get());
+  }
+  mEntriesByKey.clear();
+  mEntries.clear();
+}
+
+void EngineCache::LockForFork() {
+  unique_lock<mutex> lock(mMutex);
+  mBackgroundLoadsDone.wait(lock, [this]() { return mBackgroundLoads == 0; });
+  mUnloadsDone.wait(lock, [this]() { return mUnloadingEngineIds.empty(); });
+  lock.release();
+}
+
+void EngineCache::UnlockAfterFork() {
+  mMutex.unlock();
+}
+
+EngineCache::Statistics EngineCache::GetStatistics() const {
+  lock_guard<mutex> lock(mMutex);
+  return mStatistics;
+}
+
+PolicyHandlerPool::Statistics EngineCache::GetHandlerPoolStatistics() const {
+  lock_guard<mutex> lock(mMutex);
+  PolicyHandlerPool::Statistics statistics = mRetiredHandlerPoolStatistics;
+  for (const Entry& entry : mEntries) {
+    if (IsReady(entry.engine))
+      AddStatistics(entry.engine.get()->handlers.GetStatistics(), statistics);
+  }
+  return statistics;
+}
+
+// Must be called with mMutex held
+void EngineCache::Retire(const shared_ptr<CachedEngine>& engine) {
+  if (nullptr != engine)
+    AddStatistics(engine->handlers.GetStatistics(), mRetiredHandlerPoolStatistics);
+}
+
+void EngineCache::EvictIdleEngines() {
+  vector<string> evictedEngineIds;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto it = mEntries.end();
+    while (mEntries.size() > mMaxSize && it != mEntries.begin()) {
+      --it;
+      // Skip engines still loading, engines some caller still holds (the future holds the only other reference) and
+      // engines a caller is still waiting for
+      if (!IsReady(it->engine) || it->engine.get().use_count() > 1 || it->lease.use_count() > 1)
+        continue;
+
+      Retire(it->engine.get());
+      evictedEngineIds.push_back(it->engine.get()->engine->GetSettings().GetEngineId());
+      mUnloadingEngineIds.insert(evictedEngineIds.back());
+      mEntriesByKey.erase(it->key);
+      it = mEntries.erase(it);
+      ++mStatistics.evictions;
+    }
+  }
+
+  // Unloading waits on the profile, so it happens outside the lock
+  UnloadEngines(evictedEngineIds);
+}
+
+void EngineCache::WaitForUnload(const string& engineId) {
+  if (engineId.empty())
+    return;
+  unique_lock<mutex> lock(mMutex);
+  mUnloadsDone.wait(lock, [this, &engineId]() { return mUnloadingEngineIds.count(engineId) == 0; });
+}
+
+// Unloads engines already marked in mUnloadingEngineIds, then clears their marks
+void EngineCache::UnloadEngines(const vector<string>& engineIds) {
+  for (const string& engineId : engineIds) {
+    try {
+      mUnloadEngine(engineId);
+    } catch (const exception& ex) {
+      cerr << "WARNING: Failed to unload engine '" << engineId << "': " << ex.what() << endl;
+    }
+    {
+      lock_guard<mutex> lock(mMutex);
+      mUnloadingEngineIds.erase(engineId);
+    }
+    mUnloadsDone.notify_all();
+  }
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,170 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_ENGINE_CACHE_H_
+#define SAMPLES_UPE_ENGINE_CACHE_H_
+
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mip/common_types.h"
+#include "mip/upe/policy_engine.h"
+
+#include "action_plan_table.h"
+#include "deadline.h"
+#include "policy_handler_pool.h"
+
+namespace sample {
+namespace upe {
+
+// An engine together with the pool of handlers created from it and, optionally, its precomputed action plans
+struct CachedEngine {
+  explicit CachedEngine(
+      const std::shared_ptr<mip::PolicyEngine>& policyEngine,
+      const std::shared_ptr<const ActionPlanTable>& policyActionPlans = nullptr)
+      : engine(policyEngine),
+        actionPlans(policyActionPlans) {
+    handlers.Reset(policyEngine);
+  }
+
+  const std::shared_ptr<mip::PolicyEngine> engine;
+  const std::shared_ptr<const ActionPlanTable> actionPlans;
+  PolicyHandlerPool handlers;
+  // Identifies the policy content and the engine settings shaping results, computed on first use (see
+  // Action::GetSharedResultKey)
+  std::once_flag policyVersionOnce;
+  std::string policyVersion;
+};
+
+// Keeps loaded engines for up to 'maxSize' identities (email and delegated email). Concurrent requests for the same
+// identity share a single load. When the cache is over capacity the least recently used engines that no caller is
+// holding are unloaded. The engine id assigned to an identity is remembered after eviction, so the identity's engine
+// is later reloaded by id rather than added again as a duplicate.
+class EngineCache {
+public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t reusedEngineIds = 0; // misses satisfied by loading an existing engine id
+  };
+
+  // Loads the engine with 'engineId', or creates a new engine for 'identity' if 'engineId' is empty
+  typedef std::function<std::shared_ptr<CachedEngine>(const mip::Identity& identity, const std::string& engineId)>
+      LoadEngineFunction;
+  typedef std::function<void(const std::string& engineId)> UnloadEngineFunction;
+
+  EngineCache(size_t maxSize, LoadEngineFunction loadEngine, UnloadEngineFunction unloadEngine);
+
+  // Records that 'identity' already owns the engine 'engineId' (e.g. one in the storage cache)
+  void SetEngineId(const mip::Identity& identity, const std::string& engineId);
+
+  // Returns the identity's engine, loading it (and evicting idle engines) if it is not cached
+  std::shared_ptr<CachedEngine> Get(const mip::Identity& identity);
+
+  // Same, but throws DeadlineExceededError if the engine is not loaded by 'deadline'. A load started here then runs on a
+  // background thread, so an abandoned load still completes and serves later requests.
+  std::shared_ptr<CachedEngine> Get(const mip::Identity& identity, Deadline deadline);
+
+  // Adds an engine loaded ahead of any request for it (e.g. at startup from the storage cache). An engine whose settings
+  // name an identity is served to that identity; otherwise it is served to the identity later mapped to its id with
+  // SetEngineId. Returns false if an engine for that identity or id is already cached.
+  bool Add(const std::shared_ptr<CachedEngine>& engine);
+
+  // Re-adds a cached engine after a policy change. Returns nullptr if the engine is not cached; it will be loaded by id
+  // the next time its identity is requested.
+  std::shared_ptr<CachedEngine> Reload(const std::string& engineId);
+
+  // Waits for background loads, then drops every cached engine without unloading it, e.g. before the profile itself is
+  // released
+  void Clear();
+
+  Statistics GetStatistics() const;
+
+  // Handler pool counters summed across every engine the cache has held
+  PolicyHandlerPool::Statistics GetHandlerPoolStatistics() const;
+
+  // LockForFork waits until no background load or eviction unload is in flight and returns with the cache locked, so a
+  // process forked before UnlockAfterFork copies it idle. Nothing must load an engine through the cache meanwhile.
+  void LockForFork();
+  void UnlockAfterFork();
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_future<std::shared_ptr<CachedEngine>> engine;
+    std::shared_ptr<void> lease; // copied by callers still waiting on 'engine', so eviction can skip it
+  };
+
+  EngineCache(const EngineCache&);
+  EngineCache& operator=(const EngineCache&);
+
+  static std::string GetKey(const mip::Identity& identity);
+  static std::string GetEngineIdKey(const std::string& engineId);
+  std::shared_ptr<CachedEngine> Load(
+      const mip::Identity& identity,
+      const std::string& key,
+      const std::string& engineId,
+      std::promise<std::shared_ptr<CachedEngine>>& loadPromise);
+  void Retire(const std::shared_ptr<CachedEngine>& engine);
+  void EvictIdleEngines();
+  void WaitForUnload(const std::string& engineId);
+  void UnloadEngines(const std::vector<std::string>& engineIds);
+
+  size_t mMaxSize;
+  LoadEngineFunction mLoadEngine;
+  UnloadEngineFunction mUnloadEngine;
+
+  mutable std::mutex mMutex;
+  std::list<Entry> mEntries; // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> mEntriesByKey;
+  std::unordered_map<std::string, std::string> mEngineIdsByKey;
+  std::unordered_map<std::string, std::string> mKeysByEngineId;
+  Statistics mStatistics;
+  PolicyHandlerPool::Statistics mRetiredHandlerPoolStatistics;
+  size_t mBackgroundLoads;
+  std::condition_variable mBackgroundLoadsDone;
+  // Evicted engines whose unload is in flight. Loading one of these ids waits for the unload, which would otherwise
+  // unload the freshly loaded engine too.
+  std::unordered_set<std::string> mUnloadingEngineIds;
+  std::condition_variable mUnloadsDone;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_ENGINE_CACHE_H_
@@ -27,13 +27,64 @@
 
 #include "execution_state_impl.h"
 
+#include <algorithm>
+#include <cstdint>
+
 using std::pair;
 using std::string;
-using std::unordered_map;
 using std::vector;
 
+namespace {
+
+// Length-prefixed so that no choice of field values can make two different states encode the same
+void AppendFingerprintField(sample::upe::StringView value, string& fingerprint) {
+  fingerprint += std::to_string(value.GetSize());
+  fingerprint += ':';
+  fingerprint.append(value.GetData(), value.GetSize());
+}
+
+void AppendFingerprintField(int64_t value, string& fingerprint) {
+  fingerprint += std::to_string(value);
+  fingerprint += ';';
+}
+
+// Orders metadata entries by name, and finds them by name
+struct NameLess {
+  typedef pair<sample::upe::StringView, sample::upe::StringView> Entry;
+
+  bool operator()(const Entry& left, const Entry& right) const { return left.first < right.first; }
+  bool operator()(const Entry& entry, sample::upe::StringView name) const { return entry.first < name; }
+};
+
+} // namespace
+
 namespace sample {
 namespace upe {
+
+ExecutionStateImpl::ExecutionStateImpl(ExecutionStateOptions options) : mOptions(std::move(options)) {
+  mMetadata.reserve(mOptions.metadata.size());
+  for (const auto& prop : mOptions.metadata)
+    mMetadata.emplace_back(prop.first, prop.second);
+  std::sort(mMetadata.begin(), mMetadata.end(), NameLess());
+}
+
+ExecutionStateImpl::ExecutionStateImpl(ExecutionStateView view)
+    : mOptions(std::move(view.options)),
+      mUnescaped(std::move(view.unescaped)), // moving keeps the strings in place, so views of them stay valid
+      mMetadata(std::move(view.metadata)) {
+  mOptions.metadata.clear();
+
+  // Sorted by name, keeping the last entry of each name
+  std::stable_sort(mMetadata.begin(), mMetadata.end(), NameLess());
+  size_t count = 0;
+  for (size_t i = 0; i < mMetadata.size(); ++i) {
+    if (i + 1 < mMetadata.size() && mMetadata[i + 1].first == mMetadata[i].first)
+      continue;
+    mMetadata[count++] = mMetadata[i];
+  }
+  mMetadata.resize(count);
+}
+
 vector<pair<string, string>> ExecutionStateImpl::GetNewLabelExtendedProperties() const {
   return vector<pair<string, string>>();
 }
@@ -41,24 +92,30 @@ vector<pair<string, string>> ExecutionStateImpl::GetNewLabelExtendedProperties()
 vector<pair<string, string>> ExecutionStateImpl::GetContentMetadata(
     const vector<string>& names,
     const vector<string>& namePrefixes) const {
-  unordered_map<string, string> filteredMetadata;
+  if (mMetadataQueryObserver)
+    mMetadataQueryObserver(names, namePrefixes);
 
+  // Entries matching a prefix are contiguous in the sorted metadata, and an entry may match several queries
+  vector<size_t> matches;
   for (const string& namePrefix : namePrefixes) {
-    for (const auto& prop : mOptions.metadata) {
-      if (prop.first.compare(0, namePrefix.length(), namePrefix) == 0)
-        filteredMetadata[prop.first] = prop.second;
-    }
+    auto it = std::lower_bound(mMetadata.begin(), mMetadata.end(), StringView(namePrefix), NameLess());
+    for (; it != mMetadata.end() && it->first.StartsWith(namePrefix); ++it)
+      matches.push_back(static_cast<size_t>(it - mMetadata.begin()));
   }
 
   for (const string& name : names) {
-    auto itName = mOptions.metadata.find(name);
-    if (itName != mOptions.metadata.end())
-      filteredMetadata[name] = itName->second;
+    auto it = std::lower_bound(mMetadata.begin(), mMetadata.end(), StringView(name), NameLess());
+    if (it != mMetadata.end() && it->first == name)
+      matches.push_back(static_cast<size_t>(it - mMetadata.begin()));
   }
 
+  std::sort(matches.begin(), matches.end());
+  matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
   vector<pair<string, string>> result;
-  for (const auto& prop : filteredMetadata)
-    result.emplace_back(prop.first, prop.second);
+  result.reserve(matches.size());
+  for (size_t match : matches)
+    result.emplace_back(mMetadata[match].first.ToString(), mMetadata[match].second.ToString());
 
   return result;
 }
@@ -78,5 +135,31 @@ mip::ActionType ExecutionStateImpl::GetSupportedActions() const {
       mip::ActionType::PROTECT_DO_NOT_FORWARD;
 }
 
+string ExecutionStateImpl::GetFingerprint() const {
+  size_t metadataLength = 0;
+  for (const auto& prop : mMetadata)
+    metadataLength += prop.first.GetSize() + prop.second.GetSize() + 16;
+
+  string fingerprint;
+  fingerprint.reserve(metadataLength + mOptions.newLabelId.size() + mOptions.downgradeJustification.size() +
+      mOptions.templateId.size() + 128);
+  AppendFingerprintField(static_cast<int64_t>(mMetadata.size()), fingerprint);
+  for (const auto& prop : mMetadata) {
+    AppendFingerprintField(prop.first, fingerprint);
+    AppendFingerprintField(prop.second, fingerprint);
+  }
+  AppendFingerprintField(mOptions.newLabelId, fingerprint);
+  AppendFingerprintField(static_cast<int64_t>(mOptions.actionSource), fingerprint);
+  AppendFingerprintField(static_cast<int64_t>(mOptions.dataState), fingerprint);
+  AppendFingerprintField(static_cast<int64_t>(mOptions.assignmentMethod), fingerprint);
+  AppendFingerprintField(mOptions.isDowngradeJustified ? 1 : 0, fingerprint);
+  AppendFingerprintField(mOptions.downgradeJustification, fingerprint);
+  AppendFingerprintField(mOptions.templateId, fingerprint);
+  AppendFingerprintField(static_cast<int64_t>(mOptions.contentFormat), fingerprint);
+  AppendFingerprintField(mOptions.isAuditDiscoveryEnabled ? 1 : 0, fingerprint);
+  AppendFingerprintField(static_cast<int64_t>(GetSupportedActions()), fingerprint);
+  return fingerprint;
+}
+
 } // namespace sample
 } // namespace upe
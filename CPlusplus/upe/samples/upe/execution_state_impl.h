@@ -28,15 +28,19 @@
 #ifndef SAMPLES_UPE_EXECUTION_STATE_IMPL_H_
 #define SAMPLES_UPE_EXECUTION_STATE_IMPL_H_
 
+#include <deque>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "mip/protection_descriptor.h"
 #include "mip/upe/action.h"
 #include "mip/upe/execution_state.h"
 #include "protection_descriptor_impl.h"
+#include "string_view.h"
 
 namespace sample {
 namespace upe {
@@ -53,11 +57,39 @@ struct ExecutionStateOptions {
   std::string templateId;
   mip::ContentFormat contentFormat = mip::ContentFormat::DEFAULT;
   bool isAuditDiscoveryEnabled = true;
+  // Identity whose engine evaluates this state. Empty uses the engine of the sample's <username>.
+  std::string username;
+  std::string delegatedEmail;
+  // Milliseconds this state's request may wait for its engine or an identical evaluation in flight. 0 uses
+  // ProfileOptions::requestTimeoutMs. Not part of the state seen by the engine.
+  size_t timeoutMs = 0;
+};
+
+// Metadata entries referencing names and values held elsewhere
+typedef std::vector<std::pair<StringView, StringView>> MetadataView;
+
+// An execution state parsed in place (see ParseExecutionStateView), e.g. from a memory-mapped batch file. Its metadata
+// references the parsed text, or 'unescaped' for strings that held escape sequences, instead of copying it into
+// 'options'. The text must outlive the view and any ExecutionStateImpl created from it.
+struct ExecutionStateView {
+  ExecutionStateOptions options; // every field but metadata
+  MetadataView metadata;         // in input order, a later entry replacing an earlier one of the same name
+  std::deque<std::string> unescaped;
 };
 
 class ExecutionStateImpl final : public mip::ExecutionState {
 public:
-  explicit ExecutionStateImpl(ExecutionStateOptions options) : mOptions(std::move(options)) {}
+  // Called with the names and name prefixes of every metadata query the engine makes through GetContentMetadata
+  typedef std::function<void(const std::vector<std::string>& names, const std::vector<std::string>& namePrefixes)>
+      MetadataQueryObserver;
+
+  explicit ExecutionStateImpl(ExecutionStateOptions options);
+  explicit ExecutionStateImpl(ExecutionStateView view);
+
+  void SetMetadataQueryObserver(MetadataQueryObserver observer) { mMetadataQueryObserver = std::move(observer); }
+  const ExecutionStateOptions& GetOptions() const { return mOptions; }
+  // Metadata sorted by name, one entry per name. States created from a view leave GetOptions().metadata empty.
+  const MetadataView& GetMetadata() const { return mMetadata; }
 
   std::string GetNewLabelId() const override { return mOptions.newLabelId; }
   mip::DataState GetDataState() const override { return mOptions.dataState; }
@@ -78,8 +110,18 @@ public:
   mip::ContentFormat GetContentFormat() const override { return mOptions.contentFormat; }
   mip::ActionType GetSupportedActions() const override;
 
+  // Canonical encoding of every field that can influence policy evaluation (all but the content identifier, which only
+  // tags audit events) for use as a result cache key. States that differ only in metadata order encode identically.
+  std::string GetFingerprint() const;
+
 private:
+  ExecutionStateImpl(const ExecutionStateImpl&);
+  ExecutionStateImpl& operator=(const ExecutionStateImpl&);
+
   ExecutionStateOptions mOptions;
+  std::deque<std::string> mUnescaped;
+  MetadataView mMetadata; // references mOptions.metadata, or the view's text and mUnescaped
+  MetadataQueryObserver mMetadataQueryObserver;
 };
 
 } // namespace sample
@@ -0,0 +1,498 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "execution_state_parser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+using sample::upe::StringView;
+using std::deque;
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+const uint64_t kEveryByte = 0x0101010101010101ull;
+const uint64_t kHighBits = 0x8080808080808080ull;
+
+// True if any of the 8 bytes in 'word' is '"' or '\\'. A matching byte's borrow may flag the bytes above it too, which
+// doesn't change the answer.
+bool HasQuoteOrBackslash(uint64_t word) {
+  uint64_t quotes = word ^ (kEveryByte * '"');
+  uint64_t backslashes = word ^ (kEveryByte * '\\');
+  uint64_t matches = (quotes - kEveryByte) & ~quotes;
+  matches |= (backslashes - kEveryByte) & ~backslashes;
+  return (matches & kHighBits) != 0;
+}
+
+// Minimal reader for the flat JSON objects used by the batch input format. Only strings, booleans, null, non-negative
+// integers and objects of strings are needed to describe an execution state, so other numbers and arrays are rejected.
+class JsonReader {
+public:
+  explicit JsonReader(StringView text) : mText(text), mPos(0) {}
+
+  void Expect(char c) {
+    SkipWhitespace();
+    if (mPos >= mText.GetSize() || mText[mPos] != c)
+      Fail(string("Expected '") + c + "'");
+    ++mPos;
+  }
+
+  // Consumes 'c' if it is the next non-whitespace character
+  bool TryConsume(char c) {
+    SkipWhitespace();
+    if (mPos < mText.GetSize() && mText[mPos] == c) {
+      ++mPos;
+      return true;
+    }
+    return false;
+  }
+
+  bool AtEnd() {
+    SkipWhitespace();
+    return mPos >= mText.GetSize();
+  }
+
+  bool TryConsumeNull() {
+    SkipWhitespace();
+    return TryConsumeLiteral("null");
+  }
+
+  bool ReadBool() {
+    SkipWhitespace();
+    if (TryConsumeLiteral("true"))
+      return true;
+    if (TryConsumeLiteral("false"))
+      return false;
+    Fail("Expected boolean");
+    return false;
+  }
+
+  string ReadString() {
+    Expect('"');
+    size_t start = mPos;
+    SkipPlainCharacters();
+    string value(mText.GetData() + start, mPos - start);
+    ReadRestOfString(value);
+    return value;
+  }
+
+  // Reads a string in place. One holding escape sequences is unescaped into a new string at the back of 'unescaped',
+  // which the returned view references instead.
+  StringView ReadStringView(deque<string>& unescaped) {
+    Expect('"');
+    size_t start = mPos;
+    SkipPlainCharacters();
+    if (mPos < mText.GetSize() && mText[mPos] == '"') {
+      ++mPos;
+      return mText.Substr(start, mPos - 1 - start);
+    }
+    unescaped.emplace_back(mText.GetData() + start, mPos - start);
+    ReadRestOfString(unescaped.back());
+    return StringView(unescaped.back());
+  }
+
+  // Reads a string in place, treating 'null' as an empty string
+  StringView ReadOptionalStringView(deque<string>& unescaped) {
+    return TryConsumeNull() ? StringView() : ReadStringView(unescaped);
+  }
+
+  // Reads a non-negative integer
+  size_t ReadUnsigned() {
+    SkipWhitespace();
+    size_t start = mPos;
+    size_t value = 0;
+    while (mPos < mText.GetSize() && mText[mPos] >= '0' && mText[mPos] <= '9') {
+      if (value > (std::numeric_limits<size_t>::max() - 9) / 10)
+        Fail("Number out of range");
+      value = value * 10 + static_cast<size_t>(mText[mPos++] - '0');
+    }
+    if (mPos == start)
+      Fail("Expected non-negative integer");
+    return value;
+  }
+
+  // Reads a string, treating 'null' as an empty string
+  string ReadOptionalString() {
+    return TryConsumeNull() ? string() : ReadString();
+  }
+
+  void Fail(const string& message) const {
+    throw runtime_error(message + " at offset " + std::to_string(mPos));
+  }
+
+private:
+  void SkipWhitespace() {
+    while (mPos < mText.GetSize() &&
+        (mText[mPos] == ' ' || mText[mPos] == '\t' || mText[mPos] == '\r' || mText[mPos] == '\n'))
+      ++mPos;
+  }
+
+  bool TryConsumeLiteral(StringView literal) {
+    if (mText.Substr(mPos, literal.GetSize()) != literal)
+      return false;
+    mPos += literal.GetSize();
+    return true;
+  }
+
+  // Advances to the next '"' or '\\', or to the end of the text. String contents are scanned 8 bytes at a time.
+  void SkipPlainCharacters() {
+    const char* data = mText.GetData();
+    size_t size = mText.GetSize();
+    while (mPos + 8 <= size) {
+      uint64_t word;
+      memcpy(&word, data + mPos, 8);
+      if (HasQuoteOrBackslash(word))
+        break;
+      mPos += 8;
+    }
+    while (mPos < size && data[mPos] != '"' && data[mPos] != '\\')
+      ++mPos;
+  }
+
+  // Appends the rest of the string starting at the current position to 'value', unescaped, and consumes its closing
+  // quote
+  void ReadRestOfString(string& value) {
+    while (mPos < mText.GetSize()) {
+      char c = mText[mPos++];
+      if (c == '"')
+        return;
+      if (c != '\\') {
+        size_t start = mPos - 1;
+        SkipPlainCharacters();
+        value.append(mText.GetData() + start, mPos - start);
+        continue;
+      }
+      if (mPos >= mText.GetSize())
+        break;
+      char escaped = mText[mPos++];
+      switch (escaped) {
+        case '"': value.push_back('"'); break;
+        case '\\': value.push_back('\\'); break;
+        case '/': value.push_back('/'); break;
+        case 'b': value.push_back('\b'); break;
+        case 'f': value.push_back('\f'); break;
+        case 'n': value.push_back('\n'); break;
+        case 'r': value.push_back('\r'); break;
+        case 't': value.push_back('\t'); break;
+        case 'u': AppendCodePoint(ReadUnicodeEscape(), value); break;
+        default: Fail("Invalid escape sequence");
+      }
+    }
+    Fail("Unterminated string");
+  }
+
+  unsigned int ReadHex4() {
+    if (mPos + 4 > mText.GetSize())
+      Fail("Truncated unicode escape");
+    unsigned int value = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = mText[mPos++];
+      value <<= 4;
+      if (c >= '0' && c <= '9')
+        value |= c - '0';
+      else if (c >= 'a' && c <= 'f')
+        value |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+        value |= c - 'A' + 10;
+      else
+        Fail("Invalid unicode escape");
+    }
+    return value;
+  }
+
+  unsigned int ReadUnicodeEscape() {
+    unsigned int codePoint = ReadHex4();
+    if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+      if (!TryConsumeLiteral("\\u"))
+        Fail("Unpaired surrogate");
+      unsigned int low = ReadHex4();
+      if (low < 0xDC00 || low > 0xDFFF)
+        Fail("Invalid surrogate pair");
+      codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+    }
+    return codePoint;
+  }
+
+  static void AppendCodePoint(unsigned int codePoint, string& out) {
+    if (codePoint < 0x80) {
+      out.push_back(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+      out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else if (codePoint < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+  }
+
+  StringView mText;
+  size_t mPos;
+};
+
+// Reads a metadata name or value up to the next unescaped ',' (or '|' if 'isName'), leaving 'position' on it or at
+// the end. Returns false on a trailing backslash.
+bool ReadMetadataToken(
+    StringView text,
+    bool isName,
+    size_t& position,
+    deque<string>& unescaped,
+    StringView& token) {
+  size_t start = position;
+  while (position < text.GetSize() && text[position] != ',' && text[position] != '\\' &&
+      (!isName || text[position] != '|'))
+    ++position;
+  if (position >= text.GetSize() || text[position] != '\\') {
+    token = text.Substr(start, position - start);
+    return true;
+  }
+
+  unescaped.emplace_back(text.GetData() + start, position - start);
+  string& value = unescaped.back();
+  while (position < text.GetSize() && text[position] != ',' && (!isName || text[position] != '|')) {
+    if (text[position] == '\\' && ++position >= text.GetSize())
+      return false;
+    value.push_back(text[position++]);
+  }
+  token = StringView(value);
+  return true;
+}
+
+// Same as ReadMetadataToken, unescaping into 'token' unless it is null. 'isEmpty' is set if the token has no characters,
+// not even escaped ones.
+bool ScanMetadataToken(StringView text, bool isName, size_t& position, string* token, bool& isEmpty) {
+  size_t start = position;
+  if (nullptr != token)
+    token->clear();
+  while (position < text.GetSize() && text[position] != ',' && (!isName || text[position] != '|')) {
+    if (text[position] == '\\' && ++position >= text.GetSize())
+      return false;
+    if (nullptr != token)
+      token->push_back(text[position]);
+    ++position;
+  }
+  isEmpty = position == start;
+  return true;
+}
+
+// Validates 'value' if 'metadata' is null, otherwise adds its pairs to 'metadata'. Uses the grammar of
+// ParseMetadataView.
+bool ScanMetadata(StringView value, std::unordered_map<string, string>* metadata) {
+  string name;
+  string pairValue;
+  string* nameToken = nullptr != metadata ? &name : nullptr;
+  string* valueToken = nullptr != metadata ? &pairValue : nullptr;
+  size_t position = 0;
+  while (position <= value.GetSize()) {
+    bool isNameEmpty = true;
+    if (!ScanMetadataToken(value, true, position, nameToken, isNameEmpty))
+      return false;
+    if (position < value.GetSize() && value[position] == '|') {
+      ++position;
+      bool isValueEmpty = true;
+      if (isNameEmpty || !ScanMetadataToken(value, false, position, valueToken, isValueEmpty))
+        return false;
+      if (nullptr != metadata)
+        (*metadata)[name] = pairValue;
+    } else if (!isNameEmpty) {
+      return false; // a name without a value
+    }
+    ++position; // past the ','
+  }
+  return true;
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+bool ParseAssignmentMethod(const string& value, mip::AssignmentMethod& assignmentMethod) {
+  if (value == "standard")
+    assignmentMethod = mip::AssignmentMethod::STANDARD;
+  else if (value == "privileged")
+    assignmentMethod = mip::AssignmentMethod::PRIVILEGED;
+  else if (value == "auto")
+    assignmentMethod = mip::AssignmentMethod::AUTO;
+  else
+    return false;
+  return true;
+}
+
+bool ParseContentFormat(const string& value, mip::ContentFormat& contentFormat) {
+  if (value == "default")
+    contentFormat = mip::ContentFormat::DEFAULT;
+  else if (value == "email")
+    contentFormat = mip::ContentFormat::EMAIL;
+  else
+    return false;
+  return true;
+}
+
+bool ParseDataState(const string& value, mip::DataState& dataState) {
+  if (value == "motion")
+    dataState = mip::DataState::MOTION;
+  else if (value == "use")
+    dataState = mip::DataState::USE;
+  else if (value == "rest")
+    dataState = mip::DataState::REST;
+  else
+    return false;
+  return true;
+}
+
+bool ParseMetadataView(StringView value, MetadataView& metadata, deque<string>& unescaped) {
+  size_t metadataSize = metadata.size();
+  size_t unescapedSize = unescaped.size();
+  size_t position = 0;
+  bool isValid = true;
+  while (isValid && position <= value.GetSize()) {
+    StringView name;
+    StringView pairValue;
+    isValid = ReadMetadataToken(value, true, position, unescaped, name);
+    if (isValid && position < value.GetSize() && value[position] == '|') {
+      ++position;
+      isValid = !name.IsEmpty() && ReadMetadataToken(value, false, position, unescaped, pairValue);
+      if (isValid)
+        metadata.emplace_back(name, pairValue);
+    } else if (isValid) {
+      isValid = name.IsEmpty(); // an empty pair, or a name without a value
+    }
+    ++position; // past the ','
+  }
+
+  if (!isValid) {
+    metadata.resize(metadataSize);
+    unescaped.resize(unescapedSize);
+  }
+  return isValid;
+}
+
+bool IsValidMetadata(const string& value) {
+  return ScanMetadata(value, nullptr);
+}
+
+bool ParseMetadata(const string& value, std::unordered_map<string, string>& metadata) {
+  // Validated first so that invalid input leaves 'metadata' untouched, then added straight to the map. Every pair is
+  // followed by a ',' unless it is the last, which bounds the pair count for the one reservation.
+  if (!ScanMetadata(value, nullptr))
+    return false;
+  metadata.reserve(metadata.size() + std::count(value.begin(), value.end(), ',') + 1);
+  return ScanMetadata(value, &metadata);
+}
+
+void ParseExecutionStateView(StringView json, const ExecutionStateOptions& defaults, ExecutionStateView& view) {
+  ExecutionStateOptions& options = view.options;
+  options = defaults;
+  options.metadata.clear();
+  view.metadata.assign(defaults.metadata.begin(), defaults.metadata.end());
+  view.unescaped.clear();
+  JsonReader reader(json);
+
+  reader.Expect('{');
+  if (!reader.TryConsume('}')) {
+    do {
+      StringView field = reader.ReadStringView(view.unescaped);
+      reader.Expect(':');
+
+      if (field == "metadata") {
+        view.metadata.clear();
+        if (!reader.TryConsumeNull()) {
+          reader.Expect('{');
+          if (!reader.TryConsume('}')) {
+            do {
+              StringView key = reader.ReadStringView(view.unescaped);
+              reader.Expect(':');
+              view.metadata.emplace_back(key, reader.ReadOptionalStringView(view.unescaped));
+            } while (reader.TryConsume(','));
+            reader.Expect('}');
+          }
+        }
+      } else if (field == "newLabelId") {
+        options.newLabelId = reader.ReadOptionalString();
+      } else if (field == "assignmentMethod") {
+        string value = reader.ReadString();
+        if (!ParseAssignmentMethod(value, options.assignmentMethod))
+          throw runtime_error("Invalid assignmentMethod '" + value + "'");
+      } else if (field == "templateId") {
+        options.templateId = reader.ReadOptionalString();
+      } else if (field == "contentFormat") {
+        string value = reader.ReadString();
+        if (!ParseContentFormat(value, options.contentFormat))
+          throw runtime_error("Invalid contentFormat '" + value + "'");
+      } else if (field == "dataState") {
+        string value = reader.ReadString();
+        if (!ParseDataState(value, options.dataState))
+          throw runtime_error("Invalid dataState '" + value + "'");
+      } else if (field == "contentIdentifier") {
+        options.contentIdentifier = reader.ReadOptionalString();
+      } else if (field == "downgradeJustified") {
+        options.isDowngradeJustified = reader.ReadBool();
+      } else if (field == "downgradeJustification") {
+        options.downgradeJustification = reader.ReadOptionalString();
+      } else if (field == "auditDiscoveryEnabled") {
+        options.isAuditDiscoveryEnabled = reader.ReadBool();
+      } else if (field == "username") {
+        options.username = reader.ReadOptionalString();
+      } else if (field == "delegatedEmail") {
+        options.delegatedEmail = reader.ReadOptionalString();
+      } else if (field == "timeoutMs") {
+        options.timeoutMs = reader.ReadUnsigned();
+      } else {
+        throw runtime_error("Unrecognized field '" + field.ToString() + "'");
+      }
+    } while (reader.TryConsume(','));
+    reader.Expect('}');
+  }
+
+  if (!reader.AtEnd())
+    reader.Fail("Unexpected trailing characters");
+}
+
+ExecutionStateOptions ParseExecutionStateJson(const string& json, const ExecutionStateOptions& defaults) {
+  ExecutionStateView view;
+  ParseExecutionStateView(json, defaults, view);
+  ExecutionStateOptions options = std::move(view.options);
+  options.metadata.reserve(view.metadata.size());
+  for (const auto& prop : view.metadata)
+    options.metadata[prop.first.ToString()] = prop.second.ToString();
+  return options;
+}
+
+} // namespace sample
+} // namespace upe
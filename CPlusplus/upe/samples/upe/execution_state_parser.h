@@ -0,0 +1,79 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_EXECUTION_STATE_PARSER_H_
+#define SAMPLES_UPE_EXECUTION_STATE_PARSER_H_
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "mip/common_types.h"
+
+#include "execution_state_impl.h"
+#include "string_view.h"
+
+namespace sample {
+namespace upe {
+
+// Parses the textual forms accepted by the command line ('standard', 'email', 'rest', etc). Each returns false and
+// leaves the output untouched if the value is not recognized.
+bool ParseAssignmentMethod(const std::string& value, mip::AssignmentMethod& assignmentMethod);
+bool ParseContentFormat(const std::string& value, mip::ContentFormat& contentFormat);
+bool ParseDataState(const std::string& value, mip::DataState& dataState);
+
+// Parses the --metadata form, comma-separated name|value pairs such as "name1|value1,name2|value2", in a single pass.
+// A backslash makes the next character literal, so names and values may hold ',', '|' or '\\'. A pair's value runs to
+// the next unescaped ',' and may be empty ("name|"). Empty pairs (e.g. a trailing ',') are skipped and later pairs
+// replace earlier ones of the same name. Fails on a pair without '|', an empty name or a trailing backslash.
+//
+// ParseMetadataView references 'value' for names and values without escapes and unescapes the others into new strings
+// at the back of 'unescaped'. ParseMetadata checks the whole value first, then unescapes each pair straight into
+// 'metadata' after a single reservation, and leaves 'metadata' unchanged on failure. IsValidMetadata only checks,
+// without copying anything, whether ParseMetadata would succeed.
+bool ParseMetadataView(StringView value, MetadataView& metadata, std::deque<std::string>& unescaped);
+bool IsValidMetadata(const std::string& value);
+bool ParseMetadata(const std::string& value, std::unordered_map<std::string, std::string>& metadata);
+
+// Parses a single JSON object describing an execution state, for example:
+//   {"metadata":{"key1":"value1"},"newLabelId":"<id>","assignmentMethod":"standard","contentFormat":"email"}
+// Recognized fields are metadata, newLabelId, assignmentMethod, templateId, contentFormat, dataState,
+// contentIdentifier, downgradeJustified, downgradeJustification, auditDiscoveryEnabled, username, delegatedEmail and
+// timeoutMs.
+// Fields not present in the object keep the value they have in 'defaults'. Throws std::runtime_error if the line is
+// malformed.
+ExecutionStateOptions ParseExecutionStateJson(const std::string& json, const ExecutionStateOptions& defaults);
+
+// Same as ParseExecutionStateJson, parsing into 'view' in place: metadata names and values reference 'json' rather than
+// being copied, and a state without metadata references that of 'defaults', so both must outlive the view. Parsing
+// into a view that held another state replaces it.
+void ParseExecutionStateView(StringView json, const ExecutionStateOptions& defaults, ExecutionStateView& view);
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_EXECUTION_STATE_PARSER_H_
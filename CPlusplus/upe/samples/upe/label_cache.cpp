@@ -0,0 +1,106 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "label_cache.h"
+
+#include <utility>
+
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Rough footprint of a mip::ContentLabel and the mip::Label it refers to
+const size_t kApproximateContentLabelBytes = 256;
+
+void AppendKeyField(sample::upe::StringView value, string& key) {
+  key += std::to_string(value.GetSize());
+  key += ':';
+  key.append(value.GetData(), value.GetSize());
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+string LabelCache::GetKey(const string& engineId, const ExecutionStateImpl& state) const {
+  const ExecutionStateOptions& options = state.GetOptions();
+  const MetadataView& stateMetadata = state.GetMetadata();
+  vector<const pair<StringView, StringView>*> metadata;
+  {
+    // The state's metadata and the remembered names are both sorted, so they are matched in one pass
+    lock_guard<mutex> lock(mQueryMutex);
+    auto itName = mMetadataNames.begin();
+    for (const auto& prop : stateMetadata) {
+      while (itName != mMetadataNames.end() && StringView(*itName) < prop.first)
+        ++itName;
+      bool isQueried = itName != mMetadataNames.end() && prop.first == *itName;
+      for (auto it = mMetadataPrefixes.begin(); !isQueried && it != mMetadataPrefixes.end(); ++it)
+        isQueried = prop.first.StartsWith(*it);
+      if (isQueried)
+        metadata.push_back(&prop);
+    }
+  }
+
+  string key;
+  AppendKeyField(engineId, key);
+  AppendKeyField(options.templateId, key);
+  key += std::to_string(static_cast<int>(options.contentFormat));
+  key += options.isAuditDiscoveryEnabled ? ";1;" : ";0;";
+  for (const pair<StringView, StringView>* prop : metadata) {
+    AppendKeyField(prop->first, key);
+    AppendKeyField(prop->second, key);
+  }
+  return key;
+}
+
+void LabelCache::Insert(const string& key, const shared_ptr<mip::ContentLabel>& label, uint64_t generation) {
+  mResults.Insert(key, label, kApproximateContentLabelBytes, generation);
+}
+
+void LabelCache::RecordMetadataQuery(const vector<string>& names, const vector<string>& namePrefixes) {
+  lock_guard<mutex> lock(mQueryMutex);
+  mMetadataNames.insert(names.begin(), names.end());
+  mMetadataPrefixes.insert(namePrefixes.begin(), namePrefixes.end());
+}
+
+LabelCache::Statistics LabelCache::GetStatistics() const {
+  Statistics statistics;
+  statistics.results = mResults.GetStatistics();
+  lock_guard<mutex> lock(mQueryMutex);
+  statistics.metadataNames = mMetadataNames.size();
+  statistics.metadataPrefixes = mMetadataPrefixes.size();
+  return statistics;
+}
+
+} // namespace sample
+} // namespace upe
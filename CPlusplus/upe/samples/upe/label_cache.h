@@ -0,0 +1,106 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_LABEL_CACHE_H_
+#define SAMPLES_UPE_LABEL_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "mip/upe/content_label.h"
+
+#include "execution_state_impl.h"
+#include "result_cache.h"
+
+namespace sample {
+namespace upe {
+
+// Memoizes GetSensitivityLabel results by the part of the execution state the engine actually reads. Every metadata
+// query the engine makes (see ExecutionStateImpl::SetMetadataQueryObserver) is remembered, and a state's key holds only
+// the metadata entries matching a remembered name or prefix, plus the template id and content format. Per-file
+// metadata the policy never asks for (and the content identifier) therefore doesn't split the cache, so a scan of many
+// files sharing a label signature evaluates that signature once.
+//
+// A result is keyed after its evaluation, when every query it made has been remembered. Since the engine's queries are
+// determined by the answers to its earlier queries, two states whose keys match get the same answers and the same
+// label.
+class LabelCache {
+public:
+  struct Statistics {
+    ResultCache<std::shared_ptr<mip::ContentLabel>>::Statistics results;
+    size_t metadataNames = 0;
+    size_t metadataPrefixes = 0;
+  };
+
+  LabelCache(size_t maxEntries, size_t maxBytes) : mResults(maxEntries, maxBytes) {}
+
+  bool IsEnabled() const { return mResults.IsEnabled(); }
+  uint64_t GetGeneration() const { return mResults.GetGeneration(); }
+
+  // Returns the cache key of 'state' for the engine 'engineId' under the metadata queries remembered so far
+  std::string GetKey(const std::string& engineId, const ExecutionStateImpl& state) const;
+
+  bool Find(const std::string& key, std::shared_ptr<mip::ContentLabel>& label) { return mResults.Find(key, label); }
+  void Insert(const std::string& key, const std::shared_ptr<mip::ContentLabel>& label, uint64_t generation);
+
+  // Remembers a metadata query, to be hooked up as the ExecutionStateImpl::MetadataQueryObserver of evaluated states
+  void RecordMetadataQuery(const std::vector<std::string>& names, const std::vector<std::string>& namePrefixes);
+
+  // Drops every cached label, e.g. after a policy change
+  void Clear() { mResults.Clear(); }
+
+  Statistics GetStatistics() const;
+
+  // Locks both the remembered queries and the results across fork() (see Action::PrepareFork)
+  void LockForFork() {
+    mQueryMutex.lock();
+    mResults.LockForFork();
+  }
+  void UnlockAfterFork() {
+    mResults.UnlockAfterFork();
+    mQueryMutex.unlock();
+  }
+
+private:
+  LabelCache(const LabelCache&);
+  LabelCache& operator=(const LabelCache&);
+
+  ResultCache<std::shared_ptr<mip::ContentLabel>> mResults;
+  mutable std::mutex mQueryMutex;
+  std::set<std::string> mMetadataNames;
+  std::set<std::string> mMetadataPrefixes;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_LABEL_CACHE_H_
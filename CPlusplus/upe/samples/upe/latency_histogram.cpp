@@ -0,0 +1,104 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "latency_histogram.h"
+
+#include <iomanip>
+
+namespace {
+
+void PrintMilliseconds(uint64_t microseconds, std::ostream& output) {
+  std::ios_base::fmtflags flags = output.flags();
+  std::streamsize precision = output.precision();
+  output << std::fixed << std::setprecision(1) << microseconds / 1000.0 << " ms";
+  output.flags(flags);
+  output.precision(precision);
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+LatencyHistogram::LatencyHistogram() : mMaxMicroseconds(0) {
+  for (std::atomic<uint64_t>& bucket : mBuckets)
+    bucket.store(0);
+}
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration latency) {
+  int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  uint64_t microseconds = elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0;
+
+  size_t bucket = 0;
+  for (uint64_t remaining = microseconds; remaining > 0 && bucket < kBucketCount - 1; remaining >>= 1)
+    ++bucket;
+  mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t max = mMaxMicroseconds.load(std::memory_order_relaxed);
+  while (microseconds > max && !mMaxMicroseconds.compare_exchange_weak(max, microseconds)) {}
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+  uint64_t count = 0;
+  for (const std::atomic<uint64_t>& bucket : mBuckets)
+    count += bucket.load(std::memory_order_relaxed);
+  return count;
+}
+
+uint64_t LatencyHistogram::GetPercentileMicroseconds(double fraction) const {
+  uint64_t count = GetCount();
+  if (count == 0)
+    return 0;
+
+  // Rank of the sample at 'fraction', counting from 1
+  uint64_t rank = static_cast<uint64_t>(fraction * count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    seen += mBuckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      uint64_t upperBound = static_cast<uint64_t>(1) << i;
+      return upperBound < GetMaxMicroseconds() ? upperBound : GetMaxMicroseconds();
+    }
+  }
+  return GetMaxMicroseconds();
+}
+
+void LatencyHistogram::Print(std::ostream& output) const {
+  output << GetCount() << " requests, p50 ";
+  PrintMilliseconds(GetPercentileMicroseconds(0.5), output);
+  output << ", p99 ";
+  PrintMilliseconds(GetPercentileMicroseconds(0.99), output);
+  output << ", p99.9 ";
+  PrintMilliseconds(GetPercentileMicroseconds(0.999), output);
+  output << ", max ";
+  PrintMilliseconds(GetMaxMicroseconds(), output);
+}
+
+} // namespace sample
+} // namespace upe
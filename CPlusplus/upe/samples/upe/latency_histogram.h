@@ -0,0 +1,71 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_LATENCY_HISTOGRAM_H_
+#define SAMPLES_UPE_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace sample {
+namespace upe {
+
+// Counts latencies recorded from any thread in power-of-two microsecond buckets, so percentiles are reported to within
+// a factor of two at the cost of one atomic increment per request
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void Record(std::chrono::steady_clock::duration latency);
+
+  uint64_t GetCount() const;
+
+  // Upper bound of the bucket holding the latency below which 'fraction' (0-1) of the recorded latencies fall, capped
+  // at the largest latency recorded
+  uint64_t GetPercentileMicroseconds(double fraction) const;
+
+  uint64_t GetMaxMicroseconds() const { return mMaxMicroseconds.load(); }
+
+  // Prints "<count> requests, p50 <x> ms, p99 <y> ms, p99.9 <z> ms, max <w> ms"
+  void Print(std::ostream& output) const;
+
+private:
+  LatencyHistogram(const LatencyHistogram&);
+  LatencyHistogram& operator=(const LatencyHistogram&);
+
+  // Bucket i counts latencies below 2^i microseconds not counted by bucket i - 1; the last also counts anything longer
+  static const size_t kBucketCount = 32;
+  std::atomic<uint64_t> mBuckets[kBucketCount];
+  std::atomic<uint64_t> mMaxMicroseconds;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_LATENCY_HISTOGRAM_H_
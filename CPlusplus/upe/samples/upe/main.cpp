@@ -25,7 +25,14 @@
  *
  */
 
-#include <sstream>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#endif // _WIN32
 
 #ifdef __linux__
 #include <unistd.h>
@@ -37,37 +44,28 @@
 #include "mip/version.h"
 
 #include "action.h"
+#include "batch_runner.h"
 #include "cxxopts.hpp"
+#include "execution_state_parser.h"
+#include "metadata_benchmark.h"
+#include "output_sink.h"
+#include "server.h"
+#include "startup_timeline.h"
 #include "string_utils.h"
 
 using std::cout;
 using std::endl;
 using std::exception;
-using std::getline;
 using std::string;
-using std::stringstream;
-using std::vector;
 
 namespace {
 
 static const char kPathSeparatorWindows = '\\';
 static const char kPathSeparatorUnix = '/';
 
-vector<string> SplitString(const string& str, char delim) {
-  vector<string> output;
-  stringstream ss(str);
-  string substr;
-
-  while (ss.good()) {
-    getline(ss, substr, delim);
-    output.emplace_back(move(substr));
-  }
-
-  return output;
-}
-
 enum class SampleActionType {
   Invalid,
+  Serve,
   ListEngines,
   ListLabels,
   ListSensitivityTypes,
@@ -77,8 +75,15 @@ enum class SampleActionType {
   ComputeActions,
 };
 
+enum class BatchInputType {
+  None,
+  File,
+  Stdin,
+};
+
 bool ValidateOptions(
   SampleActionType actionType,
+  BatchInputType batchInputType,
   const sample::upe::AuthenticationOptions& auth,
   const sample::upe::ProfileOptions& profile) {
   // Required options
@@ -104,6 +109,14 @@ bool ValidateOptions(
       return false;
   }
 
+  // Batch options
+  if (batchInputType != BatchInputType::None &&
+      actionType != SampleActionType::ShowLabel &&
+      actionType != SampleActionType::ComputeActions) {
+    cout << "ERROR: Batch input requires <showLabel> or <computeActions>." << endl;
+    return false;
+  }
+
   return true;
 }
 
@@ -132,6 +145,7 @@ string GetWorkingDirectory(int argc, char* argv[]) {
 } // namespace
 
 int main_impl(int argc, char* argv[]) {
+  sample::upe::StartupTimeline startupTimeline;
   try {
     const int argCount = argc; // need to save it as cxxopts change it while parsing
     string upeSampleWorkingDirectory = GetWorkingDirectory(argc, argv);
@@ -154,6 +168,22 @@ int main_impl(int argc, char* argv[]) {
       ("engineId", "(Optional) Load an engine from profile's storage cache by id rather than creating a new one.", cxxopts::value<string>())
       ("policyFile", "Import policy from xml file rather than from server.", cxxopts::value<string>())
       ("simulatePolicyChange", "(Optional) Simulate a policy change notification prior to performing any actions.")
+      ("engineCacheSize", "(Optional) Maximum number of identities (batch/serve 'username' and 'delegatedEmail') with a loaded engine. Idle engines beyond this are unloaded. (Default=16)", cxxopts::value<int>())
+      ("engineReplicas", "(Optional) Load this many engines for <username>, each under an engine id of its own, and pin each worker thread (<threads>, <serveThreads>) to one, trading memory for no sharing between workers. 0 loads one per core. <showStats> reports the added memory. (Default=1, one shared engine)", cxxopts::value<int>())
+      ("actionCacheSize", "(Optional) Memoize up to this many <computeActions> results per engine and execution state until the policy changes. Memoized results send no audit events. (Default=0, disabled)", cxxopts::value<int>())
+      ("actionCacheMemory", "(Optional) Approximate memory limit in MB for memoized <computeActions> results. (Default=64)", cxxopts::value<int>())
+      ("reloadQuietPeriod", "(Optional) Milliseconds without further policy change notifications for an engine before it is reloaded. (Default=500)", cxxopts::value<int>())
+      ("reloadMaxDelay", "(Optional) Maximum milliseconds a burst of policy change notifications can delay an engine reload. (Default=5000)", cxxopts::value<int>())
+      ("maxConcurrentReloads", "(Optional) Maximum number of engines reloading at once after policy changes. (Default=2)", cxxopts::value<int>())
+      ("warmUpEngines", "(Optional) With <useStorageCache>, load this many engines from the storage cache concurrently at startup (0 = all, up to <engineCacheSize>) and report each load's latency to stderr.", cxxopts::value<int>())
+      ("maxConcurrentLoads", "(Optional) Maximum number of engines <warmUpEngines> loads at once. Whether a load fetched policy is only reported for loads that did not overlap another. (Default=8)", cxxopts::value<int>())
+      ("precomputeActions", "(Optional) When an engine is created/loaded, precompute the <computeActions> result of applying each label to unlabeled content, for each <contentFormat>, on all cores. Such states are then answered from that table and send no audit events.")
+      ("coalesceRequests", "(Optional) Concurrent <computeActions>/<showLabel> evaluations of the same execution state (e.g. one message fanned out to many recipients) share one evaluation, which sends the only audit events. Adds bookkeeping to every evaluation, so it only pays off when identical requests often overlap on several threads (<threads>, <pipeline> or <serveThreads>) and evaluations are expensive; compare the 'Coalescing' ratio and throughput with <showStats> before enabling it. (Default=off)")
+      ("labelCacheSize", "(Optional) Memoize up to this many <showLabel> results, keyed only by the metadata the policy reads, until the policy changes. (Default=0, disabled)", cxxopts::value<int>())
+      ("requestTimeout", "(Optional) Milliseconds a request may wait for its engine to load or for an identical evaluation in flight before it fails. A batch/serve request's 'timeoutMs' field overrides it. (Default=0, no deadline)", cxxopts::value<int>())
+      ("staleResultCacheSize", "(Optional) Keep the last result of up to this many identities and execution states, and answer batch/serve requests past their deadline with it, marked stale. (Default=0, disabled)", cxxopts::value<int>())
+      ("sharedResultCache", "(Optional) Share <computeActions>/<showLabel> batch/serve results with every process on this host naming the same shared memory segment (ex: \"/upe_sample_results\"), e.g. <serveProcesses> workers. The segment persists until removed (on Linux, from /dev/shm). Shared results send no audit events.", cxxopts::value<string>())
+      ("sharedResultCacheSlots", "(Optional) Number of results the <sharedResultCache> segment holds, if this process creates it. (Default=16384)", cxxopts::value<int>())
 
       // Action choice
       ("listEngines", "List all engines in storage cache")
@@ -165,7 +195,7 @@ int main_impl(int argc, char* argv[]) {
       ("showPolicyData", "Shows policy data XML which describes the settings, labels, and rules associated with this policy")
 
       // Execution state options
-      ("metadata", "(Optional) Execution state: Comma-separated key-value pairs (ex: \"key1|value1,key2|value2\") (Default=empty)", cxxopts::value<string>())
+      ("metadata", "(Optional) Execution state: Comma-separated key-value pairs (ex: \"key1|value1,key2|value2\"). A '\\' makes the next character part of the key or value (ex: \"key|a\\,b\"), so a literal backslash, as in a Windows path, must be doubled (ex: \"path|C:\\\\dir\"). (Default=empty)", cxxopts::value<string>())
       ("newLabelId", "(Optional) Execution state: Label id to be applied to content. (Default=none)", cxxopts::value<string>())
       ("assignmentMethod", "(Optional) Execution state: Assignment method for <newLabelId>. ['standard'|'privileged'|'auto'] (Default='standard')", cxxopts::value<string>())
       ("downgradeJustified", "(Optional) Execution state: Label downgrade has already been justified. (Default=false)")
@@ -175,8 +205,33 @@ int main_impl(int argc, char* argv[]) {
       ("dataState", "(Optional) Execution state: State of content. ['motion'|'use'|'rest'] (Default='rest')", cxxopts::value<string>())
       ("contentIdentifier", "(Optional) A unique string that identifies a a piece of content", cxxopts::value<string>())
 
+      // Batch options
+      ("batchFile", "(Optional) Evaluate <showLabel> or <computeActions> for each JSON execution state line in file, using one engine. Execution state options above become per-line defaults.", cxxopts::value<string>())
+      ("batchStdin", "(Optional) Same as <batchFile>, reading execution state lines from stdin.")
+      ("threads", "(Optional) Number of worker threads evaluating batch lines against the shared engine. Output keeps input order. (Default=1)", cxxopts::value<int>())
+      ("pipeline", "(Optional) Evaluate batch lines in stages (read, parse, evaluate on <threads> threads, serialize) connected by bounded queues. With <showStats>, reports how busy, starved and blocked each stage was.")
+      ("buildThreads", "(Optional) With <pipeline>, number of threads parsing lines into execution states. (Default=1)", cxxopts::value<int>())
+      ("serializeThreads", "(Optional) With <pipeline>, number of threads serializing results. Output keeps input order. (Default=1)", cxxopts::value<int>())
+      ("queueCapacity", "(Optional) With <pipeline>, number of lines each queue between stages holds before the stage feeding it waits. (Default=1024)", cxxopts::value<int>())
+
+      // Output options
+      ("outputFormat", "(Optional) Format of <listLabels>, <showDefaultLabel>, <showLabel> and <computeActions> results: human-readable text, one JSON value per line, each JSON value preceded by its 4-byte big-endian length, or each result in the compact binary encoding of result_encoding.h preceded by its length. ['text'|'ndjson'|'binary'|'encoded'] (Default='text', 'ndjson' for batch input)", cxxopts::value<string>())
+      ("outputFlushBytes", "(Optional) Results are buffered and written out once this many bytes are pending, and at the end. (Default=1048576)", cxxopts::value<int>())
+
+      // Server options
+      ("serve", "(Linux only) Keep one engine loaded and answer framed ShowLabel, ComputeActions, ListLabels and ShowDefaultLabel requests on a Unix domain socket at this path until SIGINT/SIGTERM. Execution state options above become per-request defaults.", cxxopts::value<string>())
+      ("serveThreads", "(Optional) With <serve>, number of worker threads answering requests. Responses on each connection keep request order. (Default=1, answered on the connection thread)", cxxopts::value<int>())
+      ("serveProcesses", "(Optional) With <serve>, load the engine once, then fork this many worker processes that serve from a copy of it, each with <serveThreads> threads. Crashed workers are restarted without reloading the policy. Combine with <precomputeActions> so workers also inherit the action plans. (Default=0, serve from this process)", cxxopts::value<int>())
+      ("interactiveWeight", "(Optional) With <serveThreads>, number of interactive requests (all but ComputeActions) started per <bulkWeight> bulk ComputeActions requests while both are waiting. (Default=4)", cxxopts::value<int>())
+      ("bulkWeight", "(Optional) With <serveThreads>, see <interactiveWeight>. (Default=1)", cxxopts::value<int>())
+      ("maxInteractiveQueue", "(Optional) With <serveThreads>, interactive requests arriving while this many are waiting are answered Overloaded with a retry delay. (Default=1024)", cxxopts::value<int>())
+      ("maxBulkQueue", "(Optional) With <serveThreads>, bulk requests arriving while this many are waiting are answered Overloaded with a retry delay. (Default=256)", cxxopts::value<int>())
+
       // Other options
       ("locale", "Set locale/language (default 'en-US')", cxxopts::value<string>())
+      ("showStats", "(Optional) Print statistics (e.g. PolicyHandler pool hit rate) to stderr when done.")
+      ("serialStartup", "(Optional) Finish loading the profile and engine before parsing the execution state and opening input, rather than overlapping them. For comparing <showStats> startup times.")
+      ("benchmarkMetadata", "(Optional) Time parsing <metadata> (or generated MSIP label metadata) this many times and exit.", cxxopts::value<int>())
       ("version", "Display version information.")
       ("h,help", "Display help information.");
 
@@ -212,6 +267,27 @@ int main_impl(int argc, char* argv[]) {
           "    upe_sample.exe --username <username> --token <token> --contentIdentifier <filepath:filename> --computeActions --newLabelId <newLabelId> --assignmentMethod <assignmentMethod> --contentFormat <contentFormat>\n\n" <<
           "  Compute actions - Apply a label to template-protected content:\n" <<
           "    upe_sample.exe --username <username> --token <token> --contentIdentifier <filepath:filename>--computeActions --newLabelId <newLabelId> --templateId <templateId>\n\n" <<
+          "  Compute actions for many execution states with one engine (one JSON object per line):\n" <<
+          "    upe_sample.exe --username <username> --token <token> --computeActions --batchFile <batchFile> [--threads <N>]\n" <<
+          "    e.g. {\"metadata\":{\"MSIP_Label_<id>_Enabled\":\"True\"},\"newLabelId\":\"<newLabelId>\",\"contentFormat\":\"email\"}\n\n" <<
+          "  Compute actions for many execution states in a staged pipeline, reporting each stage's load:\n" <<
+          "    upe_sample.exe --username <username> --token <token> --computeActions --batchFile <batchFile> --pipeline --threads <N> --showStats\n\n" <<
+          "  Serve requests on a Unix domain socket with one engine:\n" <<
+          "    upe_sample --username <username> --token <token> --serve <socketPath>\n\n" <<
+          "  Serve requests on 8 threads, sharing one evaluation among identical concurrent requests:\n" <<
+          "    upe_sample --username <username> --token <token> --serve <socketPath> --serveThreads 8 --coalesceRequests --showStats\n\n" <<
+          "  Serve requests from 4 worker processes sharing one policy load, restarting any that crash:\n" <<
+          "    upe_sample --username <username> --token <token> --precomputeActions --serve <socketPath> --serveProcesses 4 --serveThreads 2\n\n" <<
+          "  Serve interactive requests ahead of bulk ComputeActions, rejecting bulk requests beyond 64 queued:\n" <<
+          "    upe_sample --username <username> --token <token> --serve <socketPath> --serveThreads 8 --interactiveWeight 8 --maxBulkQueue 64 --showStats\n\n" <<
+          "  Serve requests after loading up to 100 cached engines, 16 at a time:\n" <<
+          "    upe_sample --username <username> --token <token> --useStorageCache --warmUpEngines 100 --maxConcurrentLoads 16 --serve <socketPath>\n\n" <<
+          "  Serve requests within 200 ms, falling back to the last known result when an engine is still loading:\n" <<
+          "    upe_sample --username <username> --token <token> --serve <socketPath> --requestTimeout 200 --staleResultCacheSize 10000\n\n" <<
+          "  Serve requests from 4 worker processes sharing computed results through shared memory:\n" <<
+          "    upe_sample --username <username> --token <token> --serve <socketPath> --serveProcesses 4 --sharedResultCache /upe_sample_results\n\n" <<
+          "  Time parsing generated MSIP label metadata 10000 times:\n" <<
+          "    upe_sample --benchmarkMetadata 10000\n\n" <<
           endl;
 
       return 0;
@@ -222,11 +298,30 @@ int main_impl(int argc, char* argv[]) {
       return 0;
     }
 
+    if (args.count("benchmarkMetadata")) {
+      int iterations = args["benchmarkMetadata"].as<int>();
+      if (iterations <= 0) {
+        cout << "ERROR: <benchmarkMetadata> must be a positive number" << endl;
+        return -1;
+      }
+      string metadata = args.count("metadata") ? args["metadata"].as<string>() : string();
+      sample::upe::RunMetadataBenchmark(metadata, static_cast<size_t>(iterations), cout);
+      return 0;
+    }
+
     string locale = "en-US";
     if (args.count("locale"))
       locale = args["locale"].as<string>();
 
     SampleActionType actionType = SampleActionType::Invalid;
+    BatchInputType batchInputType = BatchInputType::None;
+    string batchFile;
+    sample::upe::BatchOptions batchOptions;
+    sample::upe::OutputFormat outputFormat = sample::upe::OutputFormat::Text;
+    size_t outputFlushThreshold = sample::upe::OutputSink::kDefaultFlushThreshold;
+    size_t warmUpEngineCount = 0;
+    size_t maxConcurrentLoads = 8;
+    sample::upe::ServerOptions serverOptions;
     sample::upe::AuthenticationOptions auth;
     sample::upe::ProfileOptions profile;
     sample::upe::ExecutionStateOptions executionState;
@@ -235,10 +330,6 @@ int main_impl(int argc, char* argv[]) {
     // Parse required options
     if (args.count("username"))
       auth.username = args["username"].as<string>();
-    if (args.count("contentIdentifier"))
-      executionState.contentIdentifier = args["contentIdentifier"].as<string>();
-    else 
-      executionState.contentIdentifier = "";
 
     // Parse auth options
     if (args.count("password"))
@@ -262,6 +353,126 @@ int main_impl(int argc, char* argv[]) {
       profile.simulatePolicyChange = true;
     if (args.count("engineId"))
       profile.engineId = args["engineId"].as<string>();
+    if (args.count("engineCacheSize")) {
+      int engineCacheSize = args["engineCacheSize"].as<int>();
+      if (engineCacheSize < 1) {
+        cout << "ERROR: Invalid <engineCacheSize> value. Specify a positive number." << endl;
+        return -1;
+      }
+      profile.engineCacheSize = static_cast<size_t>(engineCacheSize);
+    }
+    if (args.count("engineReplicas")) {
+      int engineReplicas = args["engineReplicas"].as<int>();
+      if (engineReplicas < 0) {
+        cout << "ERROR: Invalid <engineReplicas> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.engineReplicas = static_cast<size_t>(engineReplicas);
+    }
+    if (args.count("actionCacheSize")) {
+      int actionCacheSize = args["actionCacheSize"].as<int>();
+      if (actionCacheSize < 0) {
+        cout << "ERROR: Invalid <actionCacheSize> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.actionCacheSize = static_cast<size_t>(actionCacheSize);
+    }
+    if (args.count("labelCacheSize")) {
+      int labelCacheSize = args["labelCacheSize"].as<int>();
+      if (labelCacheSize < 0) {
+        cout << "ERROR: Invalid <labelCacheSize> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.labelCacheSize = static_cast<size_t>(labelCacheSize);
+    }
+    if (args.count("actionCacheMemory")) {
+      int actionCacheMemory = args["actionCacheMemory"].as<int>();
+      if (actionCacheMemory < 1) {
+        cout << "ERROR: Invalid <actionCacheMemory> value. Specify a positive number." << endl;
+        return -1;
+      }
+      profile.actionCacheBytes = static_cast<size_t>(actionCacheMemory) * 1024 * 1024;
+    }
+    if (args.count("reloadQuietPeriod")) {
+      int reloadQuietPeriod = args["reloadQuietPeriod"].as<int>();
+      if (reloadQuietPeriod < 0) {
+        cout << "ERROR: Invalid <reloadQuietPeriod> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.reloadQuietPeriodMs = static_cast<size_t>(reloadQuietPeriod);
+    }
+    if (args.count("reloadMaxDelay")) {
+      int reloadMaxDelay = args["reloadMaxDelay"].as<int>();
+      if (reloadMaxDelay < 0) {
+        cout << "ERROR: Invalid <reloadMaxDelay> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.reloadMaxDelayMs = static_cast<size_t>(reloadMaxDelay);
+    }
+    if (args.count("maxConcurrentReloads")) {
+      int maxConcurrentReloads = args["maxConcurrentReloads"].as<int>();
+      if (maxConcurrentReloads < 1) {
+        cout << "ERROR: Invalid <maxConcurrentReloads> value. Specify a positive number." << endl;
+        return -1;
+      }
+      profile.maxConcurrentReloads = static_cast<size_t>(maxConcurrentReloads);
+    }
+    if (args.count("warmUpEngines")) {
+      int warmUpEngines = args["warmUpEngines"].as<int>();
+      if (warmUpEngines < 0) {
+        cout << "ERROR: Invalid <warmUpEngines> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      if (!profile.useStorageCache) {
+        cout << "ERROR: <warmUpEngines> requires <useStorageCache>." << endl;
+        return -1;
+      }
+      warmUpEngineCount = static_cast<size_t>(warmUpEngines);
+    }
+    if (args.count("maxConcurrentLoads")) {
+      int concurrentLoads = args["maxConcurrentLoads"].as<int>();
+      if (concurrentLoads < 1) {
+        cout << "ERROR: Invalid <maxConcurrentLoads> value. Specify a positive number." << endl;
+        return -1;
+      }
+      maxConcurrentLoads = static_cast<size_t>(concurrentLoads);
+    }
+    if (args.count("precomputeActions"))
+      profile.precomputeActions = true;
+    if (args.count("coalesceRequests"))
+      profile.coalesceRequests = true;
+    if (args.count("requestTimeout")) {
+      int requestTimeout = args["requestTimeout"].as<int>();
+      if (requestTimeout < 0) {
+        cout << "ERROR: Invalid <requestTimeout> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.requestTimeoutMs = static_cast<size_t>(requestTimeout);
+    }
+    if (args.count("staleResultCacheSize")) {
+      int staleResultCacheSize = args["staleResultCacheSize"].as<int>();
+      if (staleResultCacheSize < 0) {
+        cout << "ERROR: Invalid <staleResultCacheSize> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      profile.staleResultCacheSize = static_cast<size_t>(staleResultCacheSize);
+    }
+    if (args.count("sharedResultCache")) {
+      profile.sharedResultCacheName = args["sharedResultCache"].as<string>();
+      if (profile.sharedResultCacheName.size() < 2 || profile.sharedResultCacheName[0] != '/' ||
+          profile.sharedResultCacheName.find('/', 1) != string::npos) {
+        cout << "ERROR: Invalid <sharedResultCache> value. Specify a name starting with '/' and containing no other '/'." << endl;
+        return -1;
+      }
+    }
+    if (args.count("sharedResultCacheSlots")) {
+      int sharedResultCacheSlots = args["sharedResultCacheSlots"].as<int>();
+      if (sharedResultCacheSlots <= 0) {
+        cout << "ERROR: Invalid <sharedResultCacheSlots> value. Specify a positive number." << endl;
+        return -1;
+      }
+      profile.sharedResultCacheSlots = static_cast<size_t>(sharedResultCacheSlots);
+    }
     if (args.count("policyFile")) {
       profile.policyType = sample::upe::PolicyType::File;
       profile.policyFile = args["policyFile"].as<string>();
@@ -283,95 +494,265 @@ int main_impl(int argc, char* argv[]) {
       actionType = SampleActionType::ShowPolicyData;
     } else if (args.count("computeActions")) {
       actionType = SampleActionType::ComputeActions;
+    } else if (args.count("serve")) {
+      actionType = SampleActionType::Serve;
     } else {
       actionType = SampleActionType::Invalid;
     }
 
-    // Parse execution state
-    if (args.count("metadata")) {
-      vector<string> metadataPairs = SplitString(args["metadata"].as<string>(), ',');
-      for (const string& metadataPair : metadataPairs) {
-        vector<string> keyValue = SplitString(metadataPair, '|');
-        executionState.metadata[keyValue[0]] = keyValue[1];
+    // Parse batch options
+    if (args.count("batchFile")) {
+      batchInputType = BatchInputType::File;
+      batchFile = args["batchFile"].as<string>();
+    } else if (args.count("batchStdin")) {
+      batchInputType = BatchInputType::Stdin;
+    }
+    if (args.count("threads")) {
+      int threads = args["threads"].as<int>();
+      if (threads < 1) {
+        cout << "ERROR: Invalid <threads> value. Specify a positive number." << endl;
+        return -1;
       }
+      batchOptions.threadCount = static_cast<size_t>(threads);
+    }
+    if (args.count("pipeline"))
+      batchOptions.isPipelined = true;
+    if (batchInputType != BatchInputType::None)
+      outputFormat = sample::upe::OutputFormat::Ndjson;
+    if (args.count("outputFormat")) {
+      if (!sample::upe::ParseOutputFormat(args["outputFormat"].as<string>(), outputFormat)) {
+        cout << "ERROR: Invalid <outputFormat> value. Choose 'text', 'ndjson', 'binary', or 'encoded'" << endl;
+        return -1;
+      }
+      if (batchInputType != BatchInputType::None &&
+          outputFormat != sample::upe::OutputFormat::Ndjson &&
+          outputFormat != sample::upe::OutputFormat::LengthPrefixed) {
+        cout << "ERROR: Batch input requires <outputFormat> 'ndjson' or 'binary'." << endl;
+        return -1;
+      }
+    }
+    if (args.count("outputFlushBytes")) {
+      int outputFlushBytes = args["outputFlushBytes"].as<int>();
+      if (outputFlushBytes < 1) {
+        cout << "ERROR: Invalid <outputFlushBytes> value. Specify a positive number." << endl;
+        return -1;
+      }
+      outputFlushThreshold = static_cast<size_t>(outputFlushBytes);
+    }
+    if (args.count("serveThreads")) {
+      int serveThreads = args["serveThreads"].as<int>();
+      if (serveThreads < 1) {
+        cout << "ERROR: Invalid <serveThreads> value. Specify a positive number." << endl;
+        return -1;
+      }
+      serverOptions.threadCount = static_cast<size_t>(serveThreads);
+    }
+    if (args.count("serveProcesses")) {
+      int serveProcesses = args["serveProcesses"].as<int>();
+      if (serveProcesses < 0) {
+        cout << "ERROR: Invalid <serveProcesses> value. Specify 0 or a positive number." << endl;
+        return -1;
+      }
+      serverOptions.workerProcesses = static_cast<size_t>(serveProcesses);
+    }
+    if (args.count("interactiveWeight")) {
+      int interactiveWeight = args["interactiveWeight"].as<int>();
+      if (interactiveWeight < 1) {
+        cout << "ERROR: Invalid <interactiveWeight> value. Specify a positive number." << endl;
+        return -1;
+      }
+      serverOptions.scheduler.interactiveWeight = static_cast<size_t>(interactiveWeight);
+    }
+    if (args.count("bulkWeight")) {
+      int bulkWeight = args["bulkWeight"].as<int>();
+      if (bulkWeight < 1) {
+        cout << "ERROR: Invalid <bulkWeight> value. Specify a positive number." << endl;
+        return -1;
+      }
+      serverOptions.scheduler.bulkWeight = static_cast<size_t>(bulkWeight);
+    }
+    if (args.count("maxInteractiveQueue")) {
+      int maxInteractiveQueue = args["maxInteractiveQueue"].as<int>();
+      if (maxInteractiveQueue < 1) {
+        cout << "ERROR: Invalid <maxInteractiveQueue> value. Specify a positive number." << endl;
+        return -1;
+      }
+      serverOptions.scheduler.maxInteractiveQueue = static_cast<size_t>(maxInteractiveQueue);
+    }
+    if (args.count("maxBulkQueue")) {
+      int maxBulkQueue = args["maxBulkQueue"].as<int>();
+      if (maxBulkQueue < 1) {
+        cout << "ERROR: Invalid <maxBulkQueue> value. Specify a positive number." << endl;
+        return -1;
+      }
+      serverOptions.scheduler.maxBulkQueue = static_cast<size_t>(maxBulkQueue);
+    }
+    if (args.count("buildThreads")) {
+      int buildThreads = args["buildThreads"].as<int>();
+      if (buildThreads < 1) {
+        cout << "ERROR: Invalid <buildThreads> value. Specify a positive number." << endl;
+        return -1;
+      }
+      batchOptions.buildThreads = static_cast<size_t>(buildThreads);
+    }
+    if (args.count("serializeThreads")) {
+      int serializeThreads = args["serializeThreads"].as<int>();
+      if (serializeThreads < 1) {
+        cout << "ERROR: Invalid <serializeThreads> value. Specify a positive number." << endl;
+        return -1;
+      }
+      batchOptions.serializeThreads = static_cast<size_t>(serializeThreads);
+    }
+    if (args.count("queueCapacity")) {
+      int queueCapacity = args["queueCapacity"].as<int>();
+      if (queueCapacity < 1) {
+        cout << "ERROR: Invalid <queueCapacity> value. Specify a positive number." << endl;
+        return -1;
+      }
+      batchOptions.queueCapacity = static_cast<size_t>(queueCapacity);
+    }
+    if (args.count("showStats")) {
+      batchOptions.statistics = &std::cerr;
+      serverOptions.statistics = &std::cerr;
+    }
+
+    if (!ValidateOptions(actionType, batchInputType, auth, profile))
+      return -1;
+
+    // Validate the execution state. Only checks that cannot wait on anything run here; the metadata is checked
+    // without being copied and is parsed once the loads have started below.
+    if (args.count("metadata") && !sample::upe::IsValidMetadata(args["metadata"].as<string>())) {
+      cout << "ERROR: Invalid <metadata> value. Use comma-separated 'key|value' pairs, escaping ',', '|' and '\\' " <<
+          "with '\\'" << endl;
+      return -1;
     }
-    if (args.count("newLabelId"))
-      executionState.newLabelId = args["newLabelId"].as<string>();
     if (args.count("assignmentMethod")) {
-      string assignmentMethod = args["assignmentMethod"].as<string>();
-      if (assignmentMethod == "standard") {
-        executionState.assignmentMethod = mip::AssignmentMethod::STANDARD;
-      } else if (assignmentMethod == "privileged") {
-        executionState.assignmentMethod = mip::AssignmentMethod::PRIVILEGED;
-      } else if (assignmentMethod == "auto") {
-        executionState.assignmentMethod = mip::AssignmentMethod::AUTO;
-      } else {
+      if (!sample::upe::ParseAssignmentMethod(args["assignmentMethod"].as<string>(), executionState.assignmentMethod)) {
         cout << "ERROR: Invalid <assignmentMethod> value. Choose 'standard', 'privileged', or 'auto'" << endl;
         return -1;
       }
     }
-    if (args.count("downgradeJustified"))
-      executionState.isDowngradeJustified = true;
-    if (args.count("dowgradeJustification"))
-      executionState.downgradeJustification = args["downgradeJustification"].as<string>();
-    if (args.count("templateId"))
-      executionState.templateId = args["templateId"].as<string>();
     if (args.count("contentFormat")) {
-      string assignmentMethod = args["contentFormat"].as<string>();
-      if (assignmentMethod == "default") {
-        executionState.contentFormat = mip::ContentFormat::DEFAULT;
-      } else if (assignmentMethod == "email") {
-        executionState.contentFormat = mip::ContentFormat::EMAIL;
-      } else {
+      if (!sample::upe::ParseContentFormat(args["contentFormat"].as<string>(), executionState.contentFormat)) {
         cout << "ERROR: Invalid <contentFormat> value. Choose 'default' or 'email'" << endl;
         return -1;
       }
     }
     executionState.dataState = mip::DataState::USE;
     if (args.count("dataState")) {
-      string dataState = args["dataState"].as<string>();
-      if (dataState == "motion") {
-        executionState.dataState = mip::DataState::MOTION;
-      } else if (dataState == "use") {
-        executionState.dataState = mip::DataState::USE;
-      } else if (dataState == "rest") {
-        executionState.dataState = mip::DataState::REST;
-      } else {
+      if (!sample::upe::ParseDataState(args["dataState"].as<string>(), executionState.dataState)) {
         cout << "ERROR: Invalid <dataState> value. Choose 'motion', 'use', or 'rest'" << endl;
         return -1;
       }
     }
 
-    if (!ValidateOptions(actionType, auth, profile))
+    if (batchInputType == BatchInputType::File && !std::ifstream(batchFile)) {
+      cout << "ERROR: Unable to open batch file '" << batchFile << "'" << endl;
       return -1;
+    }
 
-    sample::upe::Action action(auth, profile, locale, upeSampleWorkingDirectory, loadSensitivityTypes);
+    // Startup is pipelined: the profile (and, unless only listing engines, the <username> engine) loads in the background
+    // while the execution state is parsed and the input is opened. Options are validated and the batch file is checked
+    // before, so invalid input fails without waiting on a load. <serialStartup> waits for both first, as earlier versions
+    // did, to compare time-to-first-result with <showStats>.
+    sample::upe::Action action(auth, profile, locale, upeSampleWorkingDirectory, loadSensitivityTypes, startupTimeline);
+    if (actionType != SampleActionType::ListEngines) {
+      if (args.count("serialStartup"))
+        action.GetEngine();
+      else
+        action.LoadEngineInBackground();
+    }
+
+    // Parse execution state
+    if (args.count("contentIdentifier"))
+      executionState.contentIdentifier = args["contentIdentifier"].as<string>();
+    else 
+      executionState.contentIdentifier = "";
+    if (args.count("metadata"))
+      sample::upe::ParseMetadata(args["metadata"].as<string>(), executionState.metadata); // validated above
+    if (args.count("newLabelId"))
+      executionState.newLabelId = args["newLabelId"].as<string>();
+    if (args.count("downgradeJustified"))
+      executionState.isDowngradeJustified = true;
+    if (args.count("dowgradeJustification"))
+      executionState.downgradeJustification = args["downgradeJustification"].as<string>();
+    if (args.count("templateId"))
+      executionState.templateId = args["templateId"].as<string>();
+
+    // A batch file is mapped into memory and parsed in place (read whole on Windows, the part worth overlapping)
+    std::unique_ptr<sample::upe::BatchInput> batchInput;
+    if (batchInputType == BatchInputType::File) {
+      try {
+        batchInput.reset(new sample::upe::BatchInput(batchFile));
+      } catch (const exception& ex) {
+        cout << "ERROR: " << ex.what() << endl;
+        return -1;
+      }
+    } else if (batchInputType == BatchInputType::Stdin) {
+      batchInput.reset(new sample::upe::BatchInput(std::cin));
+    }
+
+    startupTimeline.Record(sample::upe::StartupTimeline::Stage::InputReady);
+
+    if (args.count("warmUpEngines"))
+      action.WarmUpEngines(warmUpEngineCount, maxConcurrentLoads, std::cerr);
+
+#ifdef _WIN32
+    // Length-prefixed frames are raw bytes; a text mode stdout would expand every 0x0A byte in them to CRLF
+    if (outputFormat == sample::upe::OutputFormat::LengthPrefixed ||
+        outputFormat == sample::upe::OutputFormat::Encoded) {
+      cout.flush();
+      _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif // _WIN32
+    sample::upe::OutputSink output(cout, outputFormat, outputFlushThreshold);
+    if (batchInputType != BatchInputType::None) {
+      size_t failures = sample::upe::RunBatch(
+          action,
+          actionType == SampleActionType::ShowLabel ?
+              sample::upe::BatchOperation::ShowLabel : sample::upe::BatchOperation::ComputeActions,
+          executionState,
+          batchOptions,
+          *batchInput,
+          output);
+      if (args.count("showStats"))
+        action.PrintStatistics(std::cerr);
+      return failures == 0 ? 0 : -1;
+    }
 
     switch (actionType) {
     case SampleActionType::ListEngines:
       action.ListEngines();
       break;
     case SampleActionType::ListLabels:
-      action.ListLabels();
+      action.ListLabels(output);
       break;
     case SampleActionType::ListSensitivityTypes:
       action.ListSensitivityTypes();
       break;
     case SampleActionType::ShowDefaultLabel:
-      action.ShowDefaultLabel();
+      action.ShowDefaultLabel(output);
       break;
     case SampleActionType::ShowLabel:
-      action.ShowLabel(executionState);
+      action.ShowLabel(executionState, output);
       break;
     case SampleActionType::ShowPolicyData:
       action.ShowPolicyData();
       break;
     case SampleActionType::ComputeActions:
-      action.ComputeActions(executionState);
+      action.ComputeActions(executionState, output);
+      break;
+    case SampleActionType::Serve:
+      sample::upe::RunServer(action, args["serve"].as<string>(), executionState, serverOptions);
       break;
     default:
       cout << "ERROR - Invalid action type" << endl;
     }
+    output.Flush();
+    startupTimeline.Record(sample::upe::StartupTimeline::Stage::FirstResult);
+
+    if (args.count("showStats"))
+      action.PrintStatistics(std::cerr);
   } catch (const cxxopts::OptionException& ex) {
     cout << "ERROR - Failed to parse options: " << ex.what() << endl;
     return -1;
@@ -0,0 +1,143 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "metadata_benchmark.h"
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "execution_state_parser.h"
+
+using std::endl;
+using std::getline;
+using std::runtime_error;
+using std::string;
+using std::stringstream;
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Label count of the generated metadata, which has 7 pairs per label as MSIP labels do
+const size_t kGeneratedLabelCount = 64;
+
+// The splitting ParseMetadata replaced, only with the missing bounds check added
+vector<string> SplitString(const string& str, char delim) {
+  vector<string> output;
+  stringstream ss(str);
+  string substr;
+
+  while (ss.good()) {
+    getline(ss, substr, delim);
+    output.emplace_back(std::move(substr));
+  }
+
+  return output;
+}
+
+void ParseMetadataBySplitting(const string& value, unordered_map<string, string>& metadata) {
+  vector<string> metadataPairs = SplitString(value, ',');
+  for (const string& metadataPair : metadataPairs) {
+    vector<string> keyValue = SplitString(metadataPair, '|');
+    if (keyValue.size() > 1)
+      metadata[keyValue[0]] = keyValue[1];
+  }
+}
+
+string GenerateMetadata() {
+  static const char* const kSuffixes[] = {"Enabled", "SetDate", "Method", "Name", "SiteId", "ActionId", "ContentBits"};
+
+  string metadata;
+  for (size_t label = 0; label < kGeneratedLabelCount; ++label) {
+    char labelId[40];
+    snprintf(labelId, sizeof(labelId), "%08x-1b2c-4d5e-8f90-%012zx", static_cast<unsigned int>(label * 2654435761u),
+        label);
+    for (const char* suffix : kSuffixes) {
+      if (!metadata.empty())
+        metadata += ',';
+      metadata += "MSIP_Label_";
+      metadata += labelId;
+      metadata += '_';
+      metadata += suffix;
+      metadata += "|value-of-";
+      metadata += suffix;
+    }
+  }
+  return metadata;
+}
+
+// Milliseconds taken to parse 'value' 'iterations' times with 'parse'
+template <typename Parse>
+double TimeParsing(const string& value, size_t iterations, Parse parse) {
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    unordered_map<string, string> metadata;
+    parse(value, metadata);
+  }
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+void RunMetadataBenchmark(const string& metadata, size_t iterations, std::ostream& output) {
+  string value = metadata.empty() ? GenerateMetadata() : metadata;
+  unordered_map<string, string> parsed;
+  if (!ParseMetadata(value, parsed))
+    throw runtime_error("Invalid metadata");
+  if (parsed.empty())
+    throw runtime_error("Metadata holds no 'key|value' pairs to time");
+
+  // Both parsers agree on metadata without escapes
+  unordered_map<string, string> split;
+  ParseMetadataBySplitting(value, split);
+  bool isSame = split == parsed;
+
+  iterations = iterations > 0 ? iterations : 1;
+  double splitting = TimeParsing(value, iterations, ParseMetadataBySplitting);
+  double tokenizing = TimeParsing(value, iterations, [](const string& text, unordered_map<string, string>& pairs) {
+    ParseMetadata(text, pairs); });
+
+  output << "METADATA: " << parsed.size() << " pairs, " << value.size() << " bytes, " << iterations << " iterations" <<
+      (isSame ? "" : " (the parsers disagree on this metadata)") << "\n";
+  output << "  SplitString: " << splitting << " ms, " << splitting * 1e6 / iterations / parsed.size() <<
+      " ns per pair\n";
+  output << "  ParseMetadata: " << tokenizing << " ms, " << tokenizing * 1e6 / iterations / parsed.size() <<
+      " ns per pair (" << splitting / tokenizing << "x)" << endl;
+}
+
+} // namespace sample
+} // namespace upe
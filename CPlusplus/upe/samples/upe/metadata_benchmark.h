@@ -0,0 +1,46 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_METADATA_BENCHMARK_H_
+#define SAMPLES_UPE_METADATA_BENCHMARK_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace sample {
+namespace upe {
+
+// Times parsing the --metadata value 'metadata' 'iterations' times with ParseMetadata and with the stringstream-based
+// splitting it replaced, and prints both to 'output'. An empty 'metadata' is replaced by a generated one holding
+// hundreds of MSIP label pairs. Throws std::runtime_error if 'metadata' is invalid or holds no pairs.
+void RunMetadataBenchmark(const std::string& metadata, size_t iterations, std::ostream& output);
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_METADATA_BENCHMARK_H_
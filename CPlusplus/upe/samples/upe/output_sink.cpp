@@ -0,0 +1,234 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "output_sink.h"
+
+#include <cstring>
+#include <exception>
+
+#include "action_serializer.h"
+#include "result_writer.h"
+
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace {
+
+// Appends "<indent>  <name>: <value>\n"
+void AppendLine(const string& indent, const char* name, const string& value, string& out) {
+  out += indent;
+  out += "  ";
+  out += name;
+  out += ": ";
+  out += value;
+  out += '\n';
+}
+
+void AppendLabelText(const shared_ptr<mip::Label>& label, int indentLevel, string& out) {
+  string indent(indentLevel * 4, ' ');
+
+  out += indent;
+  out += "LABEL:\n";
+  AppendLine(indent, "Id", label->GetId(), out);
+  AppendLine(indent, "Name", label->GetName(), out);
+  AppendLine(indent, "Description", label->GetDescription(), out);
+  AppendLine(indent, "IsActive", label->IsActive() ? "true" : "false", out);
+  AppendLine(indent, "Color", label->GetColor(), out);
+  AppendLine(indent, "Sensitivity", to_string(label->GetSensitivity()), out);
+  AppendLine(indent, "Tooltip", label->GetTooltip(), out);
+
+  shared_ptr<mip::Label> parent = label->GetParent().lock();
+  if (nullptr != parent)
+    AppendLine(indent, "Parent Id", parent->GetId(), out);
+
+  if (!label->GetChildren().empty()) {
+    out += indent;
+    out += "  Children:\n";
+    for (const shared_ptr<mip::Label>& child : label->GetChildren())
+      AppendLabelText(child, indentLevel + 1, out);
+  }
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+bool ParseOutputFormat(const string& value, OutputFormat& format) {
+  if (value == "text")
+    format = OutputFormat::Text;
+  else if (value == "ndjson")
+    format = OutputFormat::Ndjson;
+  else if (value == "binary")
+    format = OutputFormat::LengthPrefixed;
+  else if (value == "encoded")
+    format = OutputFormat::Encoded;
+  else
+    return false;
+  return true;
+}
+
+OutputSink::OutputSink(std::ostream& output, OutputFormat format, size_t flushThreshold)
+    : mOutput(output),
+      mFormat(format),
+      mFlushThreshold(flushThreshold > 0 ? flushThreshold : 1),
+      mRecordStart(string::npos) {
+  mBuffer.reserve(mFlushThreshold);
+}
+
+OutputSink::~OutputSink() {
+  try {
+    Flush();
+  } catch (const std::exception&) {
+    // Nothing left to report the error to
+  }
+}
+
+string& OutputSink::BeginRecord() {
+  if (IsFramed())
+    mBuffer.append(4, '\0'); // filled in by EndRecord
+  mRecordStart = mBuffer.size();
+  return mBuffer;
+}
+
+void OutputSink::EndRecord() {
+  size_t size = mBuffer.size() - mRecordStart;
+  if (IsFramed()) {
+    uint32_t length = static_cast<uint32_t>(size);
+    char* header = &mBuffer[mRecordStart - 4];
+    header[0] = static_cast<char>(length >> 24);
+    header[1] = static_cast<char>(length >> 16);
+    header[2] = static_cast<char>(length >> 8);
+    header[3] = static_cast<char>(length);
+  } else if (mFormat == OutputFormat::Ndjson) {
+    mBuffer += '\n';
+  }
+  mRecordStart = string::npos;
+  ++mStatistics.records;
+
+  if (mBuffer.size() >= mFlushThreshold)
+    WriteBuffer();
+}
+
+bool OutputSink::IsFramed() const {
+  return mFormat == OutputFormat::LengthPrefixed || mFormat == OutputFormat::Encoded;
+}
+
+// Discards the open record, e.g. when formatting it failed
+void OutputSink::AbortRecord() {
+  mBuffer.resize(IsFramed() ? mRecordStart - 4 : mRecordStart);
+  mRecordStart = string::npos;
+}
+
+void OutputSink::WriteRecord(const char* data, size_t size) {
+  BeginRecord().append(data, size);
+  EndRecord();
+}
+
+void OutputSink::WriteLabel(const shared_ptr<mip::Label>& label) {
+  string& out = BeginRecord();
+  try {
+    if (mFormat == OutputFormat::Text)
+      AppendLabelText(label, 0, out);
+    else if (mFormat == OutputFormat::Encoded)
+      mEncoder.EncodeLabels(vector<shared_ptr<mip::Label>>(1, label), out);
+    else
+      AppendLabelJson(label, out);
+  } catch (...) {
+    AbortRecord();
+    throw;
+  }
+  EndRecord();
+}
+
+void OutputSink::WriteDefaultLabel(const shared_ptr<mip::Label>& label) {
+  if (nullptr != label) {
+    WriteLabel(label);
+  } else if (mFormat == OutputFormat::Encoded) {
+    mEncoder.EncodeLabels(vector<shared_ptr<mip::Label>>(), BeginRecord());
+    EndRecord();
+  } else {
+    const char* text = mFormat == OutputFormat::Text ? "NO DEFAULT LABEL\n" : "null";
+    WriteRecord(text, strlen(text));
+  }
+}
+
+void OutputSink::WriteContentLabel(const shared_ptr<mip::ContentLabel>& label) {
+  if (mFormat == OutputFormat::Text) {
+    if (nullptr != label)
+      WriteLabel(label->GetLabel());
+    else
+      WriteRecord("NO LABEL\n", 9);
+    return;
+  }
+
+  string& out = BeginRecord();
+  try {
+    if (mFormat == OutputFormat::Encoded)
+      mEncoder.EncodeContentLabel(label, out);
+    else
+      AppendContentLabelJson(label, out);
+  } catch (...) {
+    AbortRecord();
+    throw;
+  }
+  EndRecord();
+}
+
+void OutputSink::WriteActions(const vector<shared_ptr<mip::Action>>& actions) {
+  string& out = BeginRecord();
+  try {
+    if (mFormat == OutputFormat::Text)
+      AppendActionsText(actions, out);
+    else if (mFormat == OutputFormat::Encoded)
+      mEncoder.EncodeActions(actions, out);
+    else
+      AppendActionsJson(actions, out);
+  } catch (...) {
+    AbortRecord();
+    throw;
+  }
+  EndRecord();
+}
+
+void OutputSink::Flush() {
+  if (!mBuffer.empty())
+    WriteBuffer();
+  mOutput.flush();
+}
+
+void OutputSink::WriteBuffer() {
+  mOutput.write(mBuffer.data(), mBuffer.size());
+  mStatistics.bytes += mBuffer.size();
+  ++mStatistics.writes;
+  mBuffer.clear(); // keeps its capacity
+}
+
+} // namespace sample
+} // namespace upe
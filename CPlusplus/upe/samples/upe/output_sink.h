@@ -0,0 +1,114 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_OUTPUT_SINK_H_
+#define SAMPLES_UPE_OUTPUT_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mip/upe/action.h"
+#include "mip/upe/content_label.h"
+#include "mip/upe/label.h"
+
+#include "result_encoding.h"
+
+namespace sample {
+namespace upe {
+
+enum class OutputFormat {
+  Text,           // human-readable, as printed by earlier versions
+  Ndjson,         // one JSON value per line (see result_writer.h)
+  LengthPrefixed, // each JSON value preceded by its length as a 4-byte big-endian integer
+  Encoded,        // each result in the encoding of result_encoding.h, framed as LengthPrefixed
+};
+
+// Parses 'text', 'ndjson', 'binary' or 'encoded'. Returns false and leaves 'format' unchanged for anything else.
+bool ParseOutputFormat(const std::string& value, OutputFormat& format);
+
+// Formats results into one reusable buffer and writes it to the stream in large chunks: whenever the buffer exceeds
+// the flush threshold, and on Flush() (e.g. once per batch) or destruction. Only Flush() flushes the stream itself.
+//
+// Records are written as is in Text format, followed by a newline as NDJSON and framed by their length when
+// LengthPrefixed or Encoded. Not thread-safe; concurrent producers serialize their records themselves and write them in order.
+class OutputSink {
+public:
+  static const size_t kDefaultFlushThreshold = 1024 * 1024;
+
+  struct Statistics {
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    uint64_t writes = 0; // writes to the stream
+  };
+
+  OutputSink(std::ostream& output, OutputFormat format, size_t flushThreshold = kDefaultFlushThreshold);
+  ~OutputSink();
+
+  OutputFormat GetFormat() const { return mFormat; }
+
+  // Starts a record and returns the buffer to append its content to, which stays valid until EndRecord(). The buffer
+  // also holds earlier records, so callers only ever append to it.
+  std::string& BeginRecord();
+  void EndRecord();
+  void WriteRecord(const char* data, size_t size);
+
+  // One record per label, content label (or its absence) and set of actions. When Encoded, a label is written as a
+  // Labels result holding it, and a missing default label as one holding no label.
+  void WriteLabel(const std::shared_ptr<mip::Label>& label);
+  void WriteDefaultLabel(const std::shared_ptr<mip::Label>& label);
+  void WriteContentLabel(const std::shared_ptr<mip::ContentLabel>& label);
+  void WriteActions(const std::vector<std::shared_ptr<mip::Action>>& actions);
+
+  void Flush();
+
+  Statistics GetStatistics() const { return mStatistics; }
+
+private:
+  OutputSink(const OutputSink&);
+  OutputSink& operator=(const OutputSink&);
+
+  bool IsFramed() const;
+  void AbortRecord();
+  void WriteBuffer();
+
+  std::ostream& mOutput;
+  const OutputFormat mFormat;
+  const size_t mFlushThreshold;
+  std::string mBuffer;
+  size_t mRecordStart; // of the open record's content, or npos
+  Statistics mStatistics;
+  ResultEncoder mEncoder;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_OUTPUT_SINK_H_
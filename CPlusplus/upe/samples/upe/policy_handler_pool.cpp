@@ -0,0 +1,120 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "policy_handler_pool.h"
+
+#include <stdexcept>
+#include <utility>
+
+using std::lock_guard;
+using std::move;
+using std::mutex;
+using std::runtime_error;
+using std::shared_ptr;
+
+namespace sample {
+namespace upe {
+
+PolicyHandlerPool::Lease::Lease(
+    PolicyHandlerPool* pool,
+    shared_ptr<mip::PolicyHandler> handler,
+    bool isAuditDiscoveryEnabled,
+    uint64_t generation)
+    : mPool(pool),
+      mHandler(move(handler)),
+      mIsAuditDiscoveryEnabled(isAuditDiscoveryEnabled),
+      mGeneration(generation) {}
+
+PolicyHandlerPool::Lease::Lease(Lease&& other)
+    : mPool(other.mPool),
+      mHandler(move(other.mHandler)),
+      mIsAuditDiscoveryEnabled(other.mIsAuditDiscoveryEnabled),
+      mGeneration(other.mGeneration) {
+  other.mPool = nullptr;
+}
+
+PolicyHandlerPool::Lease::~Lease() {
+  if (nullptr != mPool && nullptr != mHandler)
+    mPool->Release(move(mHandler), mIsAuditDiscoveryEnabled, mGeneration);
+}
+
+PolicyHandlerPool::PolicyHandlerPool(size_t maxIdlePerKey)
+    : mMaxIdlePerKey(maxIdlePerKey),
+      mGeneration(0) {}
+
+void PolicyHandlerPool::Reset(const shared_ptr<mip::PolicyEngine>& engine) {
+  lock_guard<mutex> lock(mMutex);
+  if (engine == mEngine)
+    return;
+
+  mEngine = engine;
+  ++mGeneration;
+  if (!mIdleHandlers[0].empty() || !mIdleHandlers[1].empty())
+    ++mStatistics.invalidations;
+  mIdleHandlers[0].clear();
+  mIdleHandlers[1].clear();
+}
+
+PolicyHandlerPool::Lease PolicyHandlerPool::Acquire(bool isAuditDiscoveryEnabled) {
+  shared_ptr<mip::PolicyEngine> engine;
+  uint64_t generation;
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto& idleHandlers = mIdleHandlers[isAuditDiscoveryEnabled ? 1 : 0];
+    if (!idleHandlers.empty()) {
+      shared_ptr<mip::PolicyHandler> handler = move(idleHandlers.back());
+      idleHandlers.pop_back();
+      ++mStatistics.hits;
+      return Lease(this, move(handler), isAuditDiscoveryEnabled, mGeneration);
+    }
+
+    if (nullptr == mEngine)
+      throw runtime_error("PolicyHandlerPool has no engine");
+    ++mStatistics.misses;
+    engine = mEngine;
+    generation = mGeneration;
+  }
+
+  // Handler construction is the cost being pooled, so it happens outside the lock
+  return Lease(this, engine->CreatePolicyHandler(isAuditDiscoveryEnabled), isAuditDiscoveryEnabled, generation);
+}
+
+PolicyHandlerPool::Statistics PolicyHandlerPool::GetStatistics() const {
+  lock_guard<mutex> lock(mMutex);
+  return mStatistics;
+}
+
+void PolicyHandlerPool::Release(shared_ptr<mip::PolicyHandler>&& handler, bool isAuditDiscoveryEnabled,
+    uint64_t generation) {
+  lock_guard<mutex> lock(mMutex);
+  auto& idleHandlers = mIdleHandlers[isAuditDiscoveryEnabled ? 1 : 0];
+  if (generation == mGeneration && idleHandlers.size() < mMaxIdlePerKey)
+    idleHandlers.push_back(move(handler));
+}
+
+} // namespace sample
+} // namespace upe
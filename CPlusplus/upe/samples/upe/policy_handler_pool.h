@@ -0,0 +1,108 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_POLICY_HANDLER_POOL_H_
+#define SAMPLES_UPE_POLICY_HANDLER_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mip/upe/policy_engine.h"
+#include "mip/upe/policy_handler.h"
+
+namespace sample {
+namespace upe {
+
+// Hands out idle PolicyHandlers created from the current engine instead of creating one per request. Handlers are
+// pooled separately for each isAuditDiscoveryEnabled value. Resetting the pool to a new engine (e.g. after a policy
+// change) drops every idle handler, and handlers leased from the old engine are discarded when they are returned.
+class PolicyHandlerPool {
+public:
+  struct Statistics {
+    uint64_t hits = 0;    // leases served by an idle handler
+    uint64_t misses = 0;  // leases that had to create a handler
+    uint64_t invalidations = 0;
+
+    double GetHitRate() const {
+      return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+    }
+  };
+
+  // A handler on loan from the pool, returned when the lease is destroyed
+  class Lease {
+  public:
+    Lease(Lease&& other);
+    ~Lease();
+
+    mip::PolicyHandler* operator->() const { return mHandler.get(); }
+
+  private:
+    friend class PolicyHandlerPool;
+    Lease(PolicyHandlerPool* pool, std::shared_ptr<mip::PolicyHandler> handler, bool isAuditDiscoveryEnabled,
+        uint64_t generation);
+    Lease(const Lease&);
+    Lease& operator=(const Lease&);
+
+    PolicyHandlerPool* mPool;
+    std::shared_ptr<mip::PolicyHandler> mHandler;
+    bool mIsAuditDiscoveryEnabled;
+    uint64_t mGeneration;
+  };
+
+  explicit PolicyHandlerPool(size_t maxIdlePerKey = 64);
+
+  // Replaces the engine handlers are created from and drops every idle handler
+  void Reset(const std::shared_ptr<mip::PolicyEngine>& engine);
+
+  // Leases an idle handler for 'isAuditDiscoveryEnabled', creating one if none is idle. Throws std::runtime_error if
+  // the pool has no engine.
+  Lease Acquire(bool isAuditDiscoveryEnabled);
+
+  Statistics GetStatistics() const;
+
+  // So that a forked process never inherits the pool mid-update (see Action::PrepareFork)
+  void LockForFork() { mMutex.lock(); }
+  void UnlockAfterFork() { mMutex.unlock(); }
+
+private:
+  void Release(std::shared_ptr<mip::PolicyHandler>&& handler, bool isAuditDiscoveryEnabled, uint64_t generation);
+
+  mutable std::mutex mMutex;
+  std::shared_ptr<mip::PolicyEngine> mEngine;
+  std::vector<std::shared_ptr<mip::PolicyHandler>> mIdleHandlers[2];
+  size_t mMaxIdlePerKey;
+  uint64_t mGeneration;
+  Statistics mStatistics;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_POLICY_HANDLER_POOL_H_
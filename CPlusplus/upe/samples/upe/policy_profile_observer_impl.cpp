@@ -27,16 +27,22 @@
 
 #include "policy_profile_observer_impl.h"
 
-#include <future>
+#include "completion_token.h"
 
 using std::exception_ptr;
 using std::move;
-using std::promise;
 using std::shared_ptr;
 using std::static_pointer_cast;
 using std::string;
 using std::vector;
 
+namespace {
+
+thread_local sample::upe::PolicyProfileObserverImpl::PolicyFetch tPolicyFetch =
+    sample::upe::PolicyProfileObserverImpl::PolicyFetch::Unknown;
+
+} // namespace
+
 namespace sample {
 namespace upe {
 
@@ -44,55 +50,59 @@ PolicyProfileObserverImpl::PolicyProfileObserverImpl(std::function<void(const st
     : mPolicyChangedHandler(move(policyChangedHandler)) {}
 
 void PolicyProfileObserverImpl::OnLoadSuccess(const shared_ptr<mip::PolicyProfile>& profile, const shared_ptr<void>& context) {
-  auto loadPromise = static_pointer_cast<promise<shared_ptr<mip::PolicyProfile>>>(context);
-  loadPromise->set_value(profile);
+  static_pointer_cast<CompletionToken<shared_ptr<mip::PolicyProfile>>>(context)->Complete(profile);
 }
 
 void PolicyProfileObserverImpl::OnLoadFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto loadPromise = static_pointer_cast<promise<shared_ptr<mip::PolicyProfile>>>(context);
-  loadPromise->set_exception(error);
+  static_pointer_cast<CompletionToken<shared_ptr<mip::PolicyProfile>>>(context)->Fail(error);
 }
 
 void PolicyProfileObserverImpl::OnListEnginesSuccess(const vector<string>& engineIds, const shared_ptr<void>& context) {
-  auto listEnginesPromise = static_pointer_cast<promise<vector<string>>>(context);
-  listEnginesPromise->set_value(engineIds);
+  static_pointer_cast<CompletionToken<vector<string>>>(context)->Complete(engineIds);
 }
 
 void PolicyProfileObserverImpl::OnListEnginesFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto listEnginesPromise = static_pointer_cast<promise<vector<string>>>(context);
-  listEnginesPromise->set_exception(error);
+  static_pointer_cast<CompletionToken<vector<string>>>(context)->Fail(error);
 }
 
 void PolicyProfileObserverImpl::OnUnloadEngineSuccess(const shared_ptr<void>& context) {
-  auto unloadEnginePromise = static_pointer_cast<promise<void>>(context);
-  unloadEnginePromise->set_value();
+  static_pointer_cast<CompletionToken<NoResult>>(context)->Complete(NoResult());
 }
 
 void PolicyProfileObserverImpl::OnUnloadEngineFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto unloadEnginePromise = static_pointer_cast<promise<void>>(context);
-  unloadEnginePromise->set_exception(error);
+  static_pointer_cast<CompletionToken<NoResult>>(context)->Fail(error);
+}
+
+PolicyProfileObserverImpl::PolicyFetch PolicyProfileObserverImpl::GetPolicyFetchOnThisThread() {
+  return tPolicyFetch;
+}
+
+void PolicyProfileObserverImpl::ForgetPolicyFetchOnThisThread() {
+  tPolicyFetch = PolicyFetch::Unknown;
+}
+
+void PolicyProfileObserverImpl::OnAddEngineStarting(bool requiresPolicyFetch) {
+  tPolicyFetch = requiresPolicyFetch ? PolicyFetch::Required : PolicyFetch::NotRequired;
 }
 
 void PolicyProfileObserverImpl::OnAddEngineSuccess(
     const shared_ptr<mip::PolicyEngine>& engine,
     const shared_ptr<void>& context) {
-  auto addEnginePromise = static_pointer_cast<promise<shared_ptr<mip::PolicyEngine>>>(context);
-  addEnginePromise->set_value(engine);
+  static_pointer_cast<CompletionToken<shared_ptr<mip::PolicyEngine>>>(context)->Complete(engine);
+  tPolicyFetch = PolicyFetch::Unknown;
 }
 
 void PolicyProfileObserverImpl::OnAddEngineFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto addEnginePromise = static_pointer_cast<promise<shared_ptr<mip::PolicyEngine>>>(context);
-  addEnginePromise->set_exception(error);
+  static_pointer_cast<CompletionToken<shared_ptr<mip::PolicyEngine>>>(context)->Fail(error);
+  tPolicyFetch = PolicyFetch::Unknown;
 }
 
 void PolicyProfileObserverImpl::OnDeleteEngineSuccess(const shared_ptr<void>& context) {
-  auto deleteEnginePromise = static_pointer_cast<promise<void>>(context);
-  deleteEnginePromise->set_value();
+  static_pointer_cast<CompletionToken<NoResult>>(context)->Complete(NoResult());
 }
 
 void PolicyProfileObserverImpl::OnDeleteEngineFailure(const exception_ptr& error, const shared_ptr<void>& context) {
-  auto deleteEnginePromise = static_pointer_cast<promise<void>>(context);
-  deleteEnginePromise->set_exception(error);
+  static_pointer_cast<CompletionToken<NoResult>>(context)->Fail(error);
 }
 
 void PolicyProfileObserverImpl::OnPolicyChanged(const string& engineId) {
@@ -36,10 +36,25 @@
 namespace sample {
 namespace upe {
 
+// Completes the CompletionToken every PolicyProfile async operation is started with (see AsyncProfileOperations) and
+// forwards policy change notifications to 'policyChangedHandler'
 class PolicyProfileObserverImpl final : public mip::PolicyProfile::Observer {
 public:
+  enum class PolicyFetch {
+    Unknown,
+    Required, // policy is being fetched from the server
+    NotRequired, // engine is created from locally cached policy
+  };
+
   PolicyProfileObserverImpl(std::function<void(const std::string&)>&& policyChangedHandler);
 
+  // What OnAddEngineStarting reported for the engine being added on the calling thread. OnAddEngineStarting carries no
+  // context, so an AddEngineAsync continuation (which runs inside OnAddEngineSuccess/OnAddEngineFailure) uses this to
+  // learn whether its engine's policy was fetched. Unknown if the SDK reported it on another thread, or if it was
+  // forgotten because other engines were being added at the same time (see AsyncProfileOperations::AddEngine).
+  static PolicyFetch GetPolicyFetchOnThisThread();
+  static void ForgetPolicyFetchOnThisThread();
+
   virtual void OnLoadSuccess(
       const std::shared_ptr<mip::PolicyProfile>& profile,
       const std::shared_ptr<void>& context) override;
@@ -57,6 +72,7 @@ public:
   virtual void OnUnloadEngineSuccess(const std::shared_ptr<void>& context) override;
   virtual void OnUnloadEngineFailure(const std::exception_ptr& error, const std::shared_ptr<void>& context) override;
 
+  virtual void OnAddEngineStarting(bool requiresPolicyFetch) override;
   virtual void OnAddEngineSuccess(
       const std::shared_ptr<mip::PolicyEngine>& engine,
       const std::shared_ptr<void>& context) override;
@@ -0,0 +1,199 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_PRIORITY_SCHEDULER_H_
+#define SAMPLES_UPE_PRIORITY_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace sample {
+namespace upe {
+
+enum class RequestLane {
+  Interactive = 0, // latency sensitive, e.g. a user waiting on a label
+  Bulk = 1,        // throughput work, e.g. relabeling a whole store
+  Count,
+};
+
+struct SchedulerOptions {
+  // While both lanes have requests waiting, workers start this many interactive requests per 'bulkWeight' bulk ones.
+  // A lane with nothing waiting leaves its share to the other.
+  size_t interactiveWeight = 4;
+  size_t bulkWeight = 1;
+  // Requests arriving while this many of their lane are already waiting are rejected with a retry delay
+  size_t maxInteractiveQueue = 1024;
+  size_t maxBulkQueue = 256;
+};
+
+// Hands items from two lanes to a fixed set of workers using weighted round robin, and rejects items once their lane's
+// queue is full so an overloaded lane fails fast rather than building an unbounded backlog.
+template<typename Item>
+class PriorityScheduler {
+public:
+  struct LaneStatistics {
+    uint64_t admitted = 0;
+    uint64_t rejected = 0;
+    size_t maxDepth = 0; // most items waiting at once
+  };
+
+  PriorityScheduler(const SchedulerOptions& options, size_t workerCount)
+      : mWorkerCount(workerCount > 0 ? workerCount : 1),
+        mIsClosed(false) {
+    mLanes[Index(RequestLane::Interactive)].weight = options.interactiveWeight > 0 ? options.interactiveWeight : 1;
+    mLanes[Index(RequestLane::Interactive)].maxDepth = options.maxInteractiveQueue;
+    mLanes[Index(RequestLane::Bulk)].weight = options.bulkWeight > 0 ? options.bulkWeight : 1;
+    mLanes[Index(RequestLane::Bulk)].maxDepth = options.maxBulkQueue;
+  }
+
+  size_t GetWeight(RequestLane lane) const { return mLanes[Index(lane)].weight; }
+
+  // Queues the item, or returns false and sets 'retryAfter' to roughly how long the lane's backlog takes to drain
+  bool TryPush(RequestLane lane, Item item, std::chrono::milliseconds& retryAfter) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      Lane& queue = mLanes[Index(lane)];
+      if (queue.items.size() >= queue.maxDepth) {
+        ++queue.statistics.rejected;
+        retryAfter = EstimateDrainTime(lane);
+        return false;
+      }
+      queue.items.push_back(std::move(item));
+      ++queue.statistics.admitted;
+      if (queue.items.size() > queue.statistics.maxDepth)
+        queue.statistics.maxDepth = queue.items.size();
+    }
+    mItemAvailable.notify_one();
+    return true;
+  }
+
+  // Waits for the next item. Returns false once the scheduler is closed.
+  bool Pop(Item& item, RequestLane& lane) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mItemAvailable.wait(lock, [this] { return mIsClosed || HasItems(); });
+    if (mIsClosed)
+      return false;
+
+    Lane& interactive = mLanes[Index(RequestLane::Interactive)];
+    Lane& bulk = mLanes[Index(RequestLane::Bulk)];
+    if (bulk.items.empty()) {
+      lane = RequestLane::Interactive;
+    } else if (interactive.items.empty()) {
+      lane = RequestLane::Bulk;
+    } else {
+      // Both waiting: spend each lane's credits, then start a new round
+      if (interactive.credits == 0 && bulk.credits == 0) {
+        interactive.credits = interactive.weight;
+        bulk.credits = bulk.weight;
+      }
+      lane = interactive.credits > 0 ? RequestLane::Interactive : RequestLane::Bulk;
+      --mLanes[Index(lane)].credits;
+    }
+
+    Lane& queue = mLanes[Index(lane)];
+    item = std::move(queue.items.front());
+    queue.items.pop_front();
+    return true;
+  }
+
+  // Reports how long a worker spent on an item of 'lane', for estimating retry delays
+  void RecordServiceTime(RequestLane lane, std::chrono::steady_clock::duration serviceTime) {
+    double microseconds = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::microseconds>(serviceTime).count());
+    std::lock_guard<std::mutex> lock(mMutex);
+    Lane& queue = mLanes[Index(lane)];
+    queue.averageServiceMicroseconds = queue.averageServiceMicroseconds == 0.0 ?
+        microseconds : queue.averageServiceMicroseconds * 0.9 + microseconds * 0.1;
+  }
+
+  // Wakes every worker. Items still queued are dropped.
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mIsClosed = true;
+      for (Lane& queue : mLanes)
+        queue.items.clear();
+    }
+    mItemAvailable.notify_all();
+  }
+
+  LaneStatistics GetStatistics(RequestLane lane) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mLanes[Index(lane)].statistics;
+  }
+
+private:
+  struct Lane {
+    size_t weight = 1;
+    size_t maxDepth = 0;
+    size_t credits = 0;
+    double averageServiceMicroseconds = 0.0;
+    std::deque<Item> items;
+    LaneStatistics statistics;
+  };
+
+  PriorityScheduler(const PriorityScheduler&);
+  PriorityScheduler& operator=(const PriorityScheduler&);
+
+  static size_t Index(RequestLane lane) { return static_cast<size_t>(lane); }
+
+  bool HasItems() const {
+    for (const Lane& queue : mLanes) {
+      if (!queue.items.empty())
+        return true;
+    }
+    return false;
+  }
+
+  // Time for the lane's waiting items to be served at its recent service time (1 ms until one is recorded), assuming the
+  // other lane is busy too so the lane only gets its weighted share of the workers. At least 1 ms.
+  std::chrono::milliseconds EstimateDrainTime(RequestLane lane) const {
+    const Lane& queue = mLanes[Index(lane)];
+    size_t totalWeight = 0;
+    for (const Lane& other : mLanes)
+      totalWeight += other.weight;
+    double workers = static_cast<double>(mWorkerCount) * queue.weight / totalWeight;
+    double serviceMilliseconds = queue.averageServiceMicroseconds > 0.0 ? queue.averageServiceMicroseconds / 1000.0 : 1.0;
+    double milliseconds = queue.items.size() * serviceMilliseconds / workers;
+    return std::chrono::milliseconds(milliseconds < 1.0 ? 1 : static_cast<int64_t>(milliseconds + 0.5));
+  }
+
+  const size_t mWorkerCount;
+  mutable std::mutex mMutex;
+  std::condition_variable mItemAvailable;
+  Lane mLanes[static_cast<size_t>(RequestLane::Count)];
+  bool mIsClosed;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_PRIORITY_SCHEDULER_H_
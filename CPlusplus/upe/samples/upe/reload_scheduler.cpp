@@ -0,0 +1,173 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "reload_scheduler.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+using std::exception;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+
+namespace sample {
+namespace upe {
+
+ReloadScheduler::ReloadScheduler(
+    std::chrono::milliseconds quietPeriod,
+    std::chrono::milliseconds maxDelay,
+    size_t maxConcurrentReloads,
+    ReloadFunction reload)
+    : mQuietPeriod(quietPeriod),
+      mMaxDelay(std::max(quietPeriod, maxDelay)),
+      mReload(std::move(reload)),
+      mIsFlushing(false),
+      mIsPaused(false),
+      mIsStopping(false) {
+  size_t threadCount = std::max<size_t>(maxConcurrentReloads, 1);
+  for (size_t i = 0; i < threadCount; ++i)
+    mThreads.emplace_back(&ReloadScheduler::ReloadLoop, this);
+}
+
+ReloadScheduler::~ReloadScheduler() {
+  Shutdown();
+}
+
+void ReloadScheduler::Schedule(const string& engineId) {
+  lock_guard<mutex> lock(mMutex);
+  if (mIsStopping)
+    return;
+
+  ++mStatistics.notifications;
+  Clock::time_point now = Clock::now();
+  auto it = mPendingReloads.find(engineId);
+  if (it != mPendingReloads.end()) {
+    ++mStatistics.coalesced;
+    it->second.lastNotification = now;
+  } else {
+    PendingReload pendingReload;
+    pendingReload.firstNotification = now;
+    pendingReload.lastNotification = now;
+    mPendingReloads[engineId] = pendingReload;
+  }
+  mStateChanged.notify_all();
+}
+
+void ReloadScheduler::Flush() {
+  unique_lock<mutex> lock(mMutex);
+  mIsFlushing = true;
+  mStateChanged.notify_all();
+  mStateChanged.wait(lock, [this] { return mIsStopping || (mPendingReloads.empty() && mRunningReloads.empty()); });
+  mIsFlushing = false;
+}
+
+void ReloadScheduler::Shutdown() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mIsStopping)
+      return;
+    mIsStopping = true;
+    mPendingReloads.clear();
+  }
+  mStateChanged.notify_all();
+
+  for (std::thread& thread : mThreads)
+    thread.join();
+}
+
+void ReloadScheduler::Pause() {
+  unique_lock<mutex> lock(mMutex);
+  mIsPaused = true;
+  mStateChanged.wait(lock, [this] { return mRunningReloads.empty(); });
+}
+
+void ReloadScheduler::Resume() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mIsPaused = false;
+  }
+  mStateChanged.notify_all();
+}
+
+ReloadScheduler::Statistics ReloadScheduler::GetStatistics() const {
+  lock_guard<mutex> lock(mMutex);
+  return mStatistics;
+}
+
+ReloadScheduler::Clock::time_point ReloadScheduler::GetDueTime(const PendingReload& pendingReload) const {
+  if (mIsFlushing)
+    return Clock::time_point::min();
+  return std::min(pendingReload.lastNotification + mQuietPeriod, pendingReload.firstNotification + mMaxDelay);
+}
+
+// Each thread runs one reload at a time, which bounds the number of concurrent reloads by the number of threads
+void ReloadScheduler::ReloadLoop() {
+  unique_lock<mutex> lock(mMutex);
+  while (!mIsStopping) {
+    // Find the pending reload due first, skipping engines that are still reloading from an earlier notification
+    auto next = mPendingReloads.end();
+    Clock::time_point nextDueTime = Clock::time_point::max();
+    for (auto it = mPendingReloads.begin(); it != mPendingReloads.end(); ++it) {
+      Clock::time_point dueTime = GetDueTime(it->second);
+      if (mRunningReloads.count(it->first) == 0 && dueTime < nextDueTime) {
+        next = it;
+        nextDueTime = dueTime;
+      }
+    }
+
+    if (next == mPendingReloads.end() || mIsPaused) {
+      mStateChanged.wait(lock);
+      continue;
+    }
+    if (nextDueTime > Clock::now()) {
+      mStateChanged.wait_until(lock, nextDueTime);
+      continue;
+    }
+
+    string engineId = next->first;
+    mPendingReloads.erase(next);
+    mRunningReloads.insert(engineId);
+    ++mStatistics.reloads;
+
+    lock.unlock();
+    try {
+      mReload(engineId);
+    } catch (const exception&) {
+      // The reload function reports its own failures; a later notification retries
+    }
+    lock.lock();
+
+    mRunningReloads.erase(engineId);
+    mStateChanged.notify_all();
+  }
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,119 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_RELOAD_SCHEDULER_H_
+#define SAMPLES_UPE_RELOAD_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace sample {
+namespace upe {
+
+// Runs engine reloads requested by policy change notifications on background threads, collapsing bursts of
+// notifications. A reload for an engine id starts once no further notification for it arrived during 'quietPeriod',
+// but no later than 'maxDelay' after the first notification of the burst. Notifications arriving while the engine is
+// being reloaded are coalesced into one follow-up reload. At most 'maxConcurrentReloads' engines reload at once.
+class ReloadScheduler {
+public:
+  struct Statistics {
+    uint64_t notifications = 0;
+    uint64_t coalesced = 0; // notifications folded into a reload that was already pending
+    uint64_t reloads = 0;
+  };
+
+  typedef std::function<void(const std::string& engineId)> ReloadFunction;
+
+  ReloadScheduler(
+      std::chrono::milliseconds quietPeriod,
+      std::chrono::milliseconds maxDelay,
+      size_t maxConcurrentReloads,
+      ReloadFunction reload);
+  ~ReloadScheduler();
+
+  // Requests a reload of 'engineId'. Ignored after Shutdown().
+  void Schedule(const std::string& engineId);
+
+  // Starts every pending reload without waiting for its quiet period and blocks until no reload is pending or running
+  void Flush();
+
+  // Drops pending reloads, waits for running ones and stops the reload threads
+  void Shutdown();
+
+  // Pause keeps pending reloads from starting and waits for running ones; notifications are still collected. Resume
+  // starts those due.
+  void Pause();
+  void Resume();
+
+  // Held across fork() so that no notification is being recorded when the process is copied (see Action::PrepareFork)
+  void LockForFork() { mMutex.lock(); }
+  void UnlockAfterFork() { mMutex.unlock(); }
+
+  Statistics GetStatistics() const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct PendingReload {
+    Clock::time_point firstNotification;
+    Clock::time_point lastNotification;
+  };
+
+  ReloadScheduler(const ReloadScheduler&);
+  ReloadScheduler& operator=(const ReloadScheduler&);
+
+  void ReloadLoop();
+  Clock::time_point GetDueTime(const PendingReload& pendingReload) const;
+
+  const std::chrono::milliseconds mQuietPeriod;
+  const std::chrono::milliseconds mMaxDelay;
+  ReloadFunction mReload;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mStateChanged;
+  std::unordered_map<std::string, PendingReload> mPendingReloads;
+  std::set<std::string> mRunningReloads;
+  bool mIsFlushing;
+  bool mIsPaused;
+  bool mIsStopping;
+  Statistics mStatistics;
+  std::vector<std::thread> mThreads;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_RELOAD_SCHEDULER_H_
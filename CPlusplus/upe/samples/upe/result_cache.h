@@ -0,0 +1,163 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_RESULT_CACHE_H_
+#define SAMPLES_UPE_RESULT_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace sample {
+namespace upe {
+
+// Thread-safe LRU cache of computed results, bounded both by entry count and by an approximate byte size supplied by
+// the caller for each value. Clear() drops every entry and starts a new generation; results computed under an older
+// generation are silently not inserted, so a result derived from a replaced policy can never reappear.
+template <typename Value>
+class ResultCache {
+public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t clears = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+  };
+
+  ResultCache(size_t maxEntries, size_t maxBytes)
+      : mMaxEntries(maxEntries),
+        mMaxBytes(maxBytes),
+        mBytes(0),
+        mGeneration(0) {}
+
+  bool IsEnabled() const { return mMaxEntries > 0 && mMaxBytes > 0; }
+
+  // Generation to pass to Insert. Read it before fetching whatever the result will be computed from, so that a Clear()
+  // issued after that input was replaced also discards the result.
+  uint64_t GetGeneration() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mGeneration;
+  }
+
+  // Looks up 'key', copying the cached result to 'value' on a hit
+  bool Find(const std::string& key, Value& value) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntriesByKey.find(key);
+    if (it == mEntriesByKey.end()) {
+      ++mStatistics.misses;
+      return false;
+    }
+
+    ++mStatistics.hits;
+    mEntries.splice(mEntries.begin(), mEntries, it->second);
+    value = it->second->value;
+    return true;
+  }
+
+  void Insert(const std::string& key, const Value& value, size_t valueBytes, uint64_t generation) {
+    size_t bytes = key.size() + valueBytes + kEntryOverhead;
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!IsEnabled() || generation != mGeneration || bytes > mMaxBytes)
+      return;
+
+    auto it = mEntriesByKey.find(key);
+    if (it != mEntriesByKey.end()) {
+      mBytes -= it->second->bytes;
+      mEntries.erase(it->second);
+      mEntriesByKey.erase(it);
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.value = value;
+    entry.bytes = bytes;
+    mEntries.push_front(std::move(entry));
+    mEntriesByKey[key] = mEntries.begin();
+    mBytes += bytes;
+
+    while (mEntries.size() > mMaxEntries || mBytes > mMaxBytes) {
+      mBytes -= mEntries.back().bytes;
+      mEntriesByKey.erase(mEntries.back().key);
+      mEntries.pop_back();
+      ++mStatistics.evictions;
+    }
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mGeneration;
+    ++mStatistics.clears;
+    mEntriesByKey.clear();
+    mEntries.clear();
+    mBytes = 0;
+  }
+
+  // Held by the forking thread across fork() (see Action::PrepareFork)
+  void LockForFork() { mMutex.lock(); }
+  void UnlockAfterFork() { mMutex.unlock(); }
+
+  Statistics GetStatistics() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    Statistics statistics = mStatistics;
+    statistics.entries = mEntries.size();
+    statistics.bytes = mBytes;
+    return statistics;
+  }
+
+private:
+  // Rough per-entry cost of the list node, hash node and bookkeeping
+  static const size_t kEntryOverhead = 128;
+
+  struct Entry {
+    std::string key;
+    Value value;
+    size_t bytes;
+  };
+
+  ResultCache(const ResultCache&);
+  ResultCache& operator=(const ResultCache&);
+
+  const size_t mMaxEntries;
+  const size_t mMaxBytes;
+  mutable std::mutex mMutex;
+  std::list<Entry> mEntries; // most recently used first
+  std::unordered_map<std::string, typename std::list<Entry>::iterator> mEntriesByKey;
+  size_t mBytes;
+  uint64_t mGeneration;
+  Statistics mStatistics;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_RESULT_CACHE_H_
@@ -0,0 +1,464 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "result_encoding.h"
+
+#include <cstring>
+#include <stdexcept>
+
+using sample::upe::EncodedResultKind;
+using std::pair;
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace {
+
+const char kMagic[] = {'U', 'P', 'E', 'B'};
+const uint32_t kHeaderWords = 8;
+const uint32_t kLabelWords = 9;
+const uint32_t kContentLabelWords = 3;
+const uint32_t kActionHeaderWords = 3; // type, id, field count
+
+// Header word positions
+enum HeaderWord {
+  kMagicWord,
+  kVersionWord,
+  kKindWord,
+  kRootWord,
+  kStringTableWord,
+  kStringCountWord,
+  kStringBytesWord,
+  kTotalSizeWord,
+};
+
+// Label word positions
+enum LabelWord {
+  kLabelId,
+  kLabelName,
+  kLabelDescription,
+  kLabelIsActive,
+  kLabelColor,
+  kLabelSensitivity,
+  kLabelTooltip,
+  kLabelParentId,
+  kLabelChildren,
+};
+
+void AppendWord(uint32_t value, string& out) {
+  char bytes[4] = {
+    static_cast<char>(value),
+    static_cast<char>(value >> 8),
+    static_cast<char>(value >> 16),
+    static_cast<char>(value >> 24),
+  };
+  out.append(bytes, 4);
+}
+
+// Encoded buffers need not be aligned, so words are read byte by byte
+uint32_t LoadWord(const char* data) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+      (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+uint32_t ToWord(size_t value) {
+  if (value > 0xFFFFFFFE)
+    throw runtime_error("Result is too large to encode");
+  return static_cast<uint32_t>(value);
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+void ResultEncoder::EncodeLabels(const vector<shared_ptr<mip::Label>>& labels, string& out) {
+  Reset();
+  mWords.push_back(ToWord(labels.size()));
+  mWords.resize(mWords.size() + labels.size());
+  for (size_t i = 0; i < labels.size(); ++i) {
+    uint32_t offset = AddLabel(labels[i]);
+    mWords[1 + i] = offset;
+  }
+  Finish(EncodedResultKind::Labels, kHeaderWords, out);
+}
+
+void ResultEncoder::EncodeContentLabel(const shared_ptr<mip::ContentLabel>& label, string& out) {
+  Reset();
+  if (nullptr == label) {
+    Finish(EncodedResultKind::ContentLabel, 0, out);
+    return;
+  }
+
+  mWords.push_back(static_cast<uint32_t>(label->GetAssignmentMethod()));
+  mWords.push_back(label->IsProtectionAppliedFromLabel() ? 1 : 0);
+  mWords.push_back(0);
+  uint32_t labelOffset = AddLabel(label->GetLabel());
+  mWords[2] = labelOffset;
+  Finish(EncodedResultKind::ContentLabel, kHeaderWords, out);
+}
+
+void ResultEncoder::EncodeActions(const vector<shared_ptr<mip::Action>>& actions, string& out) {
+  Reset();
+  mWords.push_back(ToWord(actions.size()));
+  mWords.resize(mWords.size() + actions.size());
+  for (size_t i = 0; i < actions.size(); ++i) {
+    uint32_t offset = AddAction(*actions[i]);
+    mWords[1 + i] = offset;
+  }
+  Finish(EncodedResultKind::Actions, kHeaderWords, out);
+}
+
+void ResultEncoder::Reset() {
+  // Clearing keeps the buffers' capacity for the next result
+  mWords.clear();
+  mStringTable.clear();
+  mStringBytes.clear();
+  mStringIndexes.clear();
+}
+
+void ResultEncoder::Finish(EncodedResultKind kind, uint32_t root, string& out) {
+  uint32_t stringTable = GetOffset();
+  uint32_t stringCount = ToWord(mStringTable.size() / 2);
+  size_t stringBytes = (static_cast<size_t>(stringTable) + mStringTable.size()) * 4;
+  size_t totalSize = stringBytes + mStringBytes.size();
+
+  out.reserve(out.size() + totalSize);
+  out.append(kMagic, 4);
+  AppendWord(kEncodedResultVersion, out);
+  AppendWord(static_cast<uint32_t>(kind), out);
+  AppendWord(root, out);
+  AppendWord(stringTable, out);
+  AppendWord(stringCount, out);
+  AppendWord(ToWord(stringBytes), out);
+  AppendWord(ToWord(totalSize), out);
+  for (uint32_t word : mWords)
+    AppendWord(word, out);
+  for (uint32_t word : mStringTable)
+    AppendWord(word, out);
+  out += mStringBytes;
+}
+
+// Offset of the next word added to mWords
+uint32_t ResultEncoder::GetOffset() const {
+  return ToWord(kHeaderWords + mWords.size());
+}
+
+uint32_t ResultEncoder::AddString(const string& value) {
+  auto it = mStringIndexes.find(value);
+  if (it != mStringIndexes.end())
+    return it->second;
+
+  uint32_t index = ToWord(mStringTable.size() / 2);
+  mStringTable.push_back(ToWord(mStringBytes.size()));
+  mStringTable.push_back(ToWord(value.size()));
+  mStringBytes += value;
+  mStringIndexes.emplace(value, index);
+  return index;
+}
+
+uint32_t ResultEncoder::AddStringList(const vector<string>& values) {
+  uint32_t offset = GetOffset();
+  mWords.push_back(ToWord(values.size()));
+  for (const string& value : values)
+    mWords.push_back(AddString(value));
+  return offset;
+}
+
+uint32_t ResultEncoder::AddStringPairs(const vector<pair<string, string>>& values) {
+  uint32_t offset = GetOffset();
+  mWords.push_back(ToWord(values.size()));
+  for (const pair<string, string>& value : values) {
+    mWords.push_back(AddString(value.first));
+    mWords.push_back(AddString(value.second));
+  }
+  return offset;
+}
+
+uint32_t ResultEncoder::AddLabel(const shared_ptr<mip::Label>& label) {
+  uint32_t offset = GetOffset();
+  size_t start = mWords.size();
+  mWords.resize(start + kLabelWords);
+  // mWords may grow while the label's strings are added, so only index into it
+  mWords[start + kLabelId] = AddString(label->GetId());
+  mWords[start + kLabelName] = AddString(label->GetName());
+  mWords[start + kLabelDescription] = AddString(label->GetDescription());
+  mWords[start + kLabelIsActive] = label->IsActive() ? 1 : 0;
+  mWords[start + kLabelColor] = AddString(label->GetColor());
+  mWords[start + kLabelSensitivity] = static_cast<uint32_t>(label->GetSensitivity());
+  mWords[start + kLabelTooltip] = AddString(label->GetTooltip());
+  shared_ptr<mip::Label> parent = label->GetParent().lock();
+  mWords[start + kLabelParentId] = nullptr != parent ? AddString(parent->GetId()) : kNoString;
+
+  const vector<shared_ptr<mip::Label>>& children = label->GetChildren();
+  size_t childrenStart = mWords.size();
+  mWords[start + kLabelChildren] = GetOffset();
+  mWords.push_back(ToWord(children.size()));
+  mWords.resize(mWords.size() + children.size());
+  for (size_t i = 0; i < children.size(); ++i) {
+    uint32_t childOffset = AddLabel(children[i]);
+    mWords[childrenStart + 1 + i] = childOffset;
+  }
+  return offset;
+}
+
+uint32_t ResultEncoder::AddAction(mip::Action& action) {
+  uint32_t offset = GetOffset();
+  const ActionTypeDescriptor* descriptor = GetActionTypeDescriptor(action.GetType());
+  size_t fieldCount = nullptr != descriptor ? descriptor->fields.size() : 0;
+
+  size_t start = mWords.size();
+  mWords.resize(start + kActionHeaderWords + fieldCount);
+  mWords[start] = static_cast<uint32_t>(action.GetType());
+  mWords[start + 1] = AddString(action.GetId());
+  mWords[start + 2] = ToWord(fieldCount);
+  for (size_t i = 0; i < fieldCount; ++i) {
+    const ActionField& field = descriptor->fields[i];
+    uint32_t value = 0;
+    switch (field.type) {
+      case ActionFieldType::String:
+        value = AddString(field.getString(action));
+        break;
+      case ActionFieldType::Integer:
+        value = static_cast<uint32_t>(field.getInteger(action));
+        break;
+      case ActionFieldType::Alignment:
+        value = static_cast<uint32_t>(field.getAlignment(action));
+        break;
+      case ActionFieldType::Layout:
+        value = static_cast<uint32_t>(field.getLayout(action));
+        break;
+      case ActionFieldType::StringList:
+        value = AddStringList(field.getStringList(action));
+        break;
+      case ActionFieldType::StringPairs:
+        value = AddStringPairs(field.getStringPairs(action));
+        break;
+    }
+    mWords[start + kActionHeaderWords + i] = value;
+  }
+  return offset;
+}
+
+StringView EncodedLabel::GetId() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + kLabelId));
+}
+
+StringView EncodedLabel::GetName() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + kLabelName));
+}
+
+StringView EncodedLabel::GetDescription() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + kLabelDescription));
+}
+
+bool EncodedLabel::IsActive() const {
+  return mResult->ReadWord(mOffset + kLabelIsActive) != 0;
+}
+
+StringView EncodedLabel::GetColor() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + kLabelColor));
+}
+
+int EncodedLabel::GetSensitivity() const {
+  return static_cast<int>(mResult->ReadWord(mOffset + kLabelSensitivity));
+}
+
+StringView EncodedLabel::GetTooltip() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + kLabelTooltip));
+}
+
+StringView EncodedLabel::GetParentId() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + kLabelParentId));
+}
+
+size_t EncodedLabel::GetChildCount() const {
+  return mResult->ReadWord(mResult->ReadWord(mOffset + kLabelChildren));
+}
+
+EncodedLabel EncodedLabel::GetChild(size_t index) const {
+  uint32_t children = mResult->ReadWord(mOffset + kLabelChildren);
+  if (index >= mResult->ReadWord(children))
+    throw runtime_error("Child label index is out of range");
+  return EncodedLabel(*mResult, mResult->ReadWord(children + 1 + static_cast<uint32_t>(index)));
+}
+
+mip::AssignmentMethod EncodedContentLabel::GetAssignmentMethod() const {
+  return static_cast<mip::AssignmentMethod>(mResult->ReadWord(mOffset));
+}
+
+bool EncodedContentLabel::IsProtectionAppliedFromLabel() const {
+  return mResult->ReadWord(mOffset + 1) != 0;
+}
+
+EncodedLabel EncodedContentLabel::GetLabel() const {
+  return EncodedLabel(*mResult, mResult->ReadWord(mOffset + 2));
+}
+
+mip::ActionType EncodedAction::GetType() const {
+  return static_cast<mip::ActionType>(mResult->ReadWord(mOffset));
+}
+
+StringView EncodedAction::GetId() const {
+  return mResult->ReadString(mResult->ReadWord(mOffset + 1));
+}
+
+const ActionTypeDescriptor* EncodedAction::GetDescriptor() const {
+  return GetActionTypeDescriptor(GetType());
+}
+
+size_t EncodedAction::GetFieldCount() const {
+  return mResult->ReadWord(mOffset + 2);
+}
+
+uint32_t EncodedAction::GetFieldWord(size_t field) const {
+  if (field >= GetFieldCount())
+    throw runtime_error("Action field index is out of range");
+  return mResult->ReadWord(mOffset + kActionHeaderWords + static_cast<uint32_t>(field));
+}
+
+StringView EncodedAction::GetString(size_t field) const {
+  return mResult->ReadString(GetFieldWord(field));
+}
+
+int EncodedAction::GetInteger(size_t field) const {
+  return static_cast<int>(GetFieldWord(field));
+}
+
+uint32_t EncodedAction::GetEnumValue(size_t field) const {
+  return GetFieldWord(field);
+}
+
+size_t EncodedAction::GetListSize(size_t field) const {
+  return mResult->ReadWord(GetFieldWord(field));
+}
+
+StringView EncodedAction::GetListItem(size_t field, size_t index) const {
+  uint32_t list = GetFieldWord(field);
+  if (index >= mResult->ReadWord(list))
+    throw runtime_error("Action field item index is out of range");
+  return mResult->ReadString(mResult->ReadWord(list + 1 + static_cast<uint32_t>(index)));
+}
+
+pair<StringView, StringView> EncodedAction::GetPair(size_t field, size_t index) const {
+  uint32_t list = GetFieldWord(field);
+  if (index >= mResult->ReadWord(list))
+    throw runtime_error("Action field item index is out of range");
+  uint32_t item = list + 1 + static_cast<uint32_t>(index) * 2;
+  return pair<StringView, StringView>(
+      mResult->ReadString(mResult->ReadWord(item)), mResult->ReadString(mResult->ReadWord(item + 1)));
+}
+
+EncodedResult::EncodedResult(const char* data, size_t size) : mData(data), mSize(size) {
+  if (size < kHeaderWords * 4 || memcmp(data, kMagic, 4) != 0)
+    throw runtime_error("Not an encoded result");
+  mVersion = LoadWord(data + kVersionWord * 4);
+  if (mVersion != kEncodedResultVersion)
+    throw runtime_error("Unsupported encoded result version " + to_string(mVersion));
+
+  uint32_t kind = LoadWord(data + kKindWord * 4);
+  if (kind < static_cast<uint32_t>(EncodedResultKind::Labels) ||
+      kind > static_cast<uint32_t>(EncodedResultKind::Actions))
+    throw runtime_error("Unknown encoded result kind " + to_string(kind));
+  mKind = static_cast<EncodedResultKind>(kind);
+  mRoot = LoadWord(data + kRootWord * 4);
+  mStringTable = LoadWord(data + kStringTableWord * 4);
+  mStringCount = LoadWord(data + kStringCountWord * 4);
+  mWordCount = mStringTable;
+
+  // The string table follows the records, and the string bytes follow the table
+  uint64_t stringBytes = LoadWord(data + kStringBytesWord * 4);
+  uint64_t tableEnd = (static_cast<uint64_t>(mStringTable) + static_cast<uint64_t>(mStringCount) * 2) * 4;
+  if (mStringTable < kHeaderWords || stringBytes != tableEnd || LoadWord(data + kTotalSizeWord * 4) != size ||
+      stringBytes > size)
+    throw runtime_error("Malformed encoded result header");
+}
+
+size_t EncodedResult::GetLabelCount() const {
+  return ReadWord(GetRoot(EncodedResultKind::Labels));
+}
+
+EncodedLabel EncodedResult::GetLabel(size_t index) const {
+  uint32_t root = GetRoot(EncodedResultKind::Labels);
+  if (index >= ReadWord(root))
+    throw runtime_error("Label index is out of range");
+  return EncodedLabel(*this, ReadWord(root + 1 + static_cast<uint32_t>(index)));
+}
+
+bool EncodedResult::HasContentLabel() const {
+  return mKind == EncodedResultKind::ContentLabel && mRoot != 0;
+}
+
+EncodedContentLabel EncodedResult::GetContentLabel() const {
+  if (!HasContentLabel())
+    throw runtime_error("Encoded result holds no content label");
+  return EncodedContentLabel(*this, mRoot);
+}
+
+size_t EncodedResult::GetActionCount() const {
+  return ReadWord(GetRoot(EncodedResultKind::Actions));
+}
+
+EncodedAction EncodedResult::GetAction(size_t index) const {
+  uint32_t root = GetRoot(EncodedResultKind::Actions);
+  if (index >= ReadWord(root))
+    throw runtime_error("Action index is out of range");
+  return EncodedAction(*this, ReadWord(root + 1 + static_cast<uint32_t>(index)));
+}
+
+uint32_t EncodedResult::GetRoot(EncodedResultKind kind) const {
+  if (mKind != kind)
+    throw runtime_error("Encoded result holds another kind of result");
+  return mRoot;
+}
+
+uint32_t EncodedResult::ReadWord(uint32_t offset) const {
+  if (offset < kHeaderWords || offset >= mWordCount)
+    throw runtime_error("Malformed encoded result: offset " + to_string(offset) + " is out of range");
+  return LoadWord(mData + static_cast<size_t>(offset) * 4);
+}
+
+StringView EncodedResult::ReadString(uint32_t index) const {
+  if (index == kNoString)
+    return StringView();
+  if (index >= mStringCount)
+    throw runtime_error("Malformed encoded result: string " + to_string(index) + " is out of range");
+
+  const char* entry = mData + (static_cast<size_t>(mStringTable) + static_cast<size_t>(index) * 2) * 4;
+  size_t stringBytes = (static_cast<size_t>(mStringTable) + static_cast<size_t>(mStringCount) * 2) * 4;
+  uint64_t offset = LoadWord(entry);
+  uint64_t size = LoadWord(entry + 4);
+  if (offset + size > mSize - stringBytes)
+    throw runtime_error("Malformed encoded result: string " + to_string(index) + " is out of range");
+  return StringView(mData + stringBytes + offset, static_cast<size_t>(size));
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,220 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_RESULT_ENCODING_H_
+#define SAMPLES_UPE_RESULT_ENCODING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mip/common_types.h"
+#include "mip/upe/action.h"
+#include "mip/upe/content_label.h"
+#include "mip/upe/label.h"
+
+#include "action_serializer.h"
+#include "string_view.h"
+
+namespace sample {
+namespace upe {
+
+// Compact binary encoding of labels, content labels and actions, for consumers that would otherwise format and parse
+// the JSON results. An encoded result is read in place: EncodedResult and its views reference the buffer, and strings
+// are returned as StringViews into it.
+//
+// Version 1 layout. Every value is a 32-bit little-endian word, and offsets count words from the start of the buffer:
+//   Header:        'U' 'P' 'E' 'B', version, EncodedResultKind, root offset, string table offset, string count,
+//                  string bytes offset (in bytes), total size (in bytes)
+//   Records:       referenced from the root, see below
+//   String table:  per string, its byte offset and length. Records refer to strings by index, and each distinct
+//                  string is stored once (e.g. a label id repeated by its actions). kNoString stands for none.
+//   String bytes:  UTF-8, not terminated
+//
+// Records:
+//   Labels root:   count, then the offset of each Label
+//   Label:         id, name, description, isActive, color, sensitivity, tooltip, parent id (or kNoString), offset of
+//                  a list holding the offsets of its child Labels
+//   Content label: mip::AssignmentMethod, isProtectionAppliedFromLabel, offset of its Label. A root offset of 0 means
+//                  no label.
+//   Actions root:  count, then the offset of each Action
+//   Action:        mip::ActionType, id, field count, then one word per field in the order of its
+//                  ActionTypeDescriptor (see action_serializer.h): strings as a string index, integers and enum values
+//                  as is, string lists as the offset of [count, string index...] and string pairs as the offset of
+//                  [count, key index, value index...]
+//
+// Readers accept any version 1 buffer. Fields added to an action type in later versions are appended, so readers skip
+// any beyond those they know; the field count tells how many a record holds.
+enum class EncodedResultKind : uint32_t {
+  Labels = 1,
+  ContentLabel = 2,
+  Actions = 3,
+};
+
+const uint32_t kEncodedResultVersion = 1;
+const uint32_t kNoString = 0xFFFFFFFF;
+
+// Encodes results into reusable buffers, so encoding many results allocates only as they grow. Not thread-safe.
+class ResultEncoder {
+public:
+  ResultEncoder() {}
+
+  // Each appends one encoded result to 'out'
+  void EncodeLabels(const std::vector<std::shared_ptr<mip::Label>>& labels, std::string& out);
+  void EncodeContentLabel(const std::shared_ptr<mip::ContentLabel>& label, std::string& out);
+  void EncodeActions(const std::vector<std::shared_ptr<mip::Action>>& actions, std::string& out);
+
+private:
+  ResultEncoder(const ResultEncoder&);
+  ResultEncoder& operator=(const ResultEncoder&);
+
+  void Reset();
+  void Finish(EncodedResultKind kind, uint32_t root, std::string& out);
+  uint32_t GetOffset() const;
+  uint32_t AddString(const std::string& value);
+  uint32_t AddStringList(const std::vector<std::string>& values);
+  uint32_t AddStringPairs(const std::vector<std::pair<std::string, std::string>>& values);
+  uint32_t AddLabel(const std::shared_ptr<mip::Label>& label);
+  uint32_t AddAction(mip::Action& action);
+
+  std::vector<uint32_t> mWords; // records, following the header
+  std::vector<uint32_t> mStringTable;
+  std::string mStringBytes;
+  std::unordered_map<std::string, uint32_t> mStringIndexes;
+};
+
+class EncodedResult;
+
+class EncodedLabel {
+public:
+  StringView GetId() const;
+  StringView GetName() const;
+  StringView GetDescription() const;
+  bool IsActive() const;
+  StringView GetColor() const;
+  int GetSensitivity() const;
+  StringView GetTooltip() const;
+  StringView GetParentId() const; // empty if the label has no parent
+  size_t GetChildCount() const;
+  EncodedLabel GetChild(size_t index) const;
+
+private:
+  friend class EncodedResult;
+  friend class EncodedContentLabel;
+  EncodedLabel(const EncodedResult& result, uint32_t offset) : mResult(&result), mOffset(offset) {}
+
+  const EncodedResult* mResult;
+  uint32_t mOffset;
+};
+
+class EncodedContentLabel {
+public:
+  mip::AssignmentMethod GetAssignmentMethod() const;
+  bool IsProtectionAppliedFromLabel() const;
+  EncodedLabel GetLabel() const;
+
+private:
+  friend class EncodedResult;
+  EncodedContentLabel(const EncodedResult& result, uint32_t offset) : mResult(&result), mOffset(offset) {}
+
+  const EncodedResult* mResult;
+  uint32_t mOffset;
+};
+
+// Fields are read by their index in the action type's descriptor, with the accessor matching the field's type
+class EncodedAction {
+public:
+  mip::ActionType GetType() const;
+  StringView GetId() const;
+  // nullptr for action types unknown to this reader, whose fields can then only be counted
+  const ActionTypeDescriptor* GetDescriptor() const;
+  size_t GetFieldCount() const;
+
+  StringView GetString(size_t field) const;
+  int GetInteger(size_t field) const;
+  uint32_t GetEnumValue(size_t field) const; // mip::ContentMarkAlignment or mip::WatermarkLayout
+  size_t GetListSize(size_t field) const;    // string lists and string pairs
+  StringView GetListItem(size_t field, size_t index) const;
+  std::pair<StringView, StringView> GetPair(size_t field, size_t index) const;
+
+private:
+  friend class EncodedResult;
+  EncodedAction(const EncodedResult& result, uint32_t offset) : mResult(&result), mOffset(offset) {}
+
+  uint32_t GetFieldWord(size_t field) const;
+
+  const EncodedResult* mResult;
+  uint32_t mOffset;
+};
+
+// Reads an encoded result in place. The buffer must outlive the result and every view and string read from it. Offsets
+// and string indexes are checked as they are followed, so a malformed buffer throws std::runtime_error rather than
+// reading out of bounds.
+class EncodedResult {
+public:
+  // Checks the header and string table. Throws std::runtime_error if they are malformed or of another version.
+  EncodedResult(const char* data, size_t size);
+
+  EncodedResultKind GetKind() const { return mKind; }
+  uint32_t GetVersion() const { return mVersion; }
+
+  // Labels results
+  size_t GetLabelCount() const;
+  EncodedLabel GetLabel(size_t index) const;
+
+  // ContentLabel results
+  bool HasContentLabel() const;
+  EncodedContentLabel GetContentLabel() const;
+
+  // Actions results
+  size_t GetActionCount() const;
+  EncodedAction GetAction(size_t index) const;
+
+  uint32_t ReadWord(uint32_t offset) const;
+  StringView ReadString(uint32_t index) const;
+
+private:
+  uint32_t GetRoot(EncodedResultKind kind) const;
+
+  const char* mData;
+  size_t mSize;
+  uint32_t mVersion;
+  EncodedResultKind mKind;
+  uint32_t mRoot;
+  uint32_t mWordCount; // words before the string table
+  uint32_t mStringTable;
+  uint32_t mStringCount;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_RESULT_ENCODING_H_
@@ -0,0 +1,196 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "result_writer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "action_serializer.h"
+
+using std::runtime_error;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace {
+
+const uint64_t kEveryByte = 0x0101010101010101ull;
+const uint64_t kHighBits = 0x8080808080808080ull;
+
+// True if any of the 8 bytes in 'word' must be escaped in a JSON string: a control character, '"' or '\\'. Tests all
+// bytes at once; a matching byte's borrow may flag the bytes above it too, which doesn't change the answer.
+bool NeedsEscape(uint64_t word) {
+  uint64_t quotes = word ^ (kEveryByte * '"');
+  uint64_t backslashes = word ^ (kEveryByte * '\\');
+  uint64_t matches = (word - kEveryByte * 0x20) & ~word; // bytes below 0x20
+  matches |= (quotes - kEveryByte) & ~quotes;
+  matches |= (backslashes - kEveryByte) & ~backslashes;
+  return (matches & kHighBits) != 0;
+}
+
+void AppendEscaped(char c, string& out) {
+  static const char kHexDigits[] = "0123456789abcdef";
+
+  switch (c) {
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\b': out += "\\b"; break;
+    case '\f': out += "\\f"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      out += "\\u00";
+      out += kHexDigits[(c >> 4) & 0xF];
+      out += kHexDigits[c & 0xF];
+  }
+}
+
+const char* GetAssignmentMethodStr(mip::AssignmentMethod method) {
+  switch (method) {
+    case mip::AssignmentMethod::STANDARD:
+      return "standard";
+    case mip::AssignmentMethod::PRIVILEGED:
+      return "privileged";
+    case mip::AssignmentMethod::AUTO:
+      return "auto";
+    default:
+      throw runtime_error("Unrecognized AssignmentMethod");
+  }
+}
+
+void AppendField(const char* name, const string& value, string& out) {
+  out += ",\"";
+  out += name;
+  out += "\":";
+  sample::upe::AppendJsonString(value, out);
+}
+
+void AppendField(const char* name, int value, string& out) {
+  out += ",\"";
+  out += name;
+  out += "\":";
+  out += to_string(value);
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+// Runs of characters that need no escaping, typically the whole value, are found 8 bytes at a time and appended at once
+void AppendJsonString(const string& value, string& out) {
+  const char* data = value.data();
+  size_t size = value.size();
+  out.reserve(out.size() + size + 2);
+  out += '"';
+
+  size_t runStart = 0;
+  size_t i = 0;
+  while (i < size) {
+    if (i + 8 <= size) {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      if (!NeedsEscape(word)) {
+        i += 8;
+        continue;
+      }
+    }
+
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      ++i;
+      continue;
+    }
+    out.append(data + runStart, i - runStart);
+    AppendEscaped(data[i], out);
+    runStart = ++i;
+  }
+  out.append(data + runStart, size - runStart);
+  out += '"';
+}
+
+void AppendLabelJson(const shared_ptr<mip::Label>& label, string& out) {
+  out += "{\"id\":";
+  AppendJsonString(label->GetId(), out);
+  AppendField("name", label->GetName(), out);
+  AppendField("description", label->GetDescription(), out);
+  out += ",\"isActive\":";
+  out += label->IsActive() ? "true" : "false";
+  AppendField("color", label->GetColor(), out);
+  AppendField("sensitivity", label->GetSensitivity(), out);
+  AppendField("tooltip", label->GetTooltip(), out);
+
+  shared_ptr<mip::Label> parent = label->GetParent().lock();
+  if (nullptr != parent)
+    AppendField("parentId", parent->GetId(), out);
+
+  if (!label->GetChildren().empty()) {
+    out += ",\"children\":[";
+    bool first = true;
+    for (const shared_ptr<mip::Label>& child : label->GetChildren()) {
+      if (!first)
+        out += ',';
+      first = false;
+      AppendLabelJson(child, out);
+    }
+    out += ']';
+  }
+
+  out += '}';
+}
+
+void AppendContentLabelJson(const shared_ptr<mip::ContentLabel>& label, string& out) {
+  if (nullptr == label) {
+    out += "null";
+    return;
+  }
+
+  out += "{\"assignmentMethod\":\"";
+  out += GetAssignmentMethodStr(label->GetAssignmentMethod());
+  out += "\",\"isProtectionAppliedFromLabel\":";
+  out += label->IsProtectionAppliedFromLabel() ? "true" : "false";
+  out += ",\"label\":";
+  AppendLabelJson(label->GetLabel(), out);
+  out += '}';
+}
+
+void AppendActionsJson(const vector<shared_ptr<mip::Action>>& actions, string& out) {
+  out += '[';
+  for (size_t i = 0; i < actions.size(); ++i) {
+    if (i > 0)
+      out += ',';
+    AppendActionJson(*actions[i], out);
+  }
+  out += ']';
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,57 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_RESULT_WRITER_H_
+#define SAMPLES_UPE_RESULT_WRITER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mip/upe/action.h"
+#include "mip/upe/content_label.h"
+#include "mip/upe/label.h"
+
+namespace sample {
+namespace upe {
+
+// Appends 'value' to 'out' as a quoted JSON string
+void AppendJsonString(const std::string& value, std::string& out);
+
+// Appends a single-line JSON object describing a label (including its children) to 'out'
+void AppendLabelJson(const std::shared_ptr<mip::Label>& label, std::string& out);
+
+// Appends a single-line JSON object describing the label applied to content, or 'null' if 'label' is empty
+void AppendContentLabelJson(const std::shared_ptr<mip::ContentLabel>& label, std::string& out);
+
+// Appends a single-line JSON array describing the actions computed for an execution state
+void AppendActionsJson(const std::vector<std::shared_ptr<mip::Action>>& actions, std::string& out);
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_RESULT_WRITER_H_
@@ -0,0 +1,1052 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "server.h"
+
+#include <stdexcept>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "execution_state_parser.h"
+#include "latency_histogram.h"
+#include "result_encoding.h"
+#include "result_writer.h"
+#endif // __linux__
+
+using std::runtime_error;
+using std::string;
+
+#ifdef __linux__
+
+using std::cout;
+using std::endl;
+using std::exception;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+namespace {
+
+// Stop reading from a client whose responses are not being consumed once this much output is pending, or once a full
+// frame plus one read is buffered but cannot be answered yet
+const size_t kMaxPendingOutput = 4 * 1024 * 1024;
+const size_t kReadChunkSize = 64 * 1024;
+const size_t kMaxPendingInput = sample::upe::kMaxFrameLength + 4 + kReadChunkSize;
+const int kMaxEvents = 64;
+// With worker threads, stop reading from a client once this many of its requests are waiting for a worker or for an
+// earlier response
+const uint64_t kMaxRequestsInFlight = 256;
+
+// Written to by the SIGINT/SIGTERM handler, and by the SIGUSR1 handler asking a worker process to drain. A self-pipe
+// is used rather than signalfd because the SDK's own threads were started before the server and would not have the
+// signals blocked.
+int gShutdownPipe[2] = { -1, -1 };
+const char kShutdownByte = 0;
+const char kDrainByte = 1;
+
+void WriteShutdownPipe(char c) {
+  int savedErrno = errno;
+  ssize_t ignored = write(gShutdownPipe[1], &c, 1);
+  (void)ignored;
+  errno = savedErrno;
+}
+
+extern "C" void OnShutdownSignal(int) {
+  WriteShutdownPipe(kShutdownByte);
+}
+
+extern "C" void OnDrainSignal(int) {
+  WriteShutdownPipe(kDrainByte);
+}
+
+string ErrnoMessage(const string& operation) {
+  return operation + " failed: " + strerror(errno);
+}
+
+// Closes a file descriptor when it goes out of scope
+class ScopedFd {
+public:
+  explicit ScopedFd(int fd = -1) : mFd(fd) {}
+  ~ScopedFd() { Reset(); }
+  int Get() const { return mFd; }
+  int Release() {
+    int fd = mFd;
+    mFd = -1;
+    return fd;
+  }
+  void Reset(int fd = -1) {
+    if (mFd >= 0)
+      close(mFd);
+    mFd = fd;
+  }
+
+private:
+  ScopedFd(const ScopedFd&);
+  ScopedFd& operator=(const ScopedFd&);
+  int mFd;
+};
+
+void SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    throw runtime_error(ErrnoMessage("fcntl"));
+}
+
+// Returns a non-blocking socket listening on 'socketPath'. The caller unlinks the path once done with the socket.
+int BindSocket(const string& socketPath) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    throw runtime_error("Invalid socket path '" + socketPath + "'");
+  memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+  // Remove a socket left behind by a previous run, but never some other kind of file
+  struct stat existing;
+  if (lstat(socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+    unlink(socketPath.c_str());
+
+  ScopedFd listenFd(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+  if (listenFd.Get() < 0)
+    throw runtime_error(ErrnoMessage("socket"));
+  if (bind(listenFd.Get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    throw runtime_error(ErrnoMessage("bind"));
+  if (listen(listenFd.Get(), SOMAXCONN) != 0) {
+    string error = ErrnoMessage("listen");
+    unlink(socketPath.c_str());
+    throw runtime_error(error);
+  }
+  return listenFd.Release();
+}
+
+uint32_t ReadBigEndian32(const char* data) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+      (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+}
+
+void AppendBigEndian32(uint32_t value, string& out) {
+  out += static_cast<char>((value >> 24) & 0xFF);
+  out += static_cast<char>((value >> 16) & 0xFF);
+  out += static_cast<char>((value >> 8) & 0xFF);
+  out += static_cast<char>(value & 0xFF);
+}
+
+struct Connection {
+  Connection(int fd, uint64_t id)
+      : fd(fd),
+        id(id),
+        outOffset(0),
+        epollEvents(EPOLLIN),
+        isPeerClosed(false),
+        isDraining(false),
+        nextRequest(0),
+        nextResponse(0) {}
+
+  size_t PendingOutput() const { return out.size() - outOffset; }
+  uint64_t RequestsInFlight() const { return nextRequest - nextResponse; }
+  bool ShouldPauseRead() const {
+    return isPeerClosed || isDraining || PendingOutput() > kMaxPendingOutput || in.size() >= kMaxPendingInput ||
+        RequestsInFlight() >= kMaxRequestsInFlight;
+  }
+
+  ScopedFd fd;
+  uint64_t id; // unlike the fd, never reused by a later connection
+  string in;
+  string out;
+  size_t outOffset;
+  uint32_t epollEvents;
+  bool isPeerClosed;
+  bool isDraining; // the server is draining: no more requests are read, buffered ones are still answered
+
+  // Requests handed to worker threads are numbered in arrival order; responses finishing out of order wait here
+  uint64_t nextRequest;
+  uint64_t nextResponse;
+  std::map<uint64_t, string> finishedResponses;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// A request answered by a worker thread
+struct PendingRequest {
+  int fd;
+  uint64_t connectionId;
+  uint64_t sequence;
+  uint8_t type;
+  sample::upe::RequestLane lane;
+  Clock::time_point arrival;
+  string payload;
+  string response; // complete response frame
+};
+
+// Encoders keep their buffers between requests, one per thread answering requests
+sample::upe::ResultEncoder& GetEncoder() {
+  static thread_local sample::upe::ResultEncoder encoder;
+  return encoder;
+}
+
+sample::upe::RequestType GetRequestType(uint8_t type) {
+  return static_cast<sample::upe::RequestType>(type & ~sample::upe::kEncodedResponse);
+}
+
+sample::upe::RequestLane GetLane(uint8_t type) {
+  return GetRequestType(type) == sample::upe::RequestType::ComputeActions ?
+      sample::upe::RequestLane::Bulk : sample::upe::RequestLane::Interactive;
+}
+
+const char* GetLaneName(sample::upe::RequestLane lane) {
+  return lane == sample::upe::RequestLane::Bulk ? "Bulk" : "Interactive";
+}
+
+class UnixSocketServer {
+public:
+  // Binds 'socketPath' itself, or accepts on 'listenFd' if given (e.g. one inherited from a supervisor process, which
+  // then owns the path)
+  UnixSocketServer(
+      sample::upe::Action& action,
+      const string& socketPath,
+      const sample::upe::ExecutionStateOptions& defaults,
+      const sample::upe::ServerOptions& options,
+      int listenFd = -1)
+      : mAction(action),
+        mSocketPath(socketPath),
+        mDefaults(defaults),
+        mOptions(options),
+        mListenFd(listenFd),
+        mIsListenFdInherited(listenFd >= 0),
+        mIsDraining(false),
+        mNextConnectionId(0),
+        mScheduler(options.scheduler, options.threadCount) {}
+
+  ~UnixSocketServer() {
+    StopWorkers();
+    mConnections.clear();
+    if (mListenFd.Get() >= 0 && !mIsListenFdInherited)
+      unlink(mSocketPath.c_str());
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    for (int& fd : gShutdownPipe) {
+      if (fd >= 0)
+        close(fd);
+      fd = -1;
+    }
+  }
+
+  void Run() {
+    Listen();
+    StartWorkers();
+
+    cout << "Serving on '" << mSocketPath << "'" << endl;
+
+    epoll_event events[kMaxEvents];
+    bool isShuttingDown = false;
+    while (!isShuttingDown && !(mIsDraining && mConnections.empty())) {
+      int count = epoll_wait(mEpollFd.Get(), events, kMaxEvents, -1);
+      if (count < 0) {
+        if (errno == EINTR)
+          continue;
+        throw runtime_error(ErrnoMessage("epoll_wait"));
+      }
+
+      for (int i = 0; i < count; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == gShutdownPipe[0])
+          isShuttingDown = OnShutdownPipe() || isShuttingDown;
+        else if (fd == mCompletionFd.Get())
+          OnRequestsCompleted();
+        else if (fd == mListenFd.Get())
+          Accept();
+        else
+          OnConnectionEvent(fd, events[i].events);
+      }
+    }
+
+    cout << "Shutting down, closing " << mConnections.size() << " connection(s)" << endl;
+    if (nullptr != mOptions.statistics)
+      PrintStatistics(*mOptions.statistics);
+  }
+
+private:
+  // Returns true once a shutdown was requested; a drain request starts draining
+  bool OnShutdownPipe() {
+    bool isShuttingDown = false;
+    char signals[16];
+    ssize_t count;
+    while ((count = read(gShutdownPipe[0], signals, sizeof(signals))) > 0) {
+      for (ssize_t i = 0; i < count; ++i) {
+        if (signals[i] == kShutdownByte)
+          isShuttingDown = true;
+        else if (signals[i] == kDrainByte && !mIsDraining)
+          Drain();
+      }
+    }
+    return isShuttingDown;
+  }
+
+  // Stops accepting connections and reading requests. Requests already read are still answered, and each connection
+  // is closed once its responses are sent; Run returns when none remain.
+  void Drain() {
+    mIsDraining = true;
+    cout << "Draining " << mConnections.size() << " connection(s)" << endl;
+    if (mListenFd.Get() >= 0) {
+      epoll_ctl(mEpollFd.Get(), EPOLL_CTL_DEL, mListenFd.Get(), nullptr);
+      // Only this process's copy is closed when the socket is shared with a supervisor, which keeps listening
+      if (!mIsListenFdInherited)
+        unlink(mSocketPath.c_str());
+      mListenFd.Reset();
+    }
+
+    vector<int> fds;
+    for (const auto& connection : mConnections)
+      fds.push_back(connection.first);
+    for (int fd : fds) {
+      auto it = mConnections.find(fd);
+      it->second->isDraining = true;
+      UpdateConnection(it, AnswerRequests(*it->second));
+    }
+  }
+
+  void Listen() {
+    mEpollFd.Reset(epoll_create1(EPOLL_CLOEXEC));
+    if (mEpollFd.Get() < 0)
+      throw runtime_error(ErrnoMessage("epoll_create1"));
+
+    if (pipe(gShutdownPipe) != 0)
+      throw runtime_error(ErrnoMessage("pipe"));
+    SetNonBlocking(gShutdownPipe[0]);
+    SetNonBlocking(gShutdownPipe[1]);
+    AddToEpoll(gShutdownPipe[0], EPOLLIN);
+
+    struct sigaction shutdownAction;
+    memset(&shutdownAction, 0, sizeof(shutdownAction));
+    shutdownAction.sa_handler = OnShutdownSignal;
+    sigemptyset(&shutdownAction.sa_mask);
+    sigaction(SIGINT, &shutdownAction, nullptr);
+    sigaction(SIGTERM, &shutdownAction, nullptr);
+    shutdownAction.sa_handler = OnDrainSignal;
+    sigaction(SIGUSR1, &shutdownAction, nullptr);
+
+    if (!mIsListenFdInherited) {
+      mListenFd.Reset(BindSocket(mSocketPath));
+      AddToEpoll(mListenFd.Get(), EPOLLIN);
+      return;
+    }
+
+#ifdef EPOLLEXCLUSIVE
+    // Wake only one of the processes sharing the socket per connection
+    AddToEpoll(mListenFd.Get(), EPOLLIN | EPOLLEXCLUSIVE);
+#else
+    AddToEpoll(mListenFd.Get(), EPOLLIN);
+#endif // EPOLLEXCLUSIVE
+  }
+
+  void AddToEpoll(int fd, uint32_t events) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(mEpollFd.Get(), EPOLL_CTL_ADD, fd, &event) != 0)
+      throw runtime_error(ErrnoMessage("epoll_ctl"));
+  }
+
+  // Waits for input only while the connection can accept more, and for writability only while output is pending
+  void UpdateEpoll(Connection& connection) {
+    uint32_t events = 0;
+    if (!connection.ShouldPauseRead())
+      events |= EPOLLIN;
+    if (connection.PendingOutput() > 0)
+      events |= EPOLLOUT;
+    if (events == connection.epollEvents)
+      return;
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = connection.fd.Get();
+    if (epoll_ctl(mEpollFd.Get(), EPOLL_CTL_MOD, connection.fd.Get(), &event) == 0)
+      connection.epollEvents = events;
+  }
+
+  void Accept() {
+    for (;;) {
+      int fd = accept4(mListenFd.Get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          cout << "WARNING: " << ErrnoMessage("accept") << endl;
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+
+      unique_ptr<Connection> connection(new Connection(fd, mNextConnectionId++));
+      AddToEpoll(fd, EPOLLIN);
+      mConnections[fd] = std::move(connection);
+    }
+  }
+
+  void OnConnectionEvent(int fd, uint32_t events) {
+    auto it = mConnections.find(fd);
+    if (it == mConnections.end())
+      return;
+    Connection& connection = *it->second;
+
+    bool isOpen = true;
+    if (events & EPOLLIN)
+      isOpen = ReadRequests(connection);
+    else if (events & (EPOLLERR | EPOLLHUP))
+      isOpen = false;
+    if (isOpen)
+      isOpen = AnswerRequests(connection);
+    UpdateConnection(it, isOpen);
+  }
+
+  // Closes the connection if it failed or is done, otherwise updates which events it waits for
+  void UpdateConnection(unordered_map<int, unique_ptr<Connection>>::iterator it, bool isOpen) {
+    Connection& connection = *it->second;
+
+    // A client that has finished sending, or any client while draining, is closed once every complete request it sent
+    // has been answered. Responses still being computed for a closed connection are discarded when they complete.
+    if ((connection.isPeerClosed || connection.isDraining) && connection.PendingOutput() == 0 && connection.RequestsInFlight() == 0)
+      isOpen = false;
+
+    if (!isOpen) {
+      mConnections.erase(it); // closing the fd also removes it from the epoll set
+      return;
+    }
+
+    UpdateEpoll(connection);
+  }
+
+  // Reads everything available without blocking. Returns false if the connection failed.
+  bool ReadRequests(Connection& connection) {
+    char buffer[kReadChunkSize];
+    while (!connection.ShouldPauseRead()) {
+      ssize_t count = recv(connection.fd.Get(), buffer, sizeof(buffer), 0);
+      if (count > 0) {
+        connection.in.append(buffer, count);
+      } else if (count == 0) {
+        connection.isPeerClosed = true;
+      } else if (errno != EINTR) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+    }
+    return true;
+  }
+
+  // Answers complete frames from the input buffer and sends the responses, for as long as the client keeps up with the
+  // output. Returns false on a protocol violation or write failure.
+  bool AnswerRequests(Connection& connection) {
+    bool hasMoreFrames = true;
+    while (hasMoreFrames) {
+      size_t offset = 0;
+      hasMoreFrames = false;
+      while (connection.in.size() - offset >= 4) {
+        uint32_t length = ReadBigEndian32(connection.in.data() + offset);
+        if (length == 0 || length > sample::upe::kMaxFrameLength)
+          return false;
+        if (connection.in.size() - offset - 4 < length)
+          break;
+        if (connection.PendingOutput() > kMaxPendingOutput) {
+          hasMoreFrames = true;
+          break;
+        }
+        if (!mWorkers.empty() && connection.RequestsInFlight() >= kMaxRequestsInFlight)
+          break; // resumed as responses complete
+
+        const char* frame = connection.in.data() + offset + 4;
+        if (mWorkers.empty()) {
+          Clock::time_point arrival = Clock::now();
+          HandleRequest(static_cast<uint8_t>(frame[0]), string(frame + 1, length - 1), connection.out);
+          mLatencies[static_cast<size_t>(GetLane(static_cast<uint8_t>(frame[0])))].Record(Clock::now() - arrival);
+        } else {
+          DispatchRequest(connection, static_cast<uint8_t>(frame[0]), string(frame + 1, length - 1));
+        }
+        offset += 4 + length;
+      }
+      connection.in.erase(0, offset);
+
+      if (!WriteResponses(connection))
+        return false;
+      if (connection.PendingOutput() > 0)
+        break; // resumed on EPOLLOUT
+    }
+    return true;
+  }
+
+  void HandleRequest(uint8_t type, const string& payload, string& out) {
+    size_t frameStart = out.size();
+    out.append(5, '\0'); // length and status are filled in below
+
+    sample::upe::ResponseStatus status = sample::upe::ResponseStatus::Ok;
+    bool isStale = false;
+    try {
+      bool isEncoded = (type & sample::upe::kEncodedResponse) != 0;
+      switch (GetRequestType(type)) {
+        case sample::upe::RequestType::ShowLabel: {
+          sample::upe::ExecutionStateImpl state(sample::upe::ParseExecutionStateJson(payload, mDefaults));
+          if (isEncoded)
+            GetEncoder().EncodeContentLabel(mAction.GetSensitivityLabel(state, &isStale), out);
+          else
+            mAction.WriteSensitivityLabelJson(state, out, &isStale);
+          break;
+        }
+        case sample::upe::RequestType::ComputeActions: {
+          sample::upe::ExecutionStateImpl state(sample::upe::ParseExecutionStateJson(payload, mDefaults));
+          if (isEncoded)
+            GetEncoder().EncodeActions(mAction.GetActions(state, &isStale), out);
+          else
+            mAction.WriteActionsJson(state, out, &isStale);
+          break;
+        }
+        case sample::upe::RequestType::ListLabels: {
+          if (isEncoded) {
+            GetEncoder().EncodeLabels(mAction.GetLabels(), out);
+            break;
+          }
+          out += '[';
+          bool first = true;
+          for (const shared_ptr<mip::Label>& label : mAction.GetLabels()) {
+            if (!first)
+              out += ',';
+            first = false;
+            sample::upe::AppendLabelJson(label, out);
+          }
+          out += ']';
+          break;
+        }
+        case sample::upe::RequestType::ShowDefaultLabel: {
+          shared_ptr<mip::Label> label = mAction.GetDefaultLabel();
+          if (isEncoded) {
+            vector<shared_ptr<mip::Label>> labels;
+            if (nullptr != label)
+              labels.push_back(label);
+            GetEncoder().EncodeLabels(labels, out);
+          } else if (nullptr != label) {
+            sample::upe::AppendLabelJson(label, out);
+          } else {
+            out += "null";
+          }
+          break;
+        }
+        default:
+          throw runtime_error("Unrecognized request type " + std::to_string(type));
+      }
+      if (isStale)
+        status = sample::upe::ResponseStatus::Stale;
+    } catch (const exception& ex) {
+      status = sample::upe::ResponseStatus::Error;
+      out.resize(frameStart + 5);
+      out += ex.what();
+    }
+
+    string header;
+    AppendBigEndian32(static_cast<uint32_t>(out.size() - frameStart - 4), header);
+    header += static_cast<char>(status);
+    out.replace(frameStart, 5, header);
+    mAction.GetStartupTimeline().Record(sample::upe::StartupTimeline::Stage::FirstResult); // no-op after the first
+  }
+
+  void StartWorkers() {
+    if (mOptions.threadCount <= 1)
+      return;
+
+    mCompletionFd.Reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (mCompletionFd.Get() < 0)
+      throw runtime_error(ErrnoMessage("eventfd"));
+    AddToEpoll(mCompletionFd.Get(), EPOLLIN);
+    for (size_t i = 0; i < mOptions.threadCount; ++i)
+      mWorkers.emplace_back([this, i] { WorkerLoop(i); });
+  }
+
+  // Lets running requests finish and drops queued ones
+  void StopWorkers() {
+    mScheduler.Close();
+    for (std::thread& worker : mWorkers)
+      worker.join();
+    mWorkers.clear();
+  }
+
+  void DispatchRequest(Connection& connection, uint8_t type, string payload) {
+    unique_ptr<PendingRequest> request(new PendingRequest());
+    request->fd = connection.fd.Get();
+    request->connectionId = connection.id;
+    request->sequence = connection.nextRequest++;
+    request->type = type;
+    request->lane = GetLane(type);
+    request->arrival = Clock::now();
+    request->payload = std::move(payload);
+
+    uint64_t sequence = request->sequence;
+    sample::upe::RequestLane lane = request->lane;
+    std::chrono::milliseconds retryAfter(0);
+    if (mScheduler.TryPush(lane, std::move(request), retryAfter))
+      return;
+
+    // Rejected without reading the payload, in order with the connection's other responses
+    string response;
+    string retryAfterText = std::to_string(retryAfter.count());
+    AppendBigEndian32(static_cast<uint32_t>(1 + retryAfterText.size()), response);
+    response += static_cast<char>(sample::upe::ResponseStatus::Overloaded);
+    response += retryAfterText;
+    FinishResponse(connection, sequence, std::move(response));
+  }
+
+  void WorkerLoop(size_t workerIndex) {
+    sample::upe::Action::PinThreadToEngineReplica(workerIndex);
+    unique_ptr<PendingRequest> request;
+    sample::upe::RequestLane lane;
+    while (mScheduler.Pop(request, lane)) {
+      Clock::time_point start = Clock::now();
+      HandleRequest(request->type, request->payload, request->response);
+      Clock::time_point end = Clock::now();
+      mScheduler.RecordServiceTime(lane, end - start);
+      mLatencies[static_cast<size_t>(lane)].Record(end - request->arrival);
+      {
+        lock_guard<mutex> lock(mCompletedMutex);
+        mCompleted.push_back(std::move(request));
+      }
+      uint64_t one = 1;
+      ssize_t ignored = write(mCompletionFd.Get(), &one, sizeof(one));
+      (void)ignored;
+    }
+  }
+
+  // Queues completed responses on their connections in request order, then lets those connections continue
+  void OnRequestsCompleted() {
+    uint64_t count;
+    ssize_t ignored = read(mCompletionFd.Get(), &count, sizeof(count));
+    (void)ignored;
+
+    vector<unique_ptr<PendingRequest>> completed;
+    {
+      lock_guard<mutex> lock(mCompletedMutex);
+      completed.swap(mCompleted);
+    }
+
+    vector<int> updatedFds;
+    for (unique_ptr<PendingRequest>& request : completed) {
+      auto it = mConnections.find(request->fd);
+      if (it == mConnections.end() || it->second->id != request->connectionId)
+        continue; // the connection was closed meanwhile
+      FinishResponse(*it->second, request->sequence, std::move(request->response));
+      updatedFds.push_back(request->fd);
+    }
+
+    std::sort(updatedFds.begin(), updatedFds.end());
+    updatedFds.erase(std::unique(updatedFds.begin(), updatedFds.end()), updatedFds.end());
+    for (int fd : updatedFds) {
+      auto it = mConnections.find(fd);
+      if (it != mConnections.end())
+        UpdateConnection(it, AnswerRequests(*it->second));
+    }
+  }
+
+  // Queues the response, and any later ones it was holding up, once every earlier response on the connection is queued
+  void FinishResponse(Connection& connection, uint64_t sequence, string response) {
+    connection.finishedResponses[sequence] = std::move(response);
+    for (auto next = connection.finishedResponses.begin();
+        next != connection.finishedResponses.end() && next->first == connection.nextResponse;
+        next = connection.finishedResponses.erase(next)) {
+      connection.out += next->second;
+      ++connection.nextResponse;
+    }
+  }
+
+  void PrintStatistics(std::ostream& output) const {
+    output << "SCHEDULER:\n";
+    for (size_t i = 0; i < static_cast<size_t>(sample::upe::RequestLane::Count); ++i) {
+      sample::upe::RequestLane lane = static_cast<sample::upe::RequestLane>(i);
+      output << "  " << GetLaneName(lane) << ": ";
+      mLatencies[i].Print(output);
+      if (mOptions.threadCount > 1) {
+        sample::upe::PriorityScheduler<unique_ptr<PendingRequest>>::LaneStatistics statistics =
+            mScheduler.GetStatistics(lane);
+        output << ", weight " << mScheduler.GetWeight(lane) << ", " << statistics.rejected << " rejected, " <<
+            "at most " << statistics.maxDepth << " queued";
+      }
+      output << "\n";
+    }
+    output.flush();
+  }
+
+  // Returns false if the connection should be closed
+  bool WriteResponses(Connection& connection) {
+    while (connection.outOffset < connection.out.size()) {
+      ssize_t count = send(
+          connection.fd.Get(),
+          connection.out.data() + connection.outOffset,
+          connection.out.size() - connection.outOffset,
+          MSG_NOSIGNAL);
+      if (count > 0) {
+        connection.outOffset += count;
+        continue;
+      }
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      return false;
+    }
+
+    // Reuse the buffer once fully drained, or compact it once mostly drained
+    if (connection.outOffset == connection.out.size()) {
+      connection.out.clear();
+      connection.outOffset = 0;
+    } else if (connection.outOffset > connection.out.size() / 2) {
+      connection.out.erase(0, connection.outOffset);
+      connection.outOffset = 0;
+    }
+    return true;
+  }
+
+  sample::upe::Action& mAction;
+  string mSocketPath;
+  sample::upe::ExecutionStateOptions mDefaults;
+  const sample::upe::ServerOptions mOptions;
+  ScopedFd mEpollFd;
+  ScopedFd mListenFd;
+  const bool mIsListenFdInherited;
+  bool mIsDraining;
+  unordered_map<int, unique_ptr<Connection>> mConnections;
+  uint64_t mNextConnectionId;
+
+  // Worker threads, when mOptions.threadCount > 1. Completed requests are handed back to the epoll thread through
+  // mCompletionFd.
+  vector<std::thread> mWorkers;
+  sample::upe::PriorityScheduler<unique_ptr<PendingRequest>> mScheduler;
+  // Time from reading each request to its response being ready, per lane
+  sample::upe::LatencyHistogram mLatencies[static_cast<size_t>(sample::upe::RequestLane::Count)];
+  mutex mCompletedMutex;
+  vector<unique_ptr<PendingRequest>> mCompleted;
+  ScopedFd mCompletionFd;
+};
+
+// Set by the supervisor's SIGINT/SIGTERM handler
+volatile sig_atomic_t gIsSupervisorStopping = 0;
+
+extern "C" void OnSupervisorShutdownSignal(int) {
+  gIsSupervisorStopping = 1;
+}
+
+// Forks worker processes that each serve connections accepted from one shared listening socket, using the profile
+// and engine the supervisor loaded before forking. Only the forking thread exists in a worker, so workers never load
+// engines or receive policy change notifications of their own: the supervisor does, and replaces its workers once a
+// reloaded engine is published. Workers that exit unexpectedly are replaced from the supervisor's loaded state.
+//
+// The supervisor is multithreaded when it forks (SDK threads, reloads, replica loads), so every fork is bracketed by
+// Action::PrepareFork, which waits for that background work and holds the Action's locks across fork(). Locks internal
+// to the SDK are out of its reach: a worker that inherits one held would hang on its first request.
+class PreforkSupervisor {
+public:
+  PreforkSupervisor(
+      sample::upe::Action& action,
+      const string& socketPath,
+      const sample::upe::ExecutionStateOptions& defaults,
+      const sample::upe::ServerOptions& options)
+      : mAction(action),
+        mSocketPath(socketPath),
+        mDefaults(defaults),
+        mOptions(options),
+        mWorkers(options.workerProcesses),
+        mRestarts(0),
+        mPolicyRestarts(0) {}
+
+  ~PreforkSupervisor() {
+    if (mListenFd.Get() >= 0)
+      unlink(mSocketPath.c_str());
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+  }
+
+  void Run() {
+    mListenFd.Reset(BindSocket(mSocketPath));
+
+    gIsSupervisorStopping = 0;
+    struct sigaction shutdownAction;
+    memset(&shutdownAction, 0, sizeof(shutdownAction));
+    shutdownAction.sa_handler = OnSupervisorShutdownSignal;
+    sigemptyset(&shutdownAction.sa_mask);
+    sigaction(SIGINT, &shutdownAction, nullptr);
+    sigaction(SIGTERM, &shutdownAction, nullptr);
+
+    for (Worker& worker : mWorkers)
+      StartWorker(worker);
+    cout << "Supervising " << mWorkers.size() << " worker processes serving on '" << mSocketPath << "'" << endl;
+
+    uint64_t publishedReloads = mAction.GetPublishedReloadCount();
+    while (!gIsSupervisorStopping) {
+      int status = 0;
+      pid_t pid = waitpid(-1, &status, WNOHANG);
+      if (pid > 0) {
+        OnWorkerExited(pid, status);
+        continue;
+      }
+
+      if (mAction.GetPublishedReloadCount() != publishedReloads) {
+        publishedReloads = mAction.GetPublishedReloadCount();
+        ReplaceWorkers();
+      }
+      KillStuckWorkers();
+
+      Clock::time_point now = Clock::now();
+      for (Worker& worker : mWorkers) {
+        if (worker.pid < 0 && worker.restartTime <= now)
+          StartWorker(worker);
+      }
+
+      // Interrupted early by a shutdown signal
+      timespec pollInterval = { 0, kPollIntervalMs * 1000 * 1000 };
+      nanosleep(&pollInterval, nullptr);
+    }
+
+    cout << "Shutting down, stopping " << mWorkers.size() << " worker processes" << endl;
+    StopWorkers();
+    if (nullptr != mOptions.statistics) {
+      *mOptions.statistics << "SUPERVISOR: " << mWorkers.size() << " workers, " << mRestarts <<
+          " restarted after exiting unexpectedly, " << mPolicyRestarts << " replaced after policy changes" << endl;
+    }
+  }
+
+private:
+  struct Worker {
+    pid_t pid = -1;
+    Clock::time_point startTime;
+    Clock::time_point restartTime; // when to replace a worker that exited
+  };
+
+  // A worker draining after it was replaced
+  struct RetiredWorker {
+    pid_t pid = -1;
+    Clock::time_point killTime;
+    bool isKilled = false;
+  };
+
+  // Workers exiting sooner than this after starting are replaced only after this long, so one failing at startup
+  // does not spin the supervisor
+  static const int kMinWorkerLifetimeMs = 1000;
+  static const long kPollIntervalMs = 50;
+  static const int kStopTimeoutMs = 5000;
+
+  void StartWorker(Worker& worker) {
+    // Anything still buffered would otherwise be written again by the worker
+    cout.flush();
+    std::cerr.flush();
+    // The supervisor keeps SDK and reload threads running; no lock any of them may hold is copied into the worker
+    mAction.PrepareFork();
+    pid_t pid = fork();
+    if (pid == 0) {
+      mAction.AfterForkInChild();
+      RunWorker();
+    }
+    mAction.AfterForkInParent();
+    if (pid < 0) {
+      std::cerr << "ERROR: " << ErrnoMessage("fork") << endl;
+      worker.restartTime = Clock::now() + std::chrono::milliseconds(kMinWorkerLifetimeMs);
+      return;
+    }
+
+    worker.pid = pid;
+    worker.startTime = Clock::now();
+  }
+
+  // Runs in the forked worker and never returns
+  void RunWorker() {
+    int exitCode = 0;
+    try {
+      UnixSocketServer server(mAction, mSocketPath, mDefaults, mOptions, mListenFd.Release());
+      server.Run();
+    } catch (const exception& ex) {
+      cout << "ERROR: Worker " << getpid() << " failed: " << ex.what() << endl;
+      exitCode = 1;
+    }
+
+    // Skip the Action's destructor: releasing the SDK waits on threads that only exist in the supervisor
+    cout.flush();
+    std::cerr.flush();
+    _exit(exitCode);
+  }
+
+  void OnWorkerExited(pid_t pid, int status) {
+    auto retired = std::find_if(mRetiredWorkers.begin(), mRetiredWorkers.end(),
+        [pid](const RetiredWorker& worker) { return worker.pid == pid; });
+    if (retired != mRetiredWorkers.end()) {
+      mRetiredWorkers.erase(retired);
+      return;
+    }
+
+    for (Worker& worker : mWorkers) {
+      if (worker.pid != pid)
+        continue;
+      worker.pid = -1;
+      ++mRestarts;
+      std::cerr << "WARNING: Worker " << pid << (WIFSIGNALED(status) ? " killed by signal " : " exited with status ") <<
+          (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status)) << ", restarting it" << endl;
+      Clock::time_point now = Clock::now();
+      worker.restartTime = now - worker.startTime < std::chrono::milliseconds(kMinWorkerLifetimeMs) ?
+          now + std::chrono::milliseconds(kMinWorkerLifetimeMs) : now;
+      return;
+    }
+  }
+
+  // Starts each worker's replacement from the reloaded engine before asking the previous worker to drain: it stops
+  // accepting connections, answers the requests it has already read, then closes its connections, whose clients
+  // reconnect to the new workers. A worker still running after kStopTimeoutMs is killed (see KillStuckWorkers).
+  void ReplaceWorkers() {
+    cout << "Policy changed, replacing worker processes" << endl;
+    Clock::time_point killTime = Clock::now() + std::chrono::milliseconds(kStopTimeoutMs);
+    for (Worker& worker : mWorkers) {
+      if (worker.pid < 0)
+        continue;
+      RetiredWorker retired;
+      retired.pid = worker.pid;
+      retired.killTime = killTime;
+      StartWorker(worker);
+      kill(retired.pid, SIGUSR1);
+      mRetiredWorkers.push_back(retired);
+      ++mPolicyRestarts;
+    }
+  }
+
+  void KillStuckWorkers() {
+    Clock::time_point now = Clock::now();
+    for (RetiredWorker& worker : mRetiredWorkers) {
+      if (!worker.isKilled && worker.killTime <= now) {
+        std::cerr << "WARNING: Worker " << worker.pid << " did not finish draining, killing it" << endl;
+        kill(worker.pid, SIGKILL);
+        worker.isKilled = true;
+      }
+    }
+  }
+
+  // Asks every worker to shut down, then kills those still running after kStopTimeoutMs
+  void StopWorkers() {
+    vector<pid_t> pids;
+    for (const RetiredWorker& worker : mRetiredWorkers)
+      pids.push_back(worker.pid);
+    for (Worker& worker : mWorkers) {
+      if (worker.pid >= 0)
+        pids.push_back(worker.pid);
+      worker.pid = -1;
+    }
+    for (pid_t pid : pids)
+      kill(pid, SIGTERM);
+
+    Clock::time_point killTime = Clock::now() + std::chrono::milliseconds(kStopTimeoutMs);
+    while (!pids.empty()) {
+      pid_t pid = waitpid(-1, nullptr, Clock::now() < killTime ? WNOHANG : 0);
+      if (pid > 0) {
+        pids.erase(std::remove(pids.begin(), pids.end(), pid), pids.end());
+      } else if (pid == 0) {
+        if (Clock::now() >= killTime) {
+          for (pid_t remaining : pids)
+            kill(remaining, SIGKILL);
+        }
+        timespec pollInterval = { 0, kPollIntervalMs * 1000 * 1000 };
+        nanosleep(&pollInterval, nullptr);
+      } else if (errno != EINTR) {
+        break;
+      }
+    }
+    mRetiredWorkers.clear();
+  }
+
+  sample::upe::Action& mAction;
+  string mSocketPath;
+  sample::upe::ExecutionStateOptions mDefaults;
+  const sample::upe::ServerOptions mOptions;
+  ScopedFd mListenFd;
+  vector<Worker> mWorkers;
+  vector<RetiredWorker> mRetiredWorkers; // replaced after a policy change, not yet exited
+  uint64_t mRestarts;
+  uint64_t mPolicyRestarts;
+};
+
+} // namespace
+
+#endif // __linux__
+
+namespace sample {
+namespace upe {
+
+void RunServer(
+    Action& action,
+    const string& socketPath,
+    const ExecutionStateOptions& defaults,
+    const ServerOptions& options) {
+#ifdef __linux__
+  // Load the engine before accepting connections so the first client does not pay for it. Worker processes inherit
+  // it, along with any precomputed action plans.
+  action.GetLabels();
+  action.GetDefaultLabel();
+
+  if (options.workerProcesses > 0) {
+    PreforkSupervisor supervisor(action, socketPath, defaults, options);
+    supervisor.Run();
+    return;
+  }
+
+  UnixSocketServer server(action, socketPath, defaults, options);
+  server.Run();
+#else
+  (void)action;
+  (void)socketPath;
+  (void)defaults;
+  (void)options;
+  throw runtime_error("--serve is only supported on Linux");
+#endif // __linux__
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,107 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_SERVER_H_
+#define SAMPLES_UPE_SERVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "action.h"
+#include "execution_state_impl.h"
+#include "priority_scheduler.h"
+
+namespace sample {
+namespace upe {
+
+// Framed protocol spoken over the --serve Unix domain socket. Every frame, in both directions, is a 4-byte big-endian
+// length followed by that many bytes: a 1-byte type and a UTF-8 payload.
+//
+//   Request:  [length][RequestType][JSON execution state, or empty for ListLabels/ShowDefaultLabel]
+//   Response: [length][ResponseStatus][JSON result, error message, or retry delay in milliseconds if Overloaded]
+//
+// Requests on one connection are answered in order. Execution state payloads use the same JSON format as batch input
+// lines (see ParseExecutionStateJson), and results use the same JSON format as batch output, or the binary encoding of
+// result_encoding.h if the request type is combined with kEncodedResponse.
+enum class RequestType : uint8_t {
+  ShowLabel = 1,
+  ComputeActions = 2,
+  ListLabels = 3,
+  ShowDefaultLabel = 4,
+};
+
+// Request type flag asking for an encoded result (see EncodedResult) instead of JSON. ShowDefaultLabel answers with a
+// Labels result holding no label or one, and ShowLabel with a ContentLabel result. Error messages remain text.
+const uint8_t kEncodedResponse = 0x80;
+
+enum class ResponseStatus : uint8_t {
+  Ok = 0,
+  Error = 1,
+  Stale = 2, // the request's deadline passed, this is the last result computed for its identity and execution state
+  Overloaded = 3, // the request's lane was full, retry after the given number of milliseconds
+};
+
+struct ServerOptions {
+  size_t threadCount = 1; // per worker process, if any
+  // When set, this process only supervises this many forked worker processes, which serve the engine loaded before
+  // forking (see RunServer)
+  size_t workerProcesses = 0;
+  // With worker threads, ComputeActions requests are queued in the bulk lane and all others in the interactive lane
+  SchedulerOptions scheduler;
+  // When set, receives per-lane latency and admission statistics on shutdown
+  std::ostream* statistics = nullptr;
+};
+
+// Largest frame accepted from a client. Connections sending larger frames are closed.
+const uint32_t kMaxFrameLength = 16 * 1024 * 1024;
+
+// Listens on 'socketPath' and answers requests against the single profile/engine held by 'action' until SIGINT or
+// SIGTERM is received. All connections are multiplexed on one epoll loop, which also answers the requests when
+// 'threadCount' is 1. Otherwise requests are answered by 'threadCount' worker threads, still in order per connection,
+// which share their time between the interactive and bulk lanes by weight (see PriorityScheduler). Fields missing from
+// a request take their value from 'defaults'. Throws std::runtime_error if the socket cannot be created or the
+// platform has no epoll.
+//
+// With 'workerProcesses', the engine is loaded once and then that many worker processes are forked, each serving as
+// above from a copy-on-write snapshot of it and sharing the listening socket. A worker that crashes (e.g. in the SDK)
+// is restarted from the same snapshot without reloading the policy. After a policy change the workers are replaced from
+// the reloaded engine, and the previous workers drain: they stop accepting connections, answer the requests they have
+// already read, then close their connections and exit. Workers contain only the forking thread of this process, so they
+// can evaluate requests against the loaded engine but cannot load another: execution states naming an identity whose
+// engine was not loaded before forking fail.
+void RunServer(
+    Action& action,
+    const std::string& socketPath,
+    const ExecutionStateOptions& defaults,
+    const ServerOptions& options);
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_SERVER_H_
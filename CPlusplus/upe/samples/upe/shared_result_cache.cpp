@@ -0,0 +1,330 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "shared_result_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+using std::memory_order_acq_rel;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::runtime_error;
+using std::string;
+
+namespace {
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "SharedResultCache needs address-free (always lock-free) 64-bit atomics"
+#endif
+
+const uint64_t kMagic = 0x5550455243414348ull; // "UPERCACH"
+const size_t kHeaderBytes = 128;
+const size_t kSlotAlignment = 64;
+// Slots a key may occupy, starting at the one its hash selects
+const uint64_t kProbeCount = 4;
+// How long to wait for the process creating the segment to initialize it
+const int kInitializeTimeoutMs = 1000;
+
+string ErrnoMessage(const string& operation) {
+  return operation + " failed: " + strerror(errno);
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+uint64_t SharedResultCache::GetHash(const string& data) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+struct SharedResultCache::SegmentHeader {
+  std::atomic<uint64_t> magic; // kMagic once the creating process has initialized the segment
+  uint64_t slotCount;
+  uint64_t slotBytes;
+  std::atomic<uint64_t> generation;
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> inserts;
+};
+
+// Followed in the segment by the key and then the value bytes
+struct SharedResultCache::Slot {
+  std::atomic<uint64_t> sequence; // odd while being written
+  std::atomic<uint64_t> hash;
+  std::atomic<uint64_t> generation;
+  std::atomic<uint32_t> keyBytes; // 0 if the slot is empty
+  std::atomic<uint32_t> valueBytes;
+
+  char* GetData() { return reinterpret_cast<char*>(this + 1); }
+};
+
+#ifndef _WIN32
+
+SharedResultCache::SharedResultCache(const string& name, size_t slotCount, size_t slotBytes)
+    : mName(name),
+      mSegment(nullptr),
+      mSegmentBytes(0),
+      mHeader(nullptr),
+      mHits(0),
+      mMisses(0),
+      mInserts(0) {
+  static_assert(sizeof(SegmentHeader) <= kHeaderBytes, "SegmentHeader does not fit in kHeaderBytes");
+  if (slotCount == 0)
+    throw runtime_error("Shared result cache needs at least one slot");
+  slotBytes = (std::max(slotBytes, sizeof(Slot) + 1) + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+
+  // Exactly one process creates and initializes the segment; the others wait for it. A creator that died before
+  // initializing it leaves a segment nobody could ever use, so a process giving up on it unlinks the name and creates
+  // the segment itself. Processes still mapping a segment unlinked that way keep it, unshared.
+  for (int attempt = 0; ; ++attempt) {
+    if (Open(name, slotCount, slotBytes))
+      return;
+    if (attempt > 0)
+      throw runtime_error("Shared memory segment '" + name + "' was not initialized");
+    shm_unlink(name.c_str());
+  }
+}
+
+// Maps the segment, creating and initializing it if it does not exist. Returns false if an existing segment was not
+// initialized within kInitializeTimeoutMs.
+bool SharedResultCache::Open(const string& name, size_t slotCount, size_t slotBytes) {
+  bool isCreator = true;
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    isCreator = false;
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+  }
+  if (fd < 0)
+    throw runtime_error(ErrnoMessage("shm_open '" + name + "'"));
+
+  size_t segmentBytes = kHeaderBytes + slotCount * slotBytes;
+  if (isCreator) {
+    if (ftruncate(fd, static_cast<off_t>(segmentBytes)) != 0) {
+      string error = ErrnoMessage("ftruncate");
+      close(fd);
+      shm_unlink(name.c_str());
+      throw runtime_error(error);
+    }
+  } else {
+    struct stat segmentStat;
+    for (int waitedMs = 0; ; ++waitedMs) {
+      if (fstat(fd, &segmentStat) != 0 || segmentStat.st_size >= static_cast<off_t>(kHeaderBytes) ||
+          waitedMs >= kInitializeTimeoutMs)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    segmentBytes = static_cast<size_t>(segmentStat.st_size);
+    if (segmentBytes < kHeaderBytes) {
+      close(fd);
+      return false;
+    }
+  }
+
+  void* segment = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+    throw runtime_error(ErrnoMessage("mmap"));
+  mSegment = segment;
+  mSegmentBytes = segmentBytes;
+
+  if (isCreator) {
+    mHeader = new (mSegment) SegmentHeader();
+    mHeader->slotCount = slotCount;
+    mHeader->slotBytes = slotBytes;
+    mHeader->generation.store(0, memory_order_relaxed);
+    mHeader->hits.store(0, memory_order_relaxed);
+    mHeader->misses.store(0, memory_order_relaxed);
+    mHeader->inserts.store(0, memory_order_relaxed);
+    for (uint64_t i = 0; i < slotCount; ++i) {
+      Slot* slot = new (static_cast<char*>(mSegment) + kHeaderBytes + i * slotBytes) Slot();
+      slot->sequence.store(0, memory_order_relaxed);
+      slot->keyBytes.store(0, memory_order_relaxed);
+    }
+    mHeader->magic.store(kMagic, memory_order_release);
+    return true;
+  }
+
+  // An existing segment keeps its own layout
+  mHeader = static_cast<SegmentHeader*>(mSegment);
+  for (int waitedMs = 0; mHeader->magic.load(memory_order_acquire) != kMagic; ++waitedMs) {
+    if (waitedMs >= kInitializeTimeoutMs) {
+      munmap(mSegment, mSegmentBytes);
+      mSegment = nullptr;
+      mSegmentBytes = 0;
+      mHeader = nullptr;
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (mHeader->slotCount == 0 || kHeaderBytes + mHeader->slotCount * mHeader->slotBytes > mSegmentBytes) {
+    munmap(mSegment, mSegmentBytes);
+    throw runtime_error("Shared memory segment '" + name + "' has an unexpected layout");
+  }
+  return true;
+}
+
+SharedResultCache::~SharedResultCache() {
+  munmap(mSegment, mSegmentBytes);
+}
+
+#else
+
+SharedResultCache::SharedResultCache(const string& name, size_t, size_t)
+    : mName(name),
+      mSegment(nullptr),
+      mSegmentBytes(0),
+      mHeader(nullptr),
+      mHits(0),
+      mMisses(0),
+      mInserts(0) {
+  throw runtime_error("Shared result cache is not supported on this platform");
+}
+
+SharedResultCache::~SharedResultCache() {}
+
+#endif // _WIN32
+
+SharedResultCache::Slot& SharedResultCache::GetSlot(uint64_t index) const {
+  return *reinterpret_cast<Slot*>(static_cast<char*>(mSegment) + kHeaderBytes + index * mHeader->slotBytes);
+}
+
+bool SharedResultCache::Find(const string& key, string& value) {
+  uint64_t hash = GetHash(key);
+  uint64_t generation = mHeader->generation.load(memory_order_acquire);
+  string candidate;
+  for (uint64_t probe = 0; probe < kProbeCount; ++probe) {
+    Slot& slot = GetSlot((hash + probe) % mHeader->slotCount);
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+    if ((sequence & 1) != 0 || slot.hash.load(memory_order_relaxed) != hash ||
+        slot.generation.load(memory_order_relaxed) != generation ||
+        slot.keyBytes.load(memory_order_relaxed) != key.size())
+      continue;
+
+    // Copied before being checked, since a writer may be overwriting the slot meanwhile
+    size_t valueBytes = slot.valueBytes.load(memory_order_relaxed);
+    if (sizeof(Slot) + key.size() + valueBytes > mHeader->slotBytes)
+      continue;
+    candidate.assign(slot.GetData(), key.size() + valueBytes);
+    std::atomic_thread_fence(memory_order_acquire);
+    if (slot.sequence.load(memory_order_relaxed) != sequence || candidate.compare(0, key.size(), key) != 0)
+      continue;
+
+    value.append(candidate, key.size(), valueBytes);
+    ++mHits;
+    mHeader->hits.fetch_add(1, memory_order_relaxed);
+    return true;
+  }
+
+  ++mMisses;
+  mHeader->misses.fetch_add(1, memory_order_relaxed);
+  return false;
+}
+
+void SharedResultCache::Insert(const string& key, const char* value, size_t valueBytes, uint64_t generation) {
+  if (key.empty() || sizeof(Slot) + key.size() + valueBytes > mHeader->slotBytes ||
+      mHeader->generation.load(memory_order_acquire) != generation)
+    return;
+
+  // Reuse the key's own slot or a free/outdated one among its probes, else evict the first
+  uint64_t hash = GetHash(key);
+  Slot* target = &GetSlot(hash % mHeader->slotCount);
+  for (uint64_t probe = 0; probe < kProbeCount; ++probe) {
+    Slot& slot = GetSlot((hash + probe) % mHeader->slotCount);
+    if (slot.keyBytes.load(memory_order_relaxed) == 0 || slot.generation.load(memory_order_relaxed) != generation ||
+        slot.hash.load(memory_order_relaxed) == hash) {
+      target = &slot;
+      break;
+    }
+  }
+
+  uint64_t sequence = target->sequence.load(memory_order_relaxed);
+  if ((sequence & 1) != 0 || !target->sequence.compare_exchange_strong(sequence, sequence + 1, memory_order_acquire))
+    return; // another process is writing this slot
+  std::atomic_thread_fence(memory_order_release);
+
+  target->hash.store(hash, memory_order_relaxed);
+  target->generation.store(generation, memory_order_relaxed);
+  target->keyBytes.store(static_cast<uint32_t>(key.size()), memory_order_relaxed);
+  target->valueBytes.store(static_cast<uint32_t>(valueBytes), memory_order_relaxed);
+  memcpy(target->GetData(), key.data(), key.size());
+  memcpy(target->GetData() + key.size(), value, valueBytes);
+  target->sequence.store(sequence + 2, memory_order_release);
+
+  ++mInserts;
+  mHeader->inserts.fetch_add(1, memory_order_relaxed);
+}
+
+void SharedResultCache::BumpGeneration() {
+  mHeader->generation.fetch_add(1, memory_order_acq_rel);
+}
+
+uint64_t SharedResultCache::GetGeneration() const {
+  return mHeader->generation.load(memory_order_acquire);
+}
+
+size_t SharedResultCache::GetSlotCount() const {
+  return static_cast<size_t>(mHeader->slotCount);
+}
+
+SharedResultCache::Statistics SharedResultCache::GetStatistics() const {
+  Statistics statistics;
+  statistics.hits = mHits.load();
+  statistics.misses = mMisses.load();
+  statistics.inserts = mInserts.load();
+  return statistics;
+}
+
+SharedResultCache::Statistics SharedResultCache::GetHostStatistics() const {
+  Statistics statistics;
+  statistics.hits = mHeader->hits.load(memory_order_relaxed);
+  statistics.misses = mHeader->misses.load(memory_order_relaxed);
+  statistics.inserts = mHeader->inserts.load(memory_order_relaxed);
+  return statistics;
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,112 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_SHARED_RESULT_CACHE_H_
+#define SAMPLES_UPE_SHARED_RESULT_CACHE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace sample {
+namespace upe {
+
+// Fixed-size hash table of serialized results in a named POSIX shared memory segment, so every process on the host
+// that opens the same name (including forked workers, which inherit the mapping) shares one copy of each result.
+//
+// Readers and writers never lock or block each other. Each slot holds one key/value pair guarded by a sequence number
+// that is odd while the slot is written: a writer that finds the slot busy skips the insert, and a reader that sees
+// the sequence change while copying the slot treats it as a miss. Entries are tagged with the segment's generation;
+// BumpGeneration() invalidates every entry in every process at once. Collisions evict the older entry.
+//
+// The segment outlives the processes using it. A process killed while writing a slot leaves that slot unused, and one
+// killed while creating the segment leaves it to be recreated by the next process that opens it.
+class SharedResultCache {
+public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+
+    double GetHitRate() const {
+      return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+    }
+  };
+
+  // Maps the segment 'name' (e.g. "/upe_sample_results"), creating it with 'slotCount' slots of 'slotBytes' each if it
+  // does not exist yet. An existing segment keeps the layout it was created with. Throws std::runtime_error if the
+  // segment cannot be created or mapped, or on platforms without POSIX shared memory.
+  SharedResultCache(const std::string& name, size_t slotCount, size_t slotBytes);
+  ~SharedResultCache();
+
+  // Appends the value cached for 'key' in the current generation to 'value'
+  bool Find(const std::string& key, std::string& value);
+
+  // Caches 'value' for 'key' unless the pair does not fit in a slot, the slot is being written by another process, or
+  // the generation has moved past 'generation' (read with GetGeneration() before computing the value)
+  void Insert(const std::string& key, const char* value, size_t valueBytes, uint64_t generation);
+
+  // Invalidates every entry, e.g. after a policy change, for all processes sharing the segment
+  void BumpGeneration();
+
+  uint64_t GetGeneration() const;
+
+  // 64-bit FNV-1a hash of 'data', identical in every process
+  static uint64_t GetHash(const std::string& data);
+
+  size_t GetSlotCount() const;
+  size_t GetSegmentBytes() const { return mSegmentBytes; }
+
+  // Lookups made by this process, and by every process sharing the segment since it was created
+  Statistics GetStatistics() const;
+  Statistics GetHostStatistics() const;
+
+private:
+  struct SegmentHeader;
+  struct Slot;
+
+  SharedResultCache(const SharedResultCache&);
+  SharedResultCache& operator=(const SharedResultCache&);
+
+  bool Open(const std::string& name, size_t slotCount, size_t slotBytes);
+  Slot& GetSlot(uint64_t index) const;
+
+  std::string mName;
+  void* mSegment;
+  size_t mSegmentBytes;
+  SegmentHeader* mHeader;
+  std::atomic<uint64_t> mHits;
+  std::atomic<uint64_t> mMisses;
+  std::atomic<uint64_t> mInserts;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_SHARED_RESULT_CACHE_H_
@@ -0,0 +1,128 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_SINGLE_FLIGHT_H_
+#define SAMPLES_UPE_SINGLE_FLIGHT_H_
+
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "deadline.h"
+
+namespace sample {
+namespace upe {
+
+// Coalesces concurrent computations of the same key: the first caller (the leader) computes the value while callers
+// arriving with that key before it finishes wait for and share its result, or its exception. Nothing is remembered
+// once the computation completes, so unlike ResultCache this only merges requests that overlap in time.
+template<typename Value>
+class SingleFlight {
+public:
+  struct Statistics {
+    uint64_t calls = 0;
+    uint64_t coalesced = 0; // calls answered by another caller's computation
+
+    double GetCoalescingRatio() const { return calls == 0 ? 0.0 : static_cast<double>(coalesced) / calls; }
+  };
+
+  explicit SingleFlight(bool isEnabled) : mIsEnabled(isEnabled) {}
+
+  bool IsEnabled() const { return mIsEnabled; }
+
+  // Returns compute(), or the result of the identical computation already in flight. When disabled, always computes.
+  template<typename Compute>
+  Value Run(const std::string& key, Compute compute) {
+    return Run(key, Deadline::max(), compute);
+  }
+
+  // Same, but a caller sharing another's computation throws DeadlineExceededError if it is not done by 'deadline'.
+  // The leader computes on its own thread and is not bounded.
+  template<typename Compute>
+  Value Run(const std::string& key, Deadline deadline, Compute compute) {
+    if (!mIsEnabled)
+      return compute();
+
+    std::promise<Value> leaderPromise;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      ++mStatistics.calls;
+      auto it = mFlights.find(key);
+      if (it != mFlights.end()) {
+        ++mStatistics.coalesced;
+        std::shared_future<Value> flight = it->second;
+        lock.unlock();
+        return GetBeforeDeadline(flight, deadline, "an identical evaluation in flight");
+      }
+      mFlights[key] = leaderPromise.get_future().share();
+    }
+
+    // Later callers with this key start their own computation once this one is no longer in flight
+    try {
+      Value value = compute();
+      Land(key);
+      leaderPromise.set_value(value);
+      return value;
+    } catch (...) {
+      Land(key);
+      leaderPromise.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+  Statistics GetStatistics() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStatistics;
+  }
+
+  // Keeps flights from starting or landing while the process forks (see Action::PrepareFork)
+  void LockForFork() { mMutex.lock(); }
+  void UnlockAfterFork() { mMutex.unlock(); }
+
+private:
+  SingleFlight(const SingleFlight&);
+  SingleFlight& operator=(const SingleFlight&);
+
+  void Land(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFlights.erase(key);
+  }
+
+  const bool mIsEnabled;
+  mutable std::mutex mMutex;
+  std::unordered_map<std::string, std::shared_future<Value>> mFlights;
+  Statistics mStatistics;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_SINGLE_FLIGHT_H_
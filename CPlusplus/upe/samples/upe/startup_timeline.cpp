@@ -0,0 +1,92 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "startup_timeline.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+namespace {
+
+const char* GetStageName(sample::upe::StartupTimeline::Stage stage) {
+  switch (stage) {
+    case sample::upe::StartupTimeline::Stage::InputReady:
+      return "input ready";
+    case sample::upe::StartupTimeline::Stage::ProfileLoaded:
+      return "profile loaded";
+    case sample::upe::StartupTimeline::Stage::EngineLoaded:
+      return "engine loaded";
+    case sample::upe::StartupTimeline::Stage::FirstResult:
+      return "first result";
+    default:
+      return "unknown";
+  }
+}
+
+} // namespace
+
+namespace sample {
+namespace upe {
+
+StartupTimeline::StartupTimeline() : mStart(Clock::now()) {
+  for (std::atomic<int64_t>& elapsed : mElapsedMicroseconds)
+    elapsed = -1;
+}
+
+void StartupTimeline::Record(Stage stage) {
+  std::atomic<int64_t>& elapsed = mElapsedMicroseconds[static_cast<size_t>(stage)];
+  if (elapsed.load(std::memory_order_relaxed) >= 0)
+    return;
+
+  int64_t expected = -1;
+  elapsed.compare_exchange_strong(
+      expected, std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - mStart).count());
+}
+
+void StartupTimeline::Print(std::ostream& output) const {
+  vector<pair<int64_t, Stage>> stages;
+  for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i) {
+    int64_t elapsed = mElapsedMicroseconds[i].load();
+    if (elapsed >= 0)
+      stages.emplace_back(elapsed, static_cast<Stage>(i));
+  }
+  std::sort(stages.begin(), stages.end());
+
+  output << "  Startup:";
+  for (size_t i = 0; i < stages.size(); ++i) {
+    output << (i == 0 ? " " : ", ") << GetStageName(stages[i].second) << " after " << stages[i].first / 1000 << "." <<
+        (stages[i].first % 1000) / 100 << " ms";
+  }
+  output << std::endl;
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,71 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_STARTUP_TIMELINE_H_
+#define SAMPLES_UPE_STARTUP_TIMELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace sample {
+namespace upe {
+
+// Records when each startup milestone was first reached, relative to construction (the start of main). Stages are
+// reached from whichever thread gets there first; later records of the same stage are ignored.
+class StartupTimeline {
+public:
+  enum class Stage {
+    InputReady,    // options parsed and batch input opened
+    ProfileLoaded,
+    EngineLoaded,  // engine for <username> created/loaded
+    FirstResult,   // first result written (or, for --serve, first request answered)
+    Count,
+  };
+
+  StartupTimeline();
+
+  void Record(Stage stage);
+
+  // Prints the stages reached so far, in order of time
+  void Print(std::ostream& output) const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  StartupTimeline(const StartupTimeline&);
+  StartupTimeline& operator=(const StartupTimeline&);
+
+  const Clock::time_point mStart;
+  std::atomic<int64_t> mElapsedMicroseconds[static_cast<size_t>(Stage::Count)]; // -1 until reached
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_STARTUP_TIMELINE_H_
@@ -0,0 +1,95 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_STRING_VIEW_H_
+#define SAMPLES_UPE_STRING_VIEW_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace sample {
+namespace upe {
+
+// Characters held elsewhere (e.g. in an encoded result or a memory-mapped file), referenced without copying them. Only
+// valid while they are.
+class StringView {
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  StringView() : mData(nullptr), mSize(0) {}
+  StringView(const char* data, size_t size) : mData(data), mSize(size) {}
+  StringView(const std::string& value) : mData(value.data()), mSize(value.size()) {}
+  StringView(const char* value) : mData(value), mSize(strlen(value)) {}
+
+  const char* GetData() const { return mData; }
+  size_t GetSize() const { return mSize; }
+  bool IsEmpty() const { return mSize == 0; }
+  char operator[](size_t index) const { return mData[index]; }
+
+  std::string ToString() const { return std::string(mData, mSize); }
+
+  // Characters from 'position' to the end of the view, or 'count' of them if fewer
+  StringView Substr(size_t position, size_t count = npos) const {
+    if (position > mSize)
+      position = mSize;
+    return StringView(mData + position, count < mSize - position ? count : mSize - position);
+  }
+
+  // Position of the first 'c' at or after 'position', or npos
+  size_t Find(char c, size_t position = 0) const {
+    if (position >= mSize)
+      return npos;
+    const void* found = memchr(mData + position, c, mSize - position);
+    return nullptr == found ? npos : static_cast<size_t>(static_cast<const char*>(found) - mData);
+  }
+
+  bool StartsWith(const StringView& prefix) const {
+    return prefix.mSize <= mSize && (prefix.mSize == 0 || memcmp(mData, prefix.mData, prefix.mSize) == 0);
+  }
+
+  // Orders by bytes, as std::string does
+  bool operator<(const StringView& other) const {
+    size_t size = mSize < other.mSize ? mSize : other.mSize;
+    int result = size == 0 ? 0 : memcmp(mData, other.mData, size);
+    return result < 0 || (result == 0 && mSize < other.mSize);
+  }
+
+  bool operator==(const StringView& other) const {
+    return mSize == other.mSize && (mSize == 0 || memcmp(mData, other.mData, mSize) == 0);
+  }
+  bool operator!=(const StringView& other) const { return !(*this == other); }
+
+private:
+  const char* mData;
+  size_t mSize;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_STRING_VIEW_H_
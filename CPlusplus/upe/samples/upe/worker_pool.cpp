@@ -0,0 +1,124 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "worker_pool.h"
+
+using std::exception_ptr;
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+namespace sample {
+namespace upe {
+
+WorkerPool::WorkerPool(size_t threadCount)
+    : mTask(nullptr),
+      mItemCount(0),
+      mNextItem(0),
+      mGeneration(0),
+      mActiveWorkers(0),
+      mIsStopping(false) {
+  if (threadCount == 0)
+    threadCount = 1;
+  mThreads.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; ++i)
+    mThreads.emplace_back(&WorkerPool::WorkerLoop, this, i);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mIsStopping = true;
+  }
+  mWorkAvailable.notify_all();
+  for (thread& workerThread : mThreads)
+    workerThread.join();
+}
+
+void WorkerPool::ParallelFor(size_t itemCount, const function<void(size_t, size_t)>& task) {
+  if (itemCount == 0)
+    return;
+
+  exception_ptr error;
+  {
+    unique_lock<mutex> lock(mMutex);
+    mTask = &task;
+    mItemCount = itemCount;
+    mNextItem = 0;
+    mActiveWorkers = mThreads.size();
+    mError = nullptr;
+    ++mGeneration;
+    mWorkAvailable.notify_all();
+
+    mWorkDone.wait(lock, [this] { return mActiveWorkers == 0; });
+    mTask = nullptr;
+    error = mError;
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void WorkerPool::WorkerLoop(size_t workerIndex) {
+  size_t lastGeneration = 0;
+  for (;;) {
+    {
+      unique_lock<mutex> lock(mMutex);
+      mWorkAvailable.wait(lock, [this, lastGeneration] { return mIsStopping || mGeneration != lastGeneration; });
+      if (mIsStopping)
+        return;
+      lastGeneration = mGeneration;
+    }
+
+    RunItems(workerIndex);
+
+    lock_guard<mutex> lock(mMutex);
+    if (--mActiveWorkers == 0)
+      mWorkDone.notify_one();
+  }
+}
+
+void WorkerPool::RunItems(size_t workerIndex) {
+  for (;;) {
+    size_t item = mNextItem.fetch_add(1);
+    if (item >= mItemCount)
+      return;
+
+    try {
+      (*mTask)(workerIndex, item);
+    } catch (...) {
+      lock_guard<mutex> lock(mMutex);
+      if (!mError)
+        mError = std::current_exception();
+    }
+  }
+}
+
+} // namespace sample
+} // namespace upe
@@ -0,0 +1,80 @@
+/**
+ *
+ * Copyright (c) Microsoft Corporation.
+ * All rights reserved.
+ *
+ * This code is licensed under the MIT License.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLES_UPE_WORKER_POOL_H_
+#define SAMPLES_UPE_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sample {
+namespace upe {
+
+// Fixed set of threads that repeatedly run a task over a range of items. Each thread has a stable worker index in
+// [0, GetThreadCount()) so callers can keep per-worker state (e.g. a PolicyHandler) without locking.
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t threadCount);
+  ~WorkerPool();
+
+  size_t GetThreadCount() const { return mThreads.size(); }
+
+  // Calls task(workerIndex, itemIndex) once for every item in [0, itemCount), with items claimed dynamically by idle
+  // workers, and returns once all have completed. If a task throws, the first exception is rethrown here after the
+  // remaining items have run. Not reentrant.
+  void ParallelFor(size_t itemCount, const std::function<void(size_t, size_t)>& task);
+
+private:
+  WorkerPool(const WorkerPool&);
+  WorkerPool& operator=(const WorkerPool&);
+
+  void WorkerLoop(size_t workerIndex);
+  void RunItems(size_t workerIndex);
+
+  std::vector<std::thread> mThreads;
+  std::mutex mMutex;
+  std::condition_variable mWorkAvailable;
+  std::condition_variable mWorkDone;
+  const std::function<void(size_t, size_t)>* mTask;
+  size_t mItemCount;
+  std::atomic<size_t> mNextItem;
+  size_t mGeneration;
+  size_t mActiveWorkers;
+  std::exception_ptr mError;
+  bool mIsStopping;
+};
+
+} // namespace sample
+} // namespace upe
+
+#endif // SAMPLES_UPE_WORKER_POOL_H_